@@ -8,6 +8,9 @@
 #include "Volume.h"
 #include "Tier.h"
 #include "SegmentManager.h"
+#include "GcManager.h"
+#include "FreqSketch.h"
+#include "SegReplayer.h"
 
 using namespace std;
 
@@ -15,16 +18,19 @@ namespace hlkvds {
 
 DS_MultiTier_Impl::DS_MultiTier_Impl(Options& opts, vector<BlockDevice*> &dev_vec,
                             SuperBlockManager* sb, IndexManager* idx) :
-        options_(opts), bdVec_(dev_vec), sbMgr_(sb), idxMgr_(idx) {
+        options_(opts), bdVec_(dev_vec), sbMgr_(sb), idxMgr_(idx),
+        promoteSketch_(NULL), promotedNum_(0), promoteWQ_(NULL) {
     mt_ = new MediumTier(options_, sbMgr_, idxMgr_);
     ft_ = new FastTier(options_, sbMgr_, idxMgr_, mt_);
     lastTime_ = new KVTime();
+    promoteSketch_ = new FreqSketch(PROMOTE_SKETCH_WIDTH);
 }
 
 DS_MultiTier_Impl::~DS_MultiTier_Impl() {
     delete mt_;
     delete ft_;
     delete lastTime_;
+    delete promoteSketch_;
 }
 
 void DS_MultiTier_Impl::InitSegmentBuffer() {
@@ -34,9 +40,19 @@ void DS_MultiTier_Impl::InitSegmentBuffer() {
 void DS_MultiTier_Impl::StartThds() {
     ft_->StartThds();
     mt_->StartThds();
+
+    promoteWQ_ = new PromoteWQ(this, PROMOTE_THREADS);
+    promoteWQ_->Start();
 }
 
 void DS_MultiTier_Impl::StopThds() {
+    // pending promotions still go through FastTier
+    if (promoteWQ_) {
+        promoteWQ_->Stop();
+        delete promoteWQ_;
+        promoteWQ_ = NULL;
+    }
+
     mt_->StopThds();
     ft_->StopThds();
 }
@@ -50,12 +66,28 @@ void DS_MultiTier_Impl::printDeviceTopologyInfo() {
 void DS_MultiTier_Impl::printDynamicInfo() {
     __INFO("\n\t DS_MultiTier_Impl Dynamic information: \n"
             "\t Request Queue Size          : %d\n"
-            "\t Segment Write Queue Size    : %d\n",
+            "\t Segment Write Queue Size    : %d\n"
+            "\t GC Bytes Relocated          : %lu\n"
+            "\t GC Bytes Read               : %lu\n"
+            "\t Keys Promoted               : %lu\n",
             ft_->getReqQueSize(),
-            ft_->getSegWriteQueSize());
+            ft_->getSegWriteQueSize(),
+            GcManager::GetRelocatedBytes(), GcManager::GetReadBytes(),
+            promotedNum_.load());
 }
 
+// Large and cold values go straight to MediumTier, they would only take
+// FastTier space until migration copies them down. FastTier takes them
+// when MediumTier has no room.
 Status DS_MultiTier_Impl::WriteData(KVSlice& slice, bool immediately) {
+    if (slice.GetData() && mt_->GetVolumeNum() && (slice.IsCold() ||
+            (options_.direct_medium_size > 0 && slice.GetDataLen() >= options_.direct_medium_size))) {
+        Status s = mt_->WriteData(slice);
+        if (s.ok()) {
+            return s;
+        }
+        __DEBUG("Write key %s to Medium Tier failed: %s", slice.GetKeyStr().c_str(), s.ToString().c_str());
+    }
     return ft_->WriteData(slice, immediately);
 }
 
@@ -63,15 +95,51 @@ Status DS_MultiTier_Impl::WriteBatchData(WriteBatch *batch) {
     return ft_->WriteBatchData(batch);
 }
 
-Status DS_MultiTier_Impl::ReadData(KVSlice &slice, std::string &data) {
+Status DS_MultiTier_Impl::ReadData(KVSlice &slice, std::string &data, ReadTier *tier) {
     HashEntry *entry;
     entry = &slice.GetHashEntry();
 
     TierType tier_type = locateTierFromEntry(entry);
+    if (tier) {
+        *tier = tier_type == TierType::FastTierType ? ReadTier::FAST : ReadTier::MEDIUM;
+    }
     if (tier_type == TierType::FastTierType) {
         return ft_->ReadData(slice, data);
     }
-    return mt_->ReadData(slice, data);
+    Status s = mt_->ReadData(slice, data);
+    if (s.ok()) {
+        countMediumRead(slice, data);
+    }
+    return s;
+}
+
+// A key over the read threshold is queued for promotion, unless the
+// queue is full or FastTier is already above its migration watermark,
+// where the copy would soon be demoted again.
+void DS_MultiTier_Impl::countMediumRead(KVSlice &slice, std::string &data) {
+    if (options_.promote_threshold <= 0 || !promoteWQ_) {
+        return;
+    }
+    if (promoteSketch_->Add(slice.GetDigest()) < (uint32_t) options_.promote_threshold) {
+        return;
+    }
+    if (promoteWQ_->Size() >= PROMOTE_QUEUE_MAX || ft_->GetUtilRate() > options_.mig_upper_level) {
+        return;
+    }
+
+    KVSlice *copy = new KVSlice(slice.GetKey(), slice.GetKeyLen(), data.c_str(), data.size(), true);
+    copy->SetHashEntryBeforeGC(&slice.GetHashEntry());
+    promoteWQ_->Add_task(copy);
+}
+
+void DS_MultiTier_Impl::promote(KVSlice *slice) {
+    Status s = ft_->PromoteData(*slice);
+    if (s.ok()) {
+        promotedNum_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        __DEBUG("Promote key %s failed: %s", slice->GetKeyStr().c_str(), s.ToString().c_str());
+    }
+    delete slice;
 }
 
 void DS_MultiTier_Impl::ManualGC() {
@@ -235,6 +303,16 @@ bool DS_MultiTier_Impl::OpenAllComponents() {
     return true;
 }
 
+bool DS_MultiTier_Impl::ReplaySegments(uint64_t since) {
+    std::vector<Volume *> vols;
+    vols.push_back(ft_->GetVolume());
+    for (uint32_t i = 0; i < mt_->GetVolumeNum(); i++) {
+        vols.push_back(mt_->GetVolume(i));
+    }
+    SegReplayer replayer(vols, idxMgr_, since);
+    return replayer.Replay();
+}
+
 uint32_t DS_MultiTier_Impl::GetTotalSegNum() {
     return ft_->GetTotalSegNum() + mt_->GetTotalSegNum();
 }
@@ -251,6 +329,14 @@ void DS_MultiTier_Impl::ModifyDeathEntry(HashEntry &entry) {
     return mt_->ModifyDeathEntry(entry);
 }
 
+void DS_MultiTier_Impl::ModifyLiveEntry(HashEntry &entry) {
+    TierType tier_type = locateTierFromEntry(&entry);
+    if (tier_type == TierType::FastTierType) {
+        return ft_->ModifyLiveEntry(entry);
+    }
+    return mt_->ModifyLiveEntry(entry);
+}
+
 std::string DS_MultiTier_Impl::GetKeyByHashEntry(HashEntry *entry) {
     TierType tier_type = locateTierFromEntry(entry);
     if (tier_type == TierType::FastTierType) {
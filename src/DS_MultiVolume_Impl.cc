@@ -7,6 +7,8 @@
 #include "IndexManager.h"
 #include "Volume.h"
 #include "SegmentManager.h"
+#include "GcManager.h"
+#include "SegReplayer.h"
 
 using namespace std;
 
@@ -15,26 +17,24 @@ namespace hlkvds {
 DS_MultiVolume_Impl::DS_MultiVolume_Impl(Options& opts, vector<BlockDevice*> &dev_vec,
                             SuperBlockManager* sb, IndexManager* idx) :
         options_(opts), bdVec_(dev_vec), sbMgr_(sb), idxMgr_(idx), segSize_(0), maxValueLen_(0),
-        volNum_(0), segTotalNum_(0), sstLengthOnDisk_(0), pickVolId_(-1), segWteWQ_(NULL), segTimeoutT_stop_(false) {
+        volNum_(0), segTotalNum_(0), sstLengthOnDisk_(0), pickVolId_(-1), segTimeoutT_stop_(false) {
     shardsNum_ = options_.shards_num;
+    segShards_ = new SegShardTable(shardsNum_);
     lastTime_ = new KVTime();
 }
 
 DS_MultiVolume_Impl::~DS_MultiVolume_Impl() {
     deleteAllSegments();
     deleteAllVolumes();
+    delete segShards_;
     delete lastTime_;
 }
 
 void DS_MultiVolume_Impl::InitSegmentBuffer() {
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_);
     for (int i = 0; i < shardsNum_; i++) {
         int vol_id = pickVol();
-        SegForReq * seg = new SegForReq(volMap_[vol_id], idxMgr_, options_.expired_time);
-        segMap_.insert(make_pair(i, seg));
-
-        std::mutex *seg_mtx = new mutex();
-        segMtxVec_.push_back(seg_mtx);
+        SegForReq * seg = segShards_->NewSeg(i, volMap_[vol_id], idxMgr_, options_.expired_time);
+        segShards_->Swap(i, seg);
     }
 }
 
@@ -45,18 +45,31 @@ void DS_MultiVolume_Impl::StartThds() {
         reqWQVec_.push_back(req_wq);
     }
 
-    segWteWQ_ = new SegmentWriteWQ(this, options_.seg_write_thread);
-    segWteWQ_->Start();
+    for (uint32_t i = 0; i < volNum_; i++) {
+        int depth = min(volMap_[i]->GetQueueDepth(), options_.seg_write_thread);
+        SegmentWriteWQ *seg_wq = new SegmentWriteWQ(this, max(depth, 1));
+        seg_wq->Start();
+        segWteWQVec_.push_back(seg_wq);
+    }
 
     segTimeoutT_stop_.store(false);
     segTimeoutT_ = std::thread(&DS_MultiVolume_Impl::SegTimeoutThdEntry, this);
 
     for (uint32_t i = 0; i < volNum_; i++) {
+        logVec_.push_back(new SegAppendLog(volMap_[i], idxMgr_));
         volMap_[i]->StartThds();
     }
 }
 
 void DS_MultiVolume_Impl::StopThds() {
+    for (uint32_t i = 0; i < logVec_.size(); i++) {
+        if (!logVec_[i]->Seal()) {
+            __ERROR("Seal append log of volume %u failed", i);
+        }
+        delete logVec_[i];
+    }
+    logVec_.clear();
+
     for (uint32_t i = 0; i < volNum_; i++) {
         volMap_[i]->StopThds();
     }
@@ -71,10 +84,12 @@ void DS_MultiVolume_Impl::StopThds() {
     }
     reqWQVec_.clear();
 
-    if (segWteWQ_) {
-        segWteWQ_->Stop();
-        delete segWteWQ_;
+    for (uint32_t i = 0; i < segWteWQVec_.size(); i++) {
+        SegmentWriteWQ *seg_wq = segWteWQVec_[i];
+        seg_wq->Stop();
+        delete seg_wq;
     }
+    segWteWQVec_.clear();
 }
 
 void DS_MultiVolume_Impl::printDeviceTopologyInfo() {
@@ -93,8 +108,17 @@ void DS_MultiVolume_Impl::printDeviceTopologyInfo() {
 void DS_MultiVolume_Impl::printDynamicInfo() {
     __INFO("\n DS_MultiVolume_Impl Dynamic information: \n"
             "\t Request Queue Size          : %d\n"
-            "\t Segment Write Queue Size    : %d\n",
-            getReqQueSize(), getSegWriteQueSize());
+            "\t Segment Write Queue Size    : %d\n"
+            "\t Pool Allocations            : %lu\n"
+            "\t Pool Reuses                 : %lu\n"
+            "\t Segment Bytes Copied        : %lu\n"
+            "\t Segment Bytes Zero-copy     : %lu\n"
+            "\t GC Bytes Relocated          : %lu\n"
+            "\t GC Bytes Read               : %lu\n",
+            getReqQueSize(), getSegWriteQueSize(),
+            PoolStat::GetAllocCount(), PoolStat::GetReuseCount(),
+            SegWriteStat::GetCopiedBytes(), SegWriteStat::GetZeroCopyBytes(),
+            GcManager::GetRelocatedBytes(), GcManager::GetReadBytes());
 }
 
 Status DS_MultiVolume_Impl::WriteData(KVSlice& slice, bool immediately) {
@@ -149,13 +173,18 @@ Status DS_MultiVolume_Impl::WriteBatchData(WriteBatch *batch) {
     }
 
     uint32_t free_size = seg->GetFreeSize();
+    vol->Pin(seg_id);
     vol->Use(seg_id, free_size);
     seg->UpdateToIndex();
+    vol->Unpin(seg_id);
     delete seg;
     return Status::OK();
 }
 
-Status DS_MultiVolume_Impl::ReadData(KVSlice &slice, string &data) {
+Status DS_MultiVolume_Impl::ReadData(KVSlice &slice, string &data, ReadTier *tier) {
+    if (tier) {
+        *tier = ReadTier::SINGLE;
+    }
     HashEntry *entry;
     entry = &slice.GetHashEntry();
 
@@ -339,6 +368,15 @@ bool DS_MultiVolume_Impl::CreateAllComponents(uint64_t sst_offset) {
     return true;
 }
 
+bool DS_MultiVolume_Impl::ReplaySegments(uint64_t since) {
+    std::vector<Volume *> vols;
+    for (map<int, Volume *>::iterator iter = volMap_.begin(); iter != volMap_.end(); iter++) {
+        vols.push_back(iter->second);
+    }
+    SegReplayer replayer(vols, idxMgr_, since);
+    return replayer.Replay();
+}
+
 bool DS_MultiVolume_Impl::OpenAllComponents() {
     volNum_ = sbResHeader_.volume_num;
     segSize_ = sbResHeader_.segment_size;
@@ -383,6 +421,11 @@ void DS_MultiVolume_Impl::ModifyDeathEntry(HashEntry &entry) {
     volMap_[vol_id]->ModifyDeathEntry(entry);
 }
 
+void DS_MultiVolume_Impl::ModifyLiveEntry(HashEntry &entry) {
+    int vol_id = getVolIdFromEntry(&entry);
+    volMap_[vol_id]->ModifyLiveEntry(entry);
+}
+
 string DS_MultiVolume_Impl::GetKeyByHashEntry(HashEntry *entry) {
     uint64_t key_offset = 0;
 
@@ -439,49 +482,47 @@ string DS_MultiVolume_Impl::GetValueByHashEntry(HashEntry *entry) {
 
 Status DS_MultiVolume_Impl::writeDataAggregate(KVSlice& slice) {
 
-    Request *req = new Request(slice);
-
     int shards_id = calcShardId(slice);
-    req->SetShardsWQId(shards_id);
+    Request *req = segShards_->NewRequest(shards_id, slice);
     ReqsMergeWQ *req_wq = reqWQVec_[shards_id];
     req_wq->Add_task(req);
 
     req->Wait();
     Status s = updateMeta(req);
-    delete req;
+    segShards_->FreeRequest(req);
     return s;
 }
 
 Status DS_MultiVolume_Impl::writeDataImmediately(KVSlice& slice) {
-    uint32_t seg_id = 0;
-    bool ret = false;
-
     int vol_id = pickVol();
     Volume *vol = volMap_[vol_id];
+    SegAppendLog *log = logVec_[vol_id];
 
-    //TODO: use GcSegment first, need abstract segment.
-    while (!vol->Alloc(seg_id)) {
-        ret = vol->ForeGC();
-        if (!ret) {
-            __ERROR("Cann't get a new Empty Segment.\n");
-            return Status::Aborted("Can't allocate a Empty Segment.");
+    std::lock_guard<std::mutex> l(log->GetMutex());
+    if (!log->TryPut(&slice)) {
+        if (!log->Seal()) {
+            __ERROR("Seal append log failed, seg_id = %d", log->GetSegId());
+        }
+
+        uint32_t seg_id = 0;
+        while (!vol->Alloc(seg_id)) {
+            if (!vol->ForeGC()) {
+                __ERROR("Cann't get a new Empty Segment.\n");
+                return Status::Aborted("Can't allocate a Empty Segment.");
+            }
+        }
+        if (!log->Open(seg_id)) {
+            __ERROR("Open append log failed");
+            vol->FreeForFailed(seg_id);
+            return Status::IOError("could not open append log on device");
         }
     }
 
-    SegLatencyFriendly *seg = new SegLatencyFriendly(vol, idxMgr_);
-    seg->Put(&slice);
-    seg->SegSegId(seg_id);
-    ret = seg->WriteSegToDevice();
-    if(!ret) {
-        __ERROR("Write batch segment to device failed");
-        vol->FreeForFailed(seg_id);
-        delete seg;
-        return Status::IOError("could not write batch segment to device ");
+    if (!log->Append(&slice)) {
+        __ERROR("Append to log failed");
+        return Status::IOError("could not append data to device");
     }
-    uint32_t free_size = seg->GetFreeSize();
-    vol->Use(seg_id, free_size);
-    seg->UpdateToIndex();
-    delete seg;
+    idxMgr_->UpdateIndex(&slice);
     return Status::OK();
 }
 
@@ -535,7 +576,11 @@ uint32_t DS_MultiVolume_Impl::getReqQueSize() {
 }
 
 uint32_t DS_MultiVolume_Impl::getSegWriteQueSize() {
-    return (!segWteWQ_)? 0 : segWteWQ_->Size();
+    uint32_t que_size = 0;
+    for (uint32_t i = 0; i < segWteWQVec_.size(); i++) {
+        que_size += segWteWQVec_[i]->Size();
+    }
+    return que_size;
 }
 
 Status DS_MultiVolume_Impl::updateMeta(Request *req) {
@@ -564,15 +609,11 @@ void DS_MultiVolume_Impl::deleteAllVolumes() {
 }
 
 void DS_MultiVolume_Impl::deleteAllSegments() {
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_);
     for (int i = 0; i< shardsNum_; i++) {
-        SegForReq* seg = segMap_[i];
+        std::lock_guard<std::mutex> l(segShards_->GetMutex(i));
+        SegForReq* seg = segShards_->Swap(i, NULL);
         delete seg;
-        std::mutex *seg_mtx = segMtxVec_[i];
-        delete seg_mtx;
     }
-    segMap_.clear();
-    segMtxVec_.clear();
 }
 
 void DS_MultiVolume_Impl::initSBReservedContentForCreate() {
@@ -615,14 +656,37 @@ bool DS_MultiVolume_Impl::verifyTopology() {
     return true;
 }
 
+// Pick the volume a new segment will be written soonest: queued writes
+// times recent write latency, spread over the device queue depth.
+// Running GC, a short free list and a fuller volume all raise the cost.
+// Ties keep the round robin order.
 int DS_MultiVolume_Impl::pickVol() {
     std::lock_guard <std::mutex> l(volIdMtx_);
-    if ( pickVolId_ == (int)(volNum_ - 1) ){
-        pickVolId_ = 0;
-    }
-    else {
-        pickVolId_++;
+    int best_id = -1;
+    double best_cost = 0;
+    for (uint32_t i = 0; i < volNum_; i++) {
+        int vol_id = (pickVolId_ + 1 + i) % volNum_;
+        Volume *vol = volMap_[vol_id];
+
+        int depth = max(vol->GetQueueDepth(), 1);
+        uint64_t lat = max(vol->GetWriteLatency(), (uint64_t)1);
+        double cost = (double)(vol->GetPendingWrites() + 1) * lat / depth;
+
+        if (vol->IsGCRunning()) {
+            cost *= PICK_GC_PENALTY;
+        }
+        uint32_t free_segs = vol->GetTotalFreeSegs();
+        if (free_segs <= SEG_RESERVED_FOR_GC) {
+            cost *= PICK_FULL_PENALTY;
+        }
+        cost *= 2 - (double)free_segs / vol->GetNumberOfSeg();
+
+        if (best_id < 0 || cost < best_cost) {
+            best_id = vol_id;
+            best_cost = cost;
+        }
     }
+    pickVolId_ = best_id;
     return pickVolId_;
 }
 
@@ -639,35 +703,30 @@ int DS_MultiVolume_Impl::calcShardId(KVSlice& slice) {
 void DS_MultiVolume_Impl::ReqMerge(Request* req) {
     int shard_id = req->GetShardsWQId();
 
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_, std::defer_lock);
-
-    std::mutex *seg_mtx = segMtxVec_[shard_id];
-    std::unique_lock<std::mutex> lck_seg(*seg_mtx);
-
-    lck_seg_map.lock();
-    SegForReq *seg = segMap_[shard_id];
-    lck_seg_map.unlock();
+    std::unique_lock<std::mutex> lck_seg(segShards_->GetMutex(shard_id));
+    SegForReq *seg = segShards_->Get(shard_id);
 
     if (seg->TryPut(req)) {
         seg->Put(req);
     } else {
         seg->Completion();
-        segWteWQ_->Add_task(seg);
+        addToSegWrite(seg);
 
         int vol_id = pickVol();
-        seg = new SegForReq(volMap_[vol_id], idxMgr_, options_.expired_time);
-
-        lck_seg_map.lock();
-        std::map<int, SegForReq*>::iterator iter = segMap_.find(shard_id);
-        segMap_.erase(iter);
-        segMap_.insert( make_pair(shard_id, seg) );
-        lck_seg_map.unlock();
+        seg = segShards_->NewSeg(shard_id, volMap_[vol_id], idxMgr_, options_.expired_time);
+        segShards_->Swap(shard_id, seg);
 
         seg->Put(req);
     }
 
 }
 
+void DS_MultiVolume_Impl::addToSegWrite(SegForReq *seg) {
+    Volume *vol = seg->GetSelfVolume();
+    vol->IncPendingWrites();
+    segWteWQVec_[vol->GetId()]->Add_task(seg);
+}
+
 void DS_MultiVolume_Impl::SegWrite(SegForReq *seg) {
     Volume *vol =  seg->GetSelfVolume();
 
@@ -677,47 +736,41 @@ void DS_MultiVolume_Impl::SegWrite(SegForReq *seg) {
         res = vol->ForeGC();
         if (!res) {
             __ERROR("Cann't get a new Empty Segment.\n");
+            vol->DecPendingWrites();
             seg->Notify(res);
+            return;
         }
     }
     uint32_t free_size = seg->GetFreeSize();
     seg->SetSegId(seg_id);
     res = seg->WriteSegToDevice();
     if (res) {
+        // GC must not take the segment before its requests are indexed,
+        // the segment reaper unpins it
+        vol->Pin(seg_id);
         vol->Use(seg_id, free_size);
     } else {
         vol->FreeForFailed(seg_id);
     }
+    vol->DecPendingWrites();
     seg->Notify(res);
 }
 
 void DS_MultiVolume_Impl::SegTimeoutThdEntry() {
     __DEBUG("Segment Timeout thread start!!");
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_, std::defer_lock);
 
     while (!segTimeoutT_stop_) {
         for ( int i = 0; i < shardsNum_; i++) {
-            std::mutex *mtx = segMtxVec_[i];
-            std::unique_lock<std::mutex> l(*mtx);
-
-            lck_seg_map.lock();
-            SegForReq *seg = segMap_[i];
-            lck_seg_map.unlock();
-
+            std::unique_lock<std::mutex> l(segShards_->GetMutex(i));
+            SegForReq *seg = segShards_->Get(i);
             if (seg->IsExpired()) {
                 seg->Completion();
 
-                segWteWQ_->Add_task(seg);
+                addToSegWrite(seg);
                 int vol_id = pickVol();
-                seg = new SegForReq(volMap_[vol_id], idxMgr_, options_.expired_time);
-
-                lck_seg_map.lock();
-                std::map<int, SegForReq*>::iterator iter = segMap_.find(i);
-                segMap_.erase(iter);
-                segMap_.insert( make_pair(i, seg) );
-                lck_seg_map.unlock();
+                seg = segShards_->NewSeg(i, volMap_[vol_id], idxMgr_, options_.expired_time);
+                segShards_->Swap(i, seg);
             }
-
         }
 
         usleep(options_.expired_time);
@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "FreqSketch.h"
+#include "KeyDigestHandle.h"
+#include "Db_Structure.h"
+
+namespace hlkvds {
+
+FreqSketch::FreqSketch(uint32_t width) : mask_(0), adds_(0), ageAdds_(0) {
+    uint32_t w = 1;
+    while (w < width) {
+        w <<= 1;
+    }
+    mask_ = w - 1;
+    counters_.resize((size_t) w * PROMOTE_SKETCH_ROWS, 0);
+    ageAdds_ = (uint64_t) w * PROMOTE_SKETCH_AGE;
+}
+
+FreqSketch::~FreqSketch() {
+}
+
+// Only the smallest counters of a key are raised (conservative update),
+// which keeps keys sharing a counter from inflating each other.
+uint32_t FreqSketch::Add(const Kvdb_Digest &digest) {
+    uint32_t words[PROMOTE_SKETCH_ROWS];
+    memcpy(words, digest.GetDigest(), sizeof(words));
+
+    std::lock_guard<std::mutex> l(mtx_);
+    uint8_t *cnt[PROMOTE_SKETCH_ROWS];
+    uint32_t min = UINT8_MAX;
+    for (int i = 0; i < PROMOTE_SKETCH_ROWS; i++) {
+        cnt[i] = &counters_[(size_t) i * (mask_ + 1) + (words[i] & mask_)];
+        if (*cnt[i] < min) {
+            min = *cnt[i];
+        }
+    }
+    if (min < UINT8_MAX) {
+        for (int i = 0; i < PROMOTE_SKETCH_ROWS; i++) {
+            if (*cnt[i] == min) {
+                (*cnt[i])++;
+            }
+        }
+        min++;
+    }
+
+    if (++adds_ >= ageAdds_) {
+        age();
+    }
+    return min;
+}
+
+// Must hold mtx_.
+void FreqSketch::age() {
+    for (size_t i = 0; i < counters_.size(); i++) {
+        counters_[i] >>= 1;
+    }
+    adds_ = 0;
+}
+
+}// namespace hlkvds
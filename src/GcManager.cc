@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "GcManager.h"
 #include "Db_Structure.h"
 #include "IndexManager.h"
@@ -7,18 +8,45 @@
 using namespace std;
 
 namespace hlkvds {
+std::atomic<uint64_t> GcManager::relocatedBytes_(0);
+std::atomic<uint64_t> GcManager::readBytes_(0);
+
 GcManager::~GcManager() {
-    free(dataBuf_);
-    dataBuf_ = NULL;
+    loadWQ_->Stop();
+    writeWQ_->Stop();
+    delete loadWQ_;
+    delete writeWQ_;
+
+    // victims of unwritten streams still hold their data, just drop them
+    for (uint32_t gen = 0; gen < streams_.size(); gen++) {
+        delete streams_[gen].seg;
+        cleanKvList(streams_[gen].slices);
+    }
+    for (uint32_t i = 0; i < loadBufs_.size(); i++) {
+        free(loadBufs_[i]);
+    }
+    loadBufs_.clear();
 }
 
 GcManager::GcManager(IndexManager* im, Volume* vol, Options &opt) :
-    options_(opt), dataBuf_(NULL) {
+    options_(opt), running_(false), ioClass_(IoClass::BACKGROUND),
+    loadWQ_(NULL), writeWQ_(NULL),
+    pendingWrites_(0), roundFree_(0) {
     idxMgr_ = im;
     vol_ = vol;
+    streams_.resize(std::max(options_.gc_generations, 1) + 1);
 
     uint32_t seg_size = vol_->GetSegmentSize();
-    posix_memalign((void **)&dataBuf_, 4096, seg_size);
+    for (int i = 0; i < GC_LOAD_THREADS; i++) {
+        char *buf = NULL;
+        posix_memalign((void **)&buf, 4096, seg_size);
+        loadBufs_.push_back(buf);
+    }
+
+    loadWQ_ = new GcLoadWQ(this, GC_LOAD_THREADS);
+    loadWQ_->Start();
+    writeWQ_ = new GcWriteWQ(this, GC_WRITE_THREADS);
+    writeWQ_->Start();
 }
 
 bool GcManager::ForeGC() {
@@ -30,15 +58,18 @@ bool GcManager::ForeGC() {
         return true;
     }
 
+    // a writer is waiting for this GC, so it is not background I/O
+    ioClass_ = IoClass::FG_WRITE;
     free_seg_num = 0;
     __DEBUG("Begin Fore GC !");
     while (!free_seg_num) {
         std::multimap < uint32_t, uint32_t > cands_map;
         vol_->SortSegsByUtils(cands_map, options_.seg_full_rate);
         if (cands_map.empty()) {
+            free_seg_num = flushStreams();
             break;
         }
-        free_seg_num = doMerge(cands_map);
+        free_seg_num = doMerge(cands_map, 1);
         cands_map.clear();
         __DEBUG("Once merge total free %d segments!", free_seg_num);
     }
@@ -70,6 +101,7 @@ void GcManager::BackGC() {
     if (waste_rate > options_.gc_upper_level) {
         while (waste_rate > options_.gc_lower_level && used_seg_num > 1) {
             lck_gc.lock();
+            ioClass_ = IoClass::BACKGROUND;
             std::multimap < uint32_t, uint32_t > cands_map;
             vol_->SortSegsByUtils(cands_map, options_.seg_full_rate);
 
@@ -78,7 +110,7 @@ void GcManager::BackGC() {
                 lck_gc.unlock();
                 break;
             }
-            uint32_t total_free = doMerge(cands_map);
+            uint32_t total_free = doMerge(cands_map, GC_ROUND_SEGS);
             cands_map.clear();
 
             data_theory_size = idxMgr_->GetDataTheorySize();
@@ -110,16 +142,18 @@ void GcManager::FullGC() {
 
     while (true) {
         lck_gc.lock();
+        ioClass_ = IoClass::BACKGROUND;
         std::multimap < uint32_t, uint32_t > cands_map;
         vol_->SortSegsByUtils(cands_map, options_.seg_full_rate);
         if (cands_map.size() < SEG_RESERVED_FOR_GC) {
+            flushStreams();
             free_after = vol_->GetTotalFreeSegs();
             used_total = vol_->GetNumberOfSeg() - free_after;
             __DEBUG("End do Full GC! befor have %u segment free, after do full GC now have %u segments free, now used %u segments!", free_before, free_after, used_total);
             break;
         }
 
-        total_free = doMerge(cands_map);
+        total_free = doMerge(cands_map, GC_ROUND_SEGS);
         theory_size = idxMgr_->GetDataTheorySize();
         free_seg_num = vol_->GetTotalFreeSegs();
         used_seg_num = seg_num - free_seg_num;
@@ -132,183 +166,401 @@ void GcManager::FullGC() {
     } __DEBUG("End do Full GC! total free %u segments", free_after - free_before);
 }
 
-uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
-
-    bool ret;
-    std::vector < uint32_t > free_seg_vec;
-    uint32_t last_seg_id = 0;
-    bool need_flag = false;
-    uint32_t total_free = 0;
-
-    std::list<KVSlice*> slice_list;
-    std::list<KVSlice*> recycle_list;
+uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map, uint32_t max_flush) {
+    // doMerge always runs under gcMtx_
+    // the live maps are complete only once the whole index is loaded
+    if (!idxMgr_->LoadAll()) {
+        return 0;
+    }
+    running_.store(true, std::memory_order_relaxed);
+    uint32_t total_free = mergeSegs(cands_map, max_flush);
+    running_.store(false, std::memory_order_relaxed);
+    return total_free;
+}
 
-    std::list<KVSlice*>::iterator slice_iter;
+uint32_t GcManager::mergeSegs(std::multimap<uint32_t, uint32_t> &cands_map, uint32_t max_flush) {
+    uint32_t max_gen = streams_.size() - 1;
+    uint32_t flushed = 0;
+    bool failed = false;
 
-    //handle first segment
-    SegForSlice *seg_first = new SegForSlice(vol_, idxMgr_);
+    std::vector<uint32_t> cands;
     for (std::multimap<uint32_t, uint32_t>::iterator iter = cands_map.begin(); iter
             != cands_map.end(); ++iter) {
-        uint32_t seg_id = iter->second;
-        ret = loadKvList(seg_id, slice_list);
-        if (!ret) {
+        cands.push_back(iter->second);
+    }
+
+    std::vector<char *> free_bufs(loadBufs_);
+    std::deque<GcLoadTask *> loads;
+    size_t next = 0;
+
+    // read ahead only about as much live data as fills the streams the
+    // round flushes, victims loaded but not merged are read for nothing
+    uint64_t ahead_limit = (uint64_t) max_flush * vol_->GetSegmentSize();
+    std::vector<uint64_t> ahead_bytes(streams_.size(), 0);
+
+    // a stream segment stays open across rounds until it is full, its
+    // victims are pinned meanwhile so no round picks them again
+    while (!failed && flushed < max_flush) {
+        while (next < cands.size() && !free_bufs.empty()) {
+            uint32_t gen = vol_->GetSegGeneration(cands[next]);
+            gen = gen < max_gen ? gen + 1 : max_gen;
+            if (!loads.empty() && streams_[gen].bytes + ahead_bytes[gen] >= ahead_limit) {
+                break;
+            }
+            GcLoadTask *task = new GcLoadTask(cands[next++], free_bufs.back());
+            free_bufs.pop_back();
+            task->gen = gen;
+            task->live_size = vol_->GetSegUsedSize(task->seg_id);
+            ahead_bytes[gen] += task->live_size;
+            loads.push_back(task);
+            loadWQ_->Add_task(task);
+        }
+        if (loads.empty()) {
+            break;
+        }
+
+        GcLoadTask *task = loads.front();
+        loads.pop_front();
+        waitLoad(task);
+        free_bufs.push_back(task->buf);
+        ahead_bytes[task->gen] -= task->live_size;
+
+        uint32_t seg_id = task->seg_id;
+        std::list<KVSlice*> &slice_list = task->slices;
+        if (!task->ok) {
+            cleanKvList(slice_list);
+            delete task;
             continue;
         }
 
-        for (slice_iter = slice_list.begin(); slice_iter != slice_list.end();) {
-            KVSlice* slice = *slice_iter;
-            if (seg_first->TryPut(slice)) {
-                seg_first->Put(slice);
-                recycle_list.push_back(*slice_iter);
-                slice_list.erase(slice_iter++);
-            } else {
-                need_flag = true;
-                break;
+        uint32_t gen = task->gen;
+        GcStream &stream = streams_[gen];
+        stream.timestamp = std::max(stream.timestamp, vol_->GetSegTimestamp(seg_id));
+
+        while (!slice_list.empty()) {
+            KVSlice *slice = slice_list.front();
+            if (!stream.seg) {
+                stream.seg = new SegForSlice(vol_, idxMgr_);
+            }
+            if (!stream.seg->TryPut(slice)) {
+                if (stream.slices.empty() || !flushStream(stream, gen)) {
+                    failed = true;
+                    break;
+                }
+                flushed++;
+                continue;
             }
+            stream.seg->Put(slice);
+            stream.bytes += sizeOfSlice(slice);
+            stream.slices.push_back(slice);
+            slice_list.pop_front();
         }
 
-        if (need_flag) {
-            last_seg_id = seg_id;
+        if (failed) {
+            cleanKvList(slice_list);
+            delete task;
             break;
-        } else {
-            free_seg_vec.push_back(seg_id);
         }
+        // freed once the segment holding its last record is written
+        vol_->Pin(seg_id);
+        stream.victims.push_back(seg_id);
+        delete task;
     }
 
-    uint32_t seg_first_id;
-    vol_->AllocForGC(seg_first_id);
-    seg_first->SetSegId(seg_first_id);
-    ret = seg_first->WriteSegToDevice();
-    if (!ret) {
-        __ERROR("Write First GC segment to device failed, free 0 segments");
-        delete seg_first;
-        vol_->FreeForFailed(seg_first_id);
-        cleanKvList(recycle_list);
-        cleanKvList(slice_list);
-        return total_free;
+    // victims read ahead but not merged this round
+    while (!loads.empty()) {
+        GcLoadTask *task = loads.front();
+        loads.pop_front();
+        task->skip.store(true);
+        waitLoad(task);
+        cleanKvList(task->slices);
+        delete task;
     }
 
-    uint32_t free_size = seg_first->GetFreeSize();
-    vol_->Use(seg_first_id, free_size);
+    uint32_t total_free = waitWrites();
+    __DEBUG("Merge %lu candidate segments, free %u segments", cands_map.size(), total_free);
+    return total_free;
+}
 
-    seg_first->UpdateToIndex();
+uint32_t GcManager::flushStreams() {
+    for (uint32_t gen = 1; gen < streams_.size(); gen++) {
+        flushStream(streams_[gen], gen);
+    }
+    return waitWrites();
+}
 
-    //clean work for first segment
-    for (std::vector<uint32_t>::iterator iter = free_seg_vec.begin(); iter
-            != free_seg_vec.end(); ++iter) {
-        vol_->FreeForGC(*iter);
+// Hand the stream segment to the write queue, false if there is no
+// segment left to write it to.
+bool GcManager::flushStream(GcStream &stream, uint32_t gen) {
+    GcWriteTask *task = new GcWriteTask;
+    task->seg = stream.seg;
+    task->gen = gen;
+    task->timestamp = stream.timestamp;
+    task->bytes = stream.bytes;
+    task->slices.swap(stream.slices);
+    task->victims.swap(stream.victims);
+
+    stream.seg = NULL;
+    stream.timestamp = 0;
+    stream.bytes = 0;
+
+    bool ret = true;
+    if (task->seg && !task->slices.empty()) {
+        ret = vol_->AllocForGC(task->seg_id);
+        if (!ret) {
+            __ERROR("No free segment left for GC");
+            delete task->seg;
+            task->seg = NULL;
+        }
+    } else {
+        delete task->seg;
+        task->seg = NULL;
     }
-    delete seg_first;
-    cleanKvList(recycle_list);
 
-    total_free = free_seg_vec.size() - 1;
+    if (!ret) {
+        // the victims keep their data and become candidates again
+        for (std::vector<uint32_t>::iterator iter = task->victims.begin(); iter
+                != task->victims.end(); ++iter) {
+            vol_->Unpin(*iter);
+        }
+        cleanKvList(task->slices);
+        delete task;
+        return false;
+    }
 
-    if (!need_flag) {
-        __DEBUG("All fragment segment merge to 1 segment, and free %d segments", total_free);
-        return total_free;
+    if (task->seg) {
+        task->seg->SetIoClass(ioClass_);
+    }
+    {
+        std::lock_guard<std::mutex> l(taskMtx_);
+        pendingWrites_++;
     }
+    writeWQ_->Add_task(task);
+    return true;
+}
 
-    //handle second segment
-    SegForSlice *seg_second = new SegForSlice(vol_, idxMgr_);
-    uint32_t seg_second_id;
-    vol_->AllocForGC(seg_second_id);
+uint32_t GcManager::waitWrites() {
+    std::unique_lock<std::mutex> l(taskMtx_);
+    taskCv_.wait(l, [this] { return pendingWrites_ == 0; });
+    int32_t total_free = roundFree_;
+    roundFree_ = 0;
+    return total_free > 0 ? (uint32_t) total_free : 0;
+}
 
-    for (slice_iter = slice_list.begin(); slice_iter != slice_list.end(); ++slice_iter) {
-        KVSlice* slice = *slice_iter;
-        seg_second->Put(slice);
+void GcManager::writeTask(GcWriteTask *task) {
+    bool ret = true;
+    int32_t freed = 0;
+    if (task->seg) {
+        task->seg->SetSegId(task->seg_id);
+        ret = task->seg->WriteSegToDevice();
+        if (ret) {
+            vol_->Pin(task->seg_id);
+            vol_->Use(task->seg_id, task->seg->GetFreeSize(), task->timestamp, task->gen);
+            idxMgr_->UpdateIndexesForGC(task->seg->GetSliceList());
+            vol_->Unpin(task->seg_id);
+            relocatedBytes_.fetch_add(task->bytes, std::memory_order_relaxed);
+            freed--;
+        } else {
+            __ERROR("Write GC segment to device failed, seg_id = %u", task->seg_id);
+            vol_->FreeForFailed(task->seg_id);
+        }
     }
 
-    seg_second->SetSegId(seg_second_id);
-    ret = seg_second->WriteSegToDevice();
-    if (!ret) {
-        __ERROR("Write Second GC segment to device failed, but First Segment is completed, free %d segments", total_free);
-        delete seg_second;
-        vol_->FreeForFailed(seg_second_id);
-        cleanKvList(slice_list);
-        return total_free;
+    // on failure the victims keep their data and become candidates again
+    for (std::vector<uint32_t>::iterator iter = task->victims.begin(); iter
+            != task->victims.end(); ++iter) {
+        if (ret) {
+            vol_->FreeForGC(*iter);
+            freed++;
+        }
+        vol_->Unpin(*iter);
     }
 
-    free_size = seg_second->GetFreeSize();
-    vol_->Use(seg_second_id, free_size);
+    delete task->seg;
+    cleanKvList(task->slices);
+    delete task;
 
-    seg_second->UpdateToIndex();
-    vol_->FreeForGC(last_seg_id);
-
-    //clean work for second segment
-    delete seg_second;
-    cleanKvList(slice_list);
+    std::lock_guard<std::mutex> l(taskMtx_);
+    pendingWrites_--;
+    roundFree_ += freed;
+    taskCv_.notify_all();
+}
 
-    __DEBUG("Multiple fragment segments merge to 2 segment, and free %d segments", total_free);
+void GcManager::loadTask(GcLoadTask *task) {
+    if (!task->skip.load()) {
+        task->ok = loadKvList(task->seg_id, task->buf, task->slices);
+    }
+    std::lock_guard<std::mutex> l(taskMtx_);
+    task->done = true;
+    taskCv_.notify_all();
+}
 
-    return total_free;
+void GcManager::waitLoad(GcLoadTask *task) {
+    std::unique_lock<std::mutex> l(taskMtx_);
+    taskCv_.wait(l, [task] { return task->done; });
 }
 
-void GcManager::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
-                          uint64_t phy_offset) {
+// Walk the header chain of a victim whose first read_end bytes are in
+// buf. Headers, keys and unaligned values sit in the head region, which
+// is read further as the walk needs it. Aligned values sit at the tail
+// and only those of live records are read, in a few merged extents.
+bool GcManager::loadSegKV(char *buf, list<KVSlice*> &slice_list, uint32_t num_keys,
+                          uint64_t phy_offset, uint32_t read_end) {
     uint32_t head_offset = SegBase::SizeOfSegOnDisk();
+    uint32_t seg_size = vol_->GetSegmentSize();
     int vol_id = vol_->GetId();
 
+    std::vector<DataHeader> live_headers;
+    std::vector<uint32_t> live_offsets;
+    std::vector<std::pair<uint32_t, uint32_t> > extents;
+
     for (uint32_t index = 0; index < num_keys; index++) {
+        uint32_t need = head_offset + IndexManager::SizeOfDataHeader();
+        if (need > read_end) {
+            uint32_t end = std::min(seg_size, std::max(need, read_end * 2));
+            if (!readSegRange(buf, phy_offset, read_end, end)) {
+                return false;
+            }
+            read_end = end;
+        }
+
         DataHeader header;
-        memcpy(&header, &dataBuf_[head_offset],
+        memcpy(&header, &buf[head_offset],
                IndexManager::SizeOfDataHeader());
+        uint32_t next_offset = header.GetNextHeadOffset();
 
         DataHeaderAddress addrs(vol_id, phy_offset + (uint64_t)head_offset);
         HashEntry hash_entry(header, addrs, NULL);
 
         __DEBUG("load hash_entry from seg_offset = %ld, header_offset = %d", phy_offset, head_offset );
 
-        if (idxMgr_->IsSameInMem(hash_entry)) {
-
-            Kvdb_Digest digest = header.GetDigest();
-            uint16_t data_len = header.GetDataSize();
-            if (data_len != 0) {
-                uint32_t data_offset = header.GetDataOffset();
-                char* data = new char[data_len];
-                memcpy(data, &dataBuf_[data_offset], data_len);
-
-                //memcpy key to KVSlice.GetNextHeadOffsetGetNextHeadOffset
-                uint16_t key_len =header.GetKeySize();
-                uint32_t next_head_offset = header.GetNextHeadOffset();
-                uint32_t key_offset;
-                if (ALIGNED_SIZE == data_len) {
-                    key_offset = next_head_offset - key_len;
-                } else {
-                    key_offset = next_head_offset - data_len - key_len;
+        bool copy = header.GetDataSize() ? vol_->IsLiveEntry(hash_entry)
+                : idxMgr_->KeepTombstone(hash_entry);
+        if (copy) {
+            // the key always follows its header, an aligned value may
+            // be stored inline (append log) or at the segment tail
+            uint32_t data_offset = header.GetDataOffset();
+            uint32_t data_end = data_offset + header.GetDataSize();
+            uint32_t key_end = head_offset + IndexManager::SizeOfDataHeader() + header.GetKeySize();
+            if (data_end > seg_size || key_end > seg_size) {
+                __ERROR("Corrupted record in segment at %lu, head_offset = %u", phy_offset, head_offset);
+                return false;
+            }
+            if (data_offset < next_offset) {
+                need = std::max(key_end, data_end);
+            } else {
+                need = key_end;
+                extents.push_back(std::make_pair(data_offset, data_end));
+            }
+            if (need > read_end) {
+                uint32_t end = std::min(seg_size, std::max(need, read_end * 2));
+                if (!readSegRange(buf, phy_offset, read_end, end)) {
+                    return false;
                 }
-                char* key = new char[key_len+1];
-                memcpy(key, &dataBuf_[key_offset], key_len);
-                key[key_len] = '\0';
-                KVSlice *slice = new KVSlice(&digest, key, key_len, data, data_len);
+                read_end = end;
+            }
+            live_headers.push_back(header);
+            live_offsets.push_back(head_offset);
+        }
+
+        head_offset = next_offset;
+    }
 
-                slice_list.push_back(slice);
-                __DEBUG("the slice key_digest = %s, value = %s, seg_offset = %ld, head_offset = %d is valid, need to write", digest.GetDigest(), data, phy_offset, head_offset);
+    // tail values are packed downwards from the segment end, read the
+    // live ones with as few requests as the gaps between them allow
+    std::sort(extents.begin(), extents.end());
+    uint32_t begin = 0, end = 0;
+    for (uint32_t i = 0; i <= extents.size(); i++) {
+        if (i < extents.size()) {
+            uint32_t ext_begin = std::max(extents[i].first, read_end);
+            uint32_t ext_end = extents[i].second;
+            if (ext_begin >= ext_end) {
+                continue;
             }
+            if (end != 0 && ext_begin <= end + GC_READ_GAP) {
+                end = std::max(end, ext_end);
+                continue;
+            }
+        }
+        if (end != 0 && !readSegRange(buf, phy_offset, begin, end)) {
+            return false;
         }
+        if (i < extents.size()) {
+            begin = std::max(extents[i].first, read_end);
+            end = extents[i].second;
+        }
+    }
+
+    for (uint32_t i = 0; i < live_headers.size(); i++) {
+        DataHeader &header = live_headers[i];
+        uint32_t key_offset = live_offsets[i] + IndexManager::SizeOfDataHeader();
+
+        Kvdb_Digest digest = header.GetDigest();
+        uint16_t data_len = header.GetDataSize();
+        char* data = NULL;
+        if (data_len) {
+            data = new char[data_len];
+            memcpy(data, &buf[header.GetDataOffset()], data_len);
+        }
+
+        uint16_t key_len =header.GetKeySize();
+        char* key = new char[key_len+1];
+        memcpy(key, &buf[key_offset], key_len);
+        key[key_len] = '\0';
 
-        head_offset = header.GetNextHeadOffset();
+        DataHeaderAddress addrs(vol_id, phy_offset + (uint64_t)live_offsets[i]);
+        HashEntry hash_entry(header, addrs, NULL);
+        KVSlice *slice = new KVSlice(&digest, key, key_len, data, data_len);
+        slice->SetHashEntryBeforeGC(&hash_entry);
+
+        slice_list.push_back(slice);
+        __DEBUG("the slice key_digest = %s, seg_offset = %ld, head_offset = %d is valid, need to write", digest.GetDigest(), phy_offset, live_offsets[i]);
     }
+    return true;
+}
 
+// Read [begin, end) of the segment at phy_offset into the same offsets
+// of buf, widened to ALIGNED_SIZE boundaries.
+bool GcManager::readSegRange(char *buf, uint64_t phy_offset, uint32_t begin, uint32_t end) {
+    uint32_t seg_size = vol_->GetSegmentSize();
+    begin = begin / ALIGNED_SIZE * ALIGNED_SIZE;
+    end = std::min(seg_size, (end + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE);
+    if (begin >= end) {
+        return true;
+    }
+    if (!vol_->Read(&buf[begin], end - begin, phy_offset + begin, ioClass_)) {
+        return false;
+    }
+    readBytes_.fetch_add(end - begin, std::memory_order_relaxed);
+    return true;
 }
 
-bool GcManager::loadKvList(uint32_t seg_id, std::list<KVSlice*> &slice_list) {
-    uint64_t seg_phy_off;
+bool GcManager::loadKvList(uint32_t seg_id, char *buf, std::list<KVSlice*> &slice_list) {
+    uint64_t seg_phy_off = 0;
     vol_->CalcSegOffsetFromId(seg_id, seg_phy_off);
 
     uint32_t seg_size = vol_->GetSegmentSize();
-    if (!vol_->Read(dataBuf_, seg_size, seg_phy_off)) {
+    uint32_t read_end = std::min((uint32_t) GC_HEAD_READ_SIZE, seg_size);
+    if (!readSegRange(buf, seg_phy_off, 0, read_end)) {
         return false;
     }
 
     SegHeaderOnDisk seg_header;
-    memcpy(&seg_header, dataBuf_, SegBase::SizeOfSegOnDisk());
+    memcpy(&seg_header, buf, SegBase::SizeOfSegOnDisk());
 
     uint32_t num_keys = seg_header.number_keys;
 
-    loadSegKV(slice_list, num_keys, seg_phy_off);
+    if (!loadSegKV(buf, slice_list, num_keys, seg_phy_off, read_end)) {
+        cleanKvList(slice_list);
+        return false;
+    }
     return true;
 }
 
+uint64_t GcManager::sizeOfSlice(KVSlice *slice) {
+    return IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
+}
+
 void GcManager::cleanKvList(std::list<KVSlice*> &slice_list) {
     while (!slice_list.empty()) {
         KVSlice *slice = slice_list.front();
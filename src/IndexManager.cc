@@ -4,11 +4,15 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <thread>
 
 #include "IndexManager.h"
 #include "Db_Structure.h"
 #include "SuperBlockManager.h"
 #include "DataStor.h"
+#include "Segment.h"
+#include "Volume.h"
+#include "BlockDevice.h"
 
 using namespace std;
 
@@ -16,13 +20,13 @@ namespace hlkvds {
 
 DataHeader::DataHeader() :
     key_digest(Kvdb_Digest()), key_size(0), data_size(0), data_offset(0),
-            next_header_offset(0) {
+            next_header_offset(0), lsn(0) {
 }
 
 DataHeader::DataHeader(const Kvdb_Digest &digest, uint16_t key_len, uint16_t data_len,
-                       uint32_t offset, uint32_t next_offset) :
+                       uint32_t offset, uint32_t next_offset, uint64_t seq) :
     key_digest(digest), key_size(key_len), data_size(data_len), data_offset(offset),
-            next_header_offset(next_offset) {
+            next_header_offset(next_offset), lsn(seq) {
 }
 
 DataHeader::~DataHeader() {
@@ -64,27 +68,22 @@ void HashEntryOnDisk::SetKeyDigest(const Kvdb_Digest& digest) {
 
 HashEntry::HashEntry() :
     cachePtr_(NULL) {
-    stampPtr_ = new LogicStamp;
     entryPtr_ = new HashEntryOnDisk;
 }
 
-HashEntry::HashEntry(HashEntryOnDisk& entry_ondisk, KVTime time_stamp,
-                     void* read_ptr) :
+HashEntry::HashEntry(HashEntryOnDisk& entry_ondisk, void* read_ptr) :
     cachePtr_(read_ptr) {
-    stampPtr_ = new LogicStamp(time_stamp, 0);
     entryPtr_ = new HashEntryOnDisk(entry_ondisk);
 }
 
 HashEntry::HashEntry(DataHeader& data_header, DataHeaderAddress &addrs,
                      void* read_ptr) :
     cachePtr_(read_ptr) {
-    stampPtr_ = new LogicStamp;
     entryPtr_ = new HashEntryOnDisk(data_header, addrs);
 }
 
 HashEntry::HashEntry(const HashEntry& toBeCopied) {
     entryPtr_ = new HashEntryOnDisk(*toBeCopied.entryPtr_);
-    stampPtr_ = new LogicStamp(*toBeCopied.stampPtr_);
     cachePtr_ = toBeCopied.cachePtr_;
 }
 
@@ -93,9 +92,6 @@ HashEntry::~HashEntry() {
     if (entryPtr_) {
         delete entryPtr_;
     }
-    if (stampPtr_) {
-        delete stampPtr_;
-    }
     return;
 }
 
@@ -108,7 +104,6 @@ bool HashEntry::operator==(const HashEntry& toBeCompare) const {
 
 HashEntry& HashEntry::operator=(const HashEntry& toBeCopied) {
     *entryPtr_ = *toBeCopied.entryPtr_;
-    *stampPtr_ = *toBeCopied.stampPtr_;
     cachePtr_ = toBeCopied.cachePtr_;
     return *this;
 }
@@ -117,10 +112,6 @@ void HashEntry::SetKeyDigest(const Kvdb_Digest& digest) {
     entryPtr_->SetKeyDigest(digest);
 }
 
-void HashEntry::SetLogicStamp(KVTime seg_time, int32_t seg_key_no) {
-    stampPtr_->Set(seg_time, seg_key_no);
-}
-
 void IndexManager::InitDataStor(DataStor *ds) {
     dataStor_ = ds;
 }
@@ -151,18 +142,17 @@ void IndexManager::UpdateMetaToSB() {
 }
 
 bool IndexManager::Get(char* buff, uint64_t length) {
-    if (length != sizeOndisk_) {
+    if (length != sizeOndisk_ || !LoadAll()) {
         return false;
     }
     char* buf_ptr = buff;
 
-    //Copy TS
-    int64_t time_len = KVTime::SizeOf();
-    lastTime_->Update();
-    time_t t = lastTime_->GetTime();
-    memcpy((void *)buf_ptr, (const void*)&t, time_len);
-    buf_ptr += time_len;
-    __DEBUG("memcpy timestamp: %s at %p, at %ld", KVTime::ToChar(*lastTime_), (void *)buf_ptr, (int64_t)(buf_ptr-buff));
+    //Copy LSN
+    uint64_t lsn = GetLsn();
+    memcpy((void *)buf_ptr, (const void*)&lsn, sizeof(uint64_t));
+    replayStart_.store(lsn);
+    buf_ptr += sizeof(uint64_t);
+    __DEBUG("memcpy lsn: %lu at %p, at %ld", lsn, (void *)buf_ptr, (int64_t)(buf_ptr-buff));
 
     //Copy Counter Table
     __DEBUG("memcpy Counter at %p, at %ld", (void *)buf_ptr, (int64_t)(buf_ptr-buff));
@@ -191,54 +181,437 @@ bool IndexManager::Get(char* buff, uint64_t length) {
     return true;
 }
 
-bool IndexManager::Set(char* buff, uint64_t length) {
+bool IndexManager::Set(char* buff, uint64_t length, IndexLoadProgress *progress) {
     if (length != sizeOndisk_) {
         return false;
     }
     char* buf_ptr = buff;
 
-    //Set TS
-    int64_t time_len = KVTime::SizeOf();
-    time_t t;
-    memcpy((void *)&t, (const void*)buf_ptr, time_len);
-    lastTime_->SetTime(t);
-    buf_ptr += time_len;
-
-    __DEBUG("memcpy timestamp: %s at %p, at %ld", KVTime::ToChar(*lastTime_), (void *)buf_ptr, (int64_t)(buf_ptr-buff));
-
-    //Set Index
+    //Set LSN
     uint64_t counter_table_len = sizeof(int) * htSize_;
-    char * counter_table_ptr = buf_ptr;
-    char * ht_ptr = buf_ptr + counter_table_len;
+    if (progress && !progress->WaitFor(sizeof(uint64_t) + counter_table_len)) {
+        return false;
+    }
+    uint64_t lsn;
+    memcpy((void *)&lsn, (const void*)buf_ptr, sizeof(uint64_t));
+    AdvanceLsn(lsn);
+    replayStart_.store(lsn);
+    buf_ptr += sizeof(uint64_t);
 
+    __DEBUG("memcpy lsn: %lu at %p, at %ld", lsn, (void *)buf_ptr, (int64_t)(buf_ptr-buff));
+
+    vector<uint64_t> range_offset;
     uint32_t total_entry = 0;
-    uint64_t counter_size = sizeof(int);
-    uint64_t entry_ondisk_size = IndexManager::SizeOfHashEntryOnDisk();
+    if (!calcRangeOffsets(buf_ptr, length, range_offset, total_entry)) {
+        return false;
+    }
+    if (total_entry != keyCounter_) {
+        __ERROR("The Key Number is conflit between superblock and index!!!!!");
+        return false;
+    }
+
+    //Set Index, ranges are taken in order so they follow the read
+    uint32_t range_num = range_offset.size() - 1;
+    std::atomic<uint32_t> next_range(0);
+    std::atomic<uint64_t> data_size(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        uint32_t r;
+        while ((r = next_range.fetch_add(1)) < range_num) {
+            if (progress && !progress->WaitFor(range_offset[r + 1])) {
+                failed.store(true);
+                return;
+            }
+            uint32_t first = r * INDEX_LOAD_RANGE;
+            uint32_t last = min(htSize_, first + (uint32_t) INDEX_LOAD_RANGE);
+            data_size += loadSlots(buf_ptr + sizeof(int) * first, buff + range_offset[r],
+                                   first, last, false);
+        }
+    };
+    vector<std::thread> thds;
+    uint32_t thd_num = min((uint32_t) INDEX_LOAD_THREADS, range_num);
+    for (uint32_t i = 1; i < thd_num; i++) {
+        thds.push_back(std::thread(worker));
+    }
+    worker();
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+
+    std::lock_guard<std::mutex> l(mtx_);
+    dataTheorySize_ = data_size.load();
+    return !failed.load();
+}
 
+// Find where the entries of each range of slots start in an image of
+// length bytes, from its counter table.
+bool IndexManager::calcRangeOffsets(char *counters, uint64_t length, vector<uint64_t> &range_offset,
+                                    uint32_t &entry_num) {
+    uint32_t range_num = (htSize_ + INDEX_LOAD_RANGE - 1) / INDEX_LOAD_RANGE;
+    range_offset.resize(range_num + 1);
+    uint64_t entry_ondisk_size = IndexManager::SizeOfHashEntryOnDisk();
+    uint64_t offset = sizeof(uint64_t) + sizeof(int) * htSize_;
+    uint64_t total_entry = 0;
     for (uint32_t i = 0; i < htSize_; i++) {
+        if (i % INDEX_LOAD_RANGE == 0) {
+            range_offset[i / INDEX_LOAD_RANGE] = offset;
+        }
+        int slot_num = 0;
+        memcpy((void*)&slot_num, (const void *)(counters + sizeof(int) * i), sizeof(int));
+        if (slot_num < 0) {
+            __ERROR("The Index is corrupted at slot %u!!!!!", i);
+            return false;
+        }
+        offset += slot_num * entry_ondisk_size;
+        total_entry += slot_num;
+    }
+    range_offset[range_num] = offset;
 
+    if (offset > length) {
+        __ERROR("The Index is corrupted, entries run past the region!!!!!");
+        return false;
+    }
+    entry_num = total_entry;
+    return true;
+}
+
+// Fill slots [first, last) with their counters and entries, each list
+// built from its tail so that it keeps the order of the image. A slot of
+// a delta checkpoint not applied yet is taken from the delta. Returns the
+// data size of the entries.
+uint64_t IndexManager::loadSlots(char *counters, char *entries, uint32_t first, uint32_t last,
+                                 bool mark_live) {
+    uint64_t entry_ondisk_size = IndexManager::SizeOfHashEntryOnDisk();
+    uint64_t data_size = 0;
+    char *ht_ptr = entries;
+    for (uint32_t i = first; i < last; i++) {
         int slot_num = 0;
-        memcpy((void*)&slot_num, (const void *)counter_table_ptr, sizeof(int));
+        memcpy((void*)&slot_num, (const void *)counters, sizeof(int));
+        counters += sizeof(int);
+
+        char *slot_ptr = ht_ptr;
+        int entry_num = slot_num;
+        ht_ptr += slot_num * entry_ondisk_size;
+        if (!deltaSlots_.empty()) {
+            unordered_map<uint32_t, uint64_t>::iterator it = deltaSlots_.find(i);
+            if (it != deltaSlots_.end()) {
+                slot_ptr = lazyDelta_ + it->second;
+                memcpy((void*)&entry_num, (const void *)slot_ptr, sizeof(int));
+                slot_ptr += sizeof(int);
+            }
+        }
 
-        if (slot_num > 0) {
-            for (int j = 0; j < slot_num; j++) {
-                HashEntryOnDisk entry_ondisk;
-                memcpy((void*)&entry_ondisk, (const void *)ht_ptr, entry_ondisk_size);
-                HashEntry entry(entry_ondisk, *lastTime_, 0);
-                hashtable_[i].entryList_->put(entry);
-                total_entry++;
-                ht_ptr += entry_ondisk_size;
+        LinkedList<HashEntry> *entry_list = hashtable_[i].entryList_;
+        for (int j = entry_num - 1; j >= 0; j--) {
+            HashEntryOnDisk entry_ondisk;
+            memcpy((void*)&entry_ondisk, (const void *)(slot_ptr + j * entry_ondisk_size), entry_ondisk_size);
+            HashEntry &entry = entry_list->putFront(entry_ondisk, (void *)NULL);
+            if (entry.GetDataSize()) {
+                data_size += SizeOfDataHeader() + entry.GetDataSize();
+            }
+            if (mark_live) {
+                dataStor_->ModifyLiveEntry(entry);
+            }
+        }
+    }
+    return data_size;
+}
+
+bool IndexManager::Load(BlockDevice *bdev, int64_t offset, uint64_t length) {
+    char *align_buf;
+    int ret = posix_memalign((void **)&align_buf, 4096, length);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Index, Load Failed!");
+        return false;
+    }
+
+    IndexLoadProgress progress;
+    std::thread reader([&]() {
+        uint64_t loaded = 0;
+        while (loaded < length && !progress.Failed()) {
+            uint64_t chunk = min(length - loaded, (uint64_t) INDEX_READ_CHUNK);
+            if ((uint64_t) bdev->pRead(align_buf + loaded, chunk, offset + loaded) != chunk) {
+                __ERROR("Could not read Index region from device at %ld\n", offset + loaded);
+                progress.Fail();
+                return;
             }
+            loaded += chunk;
+            progress.Advance(loaded);
         }
+    });
 
-        counter_table_ptr += counter_size;
+    bool ok = Set(align_buf, length, &progress);
+    if (!ok) {
+        progress.Fail();
+    }
+    reader.join();
+    free(align_buf);
+    return ok;
+}
+
+bool IndexManager::LoadLazy(BlockDevice *bdev, int64_t offset, uint64_t length) {
+    if (length != sizeOndisk_) {
+        return false;
+    }
+    uint64_t head_len = sizeof(uint64_t) + sizeof(int) * htSize_;
+    head_len = (head_len + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    int ret = posix_memalign((void **)&lazyCounters_, 4096, head_len);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Index, Load Failed!");
+        return false;
+    }
+    for (uint64_t loaded = 0; loaded < head_len; ) {
+        uint64_t chunk = min(head_len - loaded, (uint64_t) INDEX_READ_CHUNK);
+        if ((uint64_t) bdev->pRead(lazyCounters_ + loaded, chunk, offset + loaded) != chunk) {
+            __ERROR("Could not read Index region from device at %ld\n", offset + loaded);
+            return false;
+        }
+        loaded += chunk;
     }
 
+    //Set LSN
+    uint64_t lsn;
+    memcpy((void *)&lsn, (const void*)lazyCounters_, sizeof(uint64_t));
+    AdvanceLsn(lsn);
+    replayStart_.store(lsn);
+
+    uint32_t total_entry = 0;
+    if (!calcRangeOffsets(lazyCounters_ + sizeof(uint64_t), length, rangeOffset_, total_entry)) {
+        return false;
+    }
     if (total_entry != keyCounter_) {
         __ERROR("The Key Number is conflit between superblock and index!!!!!");
         return false;
     }
 
+    uint32_t range_num = rangeOffset_.size() - 1;
+    rangeLoaded_ = new std::atomic<bool>[range_num];
+    for (uint32_t i = 0; i < range_num; i++) {
+        rangeLoaded_[i].store(false, std::memory_order_relaxed);
+    }
+    rangeMtx_ = new std::mutex[range_num];
+    lazyDev_ = bdev;
+    lazyOffset_ = offset;
+
+    // the data size is added up as the ranges load
+    std::lock_guard<std::mutex> l(mtx_);
+    dataTheorySize_ = 0;
+    rangesLeft_.store(range_num, std::memory_order_release);
+    return true;
+}
+
+// Read the slice of the image a range of slots takes and fill the slots.
+// The data store must be open, the entries are marked live.
+bool IndexManager::loadRange(uint32_t range) {
+    if (rangeLoaded_[range].load(std::memory_order_acquire)) {
+        return true;
+    }
+    std::lock_guard<std::mutex> l(rangeMtx_[range]);
+    if (rangeLoaded_[range].load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    uint64_t begin = rangeOffset_[range] / ALIGNED_SIZE * ALIGNED_SIZE;
+    uint64_t end = (rangeOffset_[range + 1] + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    char *align_buf = NULL;
+    if (end > begin) {
+        int ret = posix_memalign((void **)&align_buf, 4096, end - begin);
+        if (ret < 0) {
+            __ERROR("Can't allocate memory for Index, Load Failed!");
+            return false;
+        }
+        if ((uint64_t) lazyDev_->pRead(align_buf, end - begin, lazyOffset_ + begin) != end - begin) {
+            __ERROR("Could not read Index region from device at %ld\n", lazyOffset_ + begin);
+            free(align_buf);
+            return false;
+        }
+    }
+
+    uint32_t first = range * INDEX_LOAD_RANGE;
+    uint32_t last = min(htSize_, first + (uint32_t) INDEX_LOAD_RANGE);
+    char *counters = lazyCounters_ + sizeof(uint64_t) + sizeof(int) * first;
+    uint64_t data_size = loadSlots(counters, align_buf + (rangeOffset_[range] - begin), first, last, true);
+    free(align_buf);
+    {
+        std::lock_guard<std::mutex> meta_lck(mtx_);
+        dataTheorySize_ += data_size;
+    }
+
+    rangeLoaded_[range].store(true, std::memory_order_release);
+    if (rangesLeft_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        __INFO("All %lu slot ranges of the index are loaded", rangeOffset_.size() - 1);
+        free(lazyCounters_);
+        lazyCounters_ = NULL;
+        deltaSlots_.clear();
+        delete[] lazyDelta_;
+        lazyDelta_ = NULL;
+    }
+    return true;
+}
+
+bool IndexManager::LoadAll() {
+    for (uint32_t r = 0; r + 1 < rangeOffset_.size() && rangesLeft_.load(std::memory_order_acquire); r++) {
+        if (!loadRange(r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void IndexManager::LazyLoadThdEntry() {
+    __DEBUG("Index lazy load thread start!!");
+    KVTime start;
+    for (uint32_t r = 0; r + 1 < rangeOffset_.size() && !lazyT_stop_.load(); r++) {
+        // a range that fails is read again when it is needed
+        loadRange(r);
+    }
+    KVTime end;
+    __DEBUG("Index lazy load thread stop after %ld ms!!", (end - start) / 1000);
+}
+
+bool IndexManager::GetCheckpoint(char* buff, uint64_t length, bool full, uint64_t since,
+                                 uint64_t &used, uint32_t &entry_num) {
+    if (full && (length < sizeOndisk_ || !LoadAll())) {
+        return false;
+    }
+    char *buf_ptr = buff;
+    char *buf_end = buff + (full ? sizeOndisk_ : length);
+    uint64_t entry_len = IndexManager::SizeOfHashEntryOnDisk();
+    entry_num = 0;
+
+    //Copy LSN
+    memcpy((void *)buf_ptr, (const void*)&since, sizeof(uint64_t));
+    buf_ptr += sizeof(uint64_t);
+
+    if (full) {
+        //Copy Counter Table and Index, a slot at a time
+        char *counter_ptr = buf_ptr;
+        buf_ptr += sizeof(int) * htSize_;
+        for (uint32_t i = 0; i < htSize_; i++) {
+            std::lock_guard<std::mutex> l(hashtable_[i].slotMtx_);
+            dirtySlots_[i / 64].fetch_and(~(1ULL << (i % 64)), std::memory_order_relaxed);
+            vector<HashEntry> tmp_vec = hashtable_[i].entryList_->get();
+            int counter = tmp_vec.size();
+            // keys deleted and inserted during the walk may overflow
+            if (buf_ptr + counter * entry_len > buf_end) {
+                return false;
+            }
+            memcpy((void *)counter_ptr, (const void*)&counter, sizeof(int));
+            counter_ptr += sizeof(int);
+            for (vector<HashEntry>::iterator iter = tmp_vec.begin(); iter != tmp_vec.end(); iter++) {
+                memcpy((void *)buf_ptr, (const void*)&(iter->GetEntryOnDisk()), entry_len);
+                buf_ptr += entry_len;
+            }
+            entry_num += counter;
+        }
+        used = sizeOndisk_;
+        return true;
+    }
+
+    //Copy the dirty slots: slot number, counter, entries
+    uint32_t slot_num = 0;
+    char *slot_num_ptr = buf_ptr;
+    buf_ptr += sizeof(uint32_t);
+    uint32_t words = (htSize_ + 63) / 64;
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t bits = dirtySlots_[w].load(std::memory_order_relaxed);
+        while (bits) {
+            uint32_t i = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!ensureLoaded(i)) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> l(hashtable_[i].slotMtx_);
+            vector<HashEntry> tmp_vec = hashtable_[i].entryList_->get();
+            int counter = tmp_vec.size();
+            if (buf_ptr + sizeof(uint32_t) + sizeof(int) + counter * entry_len > buf_end) {
+                return false;
+            }
+            memcpy((void *)buf_ptr, (const void*)&i, sizeof(uint32_t));
+            buf_ptr += sizeof(uint32_t);
+            memcpy((void *)buf_ptr, (const void*)&counter, sizeof(int));
+            buf_ptr += sizeof(int);
+            for (vector<HashEntry>::iterator iter = tmp_vec.begin(); iter != tmp_vec.end(); iter++) {
+                memcpy((void *)buf_ptr, (const void*)&(iter->GetEntryOnDisk()), entry_len);
+                buf_ptr += entry_len;
+            }
+            slot_num++;
+            entry_num += counter;
+        }
+    }
+    memcpy((void *)slot_num_ptr, (const void*)&slot_num, sizeof(uint32_t));
+    used = buf_ptr - buff;
+    return true;
+}
+
+// Replace the slots of a delta checkpoint, the table holds the full
+// checkpoint it applies to. While the full one is loaded lazily, the
+// slots are only noted and replaced as their ranges load.
+bool IndexManager::ApplyCheckpoint(char* buff, uint64_t length) {
+    char *buf_ptr = buff;
+    char *buf_end = buff + length;
+    uint64_t entry_len = IndexManager::SizeOfHashEntryOnDisk();
+    bool lazy = rangesLeft_.load() > 0;
+
+    buf_ptr += sizeof(uint64_t);
+    if (lazy) {
+        lazyDelta_ = new char[length];
+        memcpy((void *)lazyDelta_, (const void *)buff, length);
+    }
+
+    uint32_t slot_num = 0;
+    memcpy((void *)&slot_num, (const void*)buf_ptr, sizeof(uint32_t));
+    buf_ptr += sizeof(uint32_t);
+
+    std::lock_guard<std::mutex> meta_lck(mtx_);
+    for (uint32_t n = 0; n < slot_num; n++) {
+        uint32_t i = 0;
+        int counter = 0;
+        if (buf_ptr + sizeof(uint32_t) + sizeof(int) > buf_end) {
+            return false;
+        }
+        memcpy((void *)&i, (const void*)buf_ptr, sizeof(uint32_t));
+        buf_ptr += sizeof(uint32_t);
+        memcpy((void *)&counter, (const void*)(buf_ptr), sizeof(int));
+        if (i >= htSize_ || counter < 0 || buf_ptr + sizeof(int) + counter * entry_len > buf_end) {
+            __ERROR("Corrupted index checkpoint at slot %u", i);
+            return false;
+        }
+        markDirty(i);
+
+        if (lazy) {
+            int old_counter = 0;
+            memcpy((void *)&old_counter, (const void*)(lazyCounters_ + sizeof(uint64_t) + sizeof(int) * i),
+                   sizeof(int));
+            keyCounter_ += counter - old_counter;
+            deltaSlots_[i] = buf_ptr - buff;
+            buf_ptr += sizeof(int) + counter * entry_len;
+            continue;
+        }
+        buf_ptr += sizeof(int);
+
+        LinkedList<HashEntry> *entry_list = hashtable_[i].entryList_;
+        vector<HashEntry> old_vec = entry_list->get();
+        for (vector<HashEntry>::iterator iter = old_vec.begin(); iter != old_vec.end(); iter++) {
+            entry_list->remove(*iter);
+            keyCounter_--;
+            if (iter->GetDataSize()) {
+                dataTheorySize_ -= SizeOfDataHeader() + iter->GetDataSize();
+            }
+        }
+        for (int j = 0; j < counter; j++) {
+            HashEntryOnDisk entry_ondisk;
+            memcpy((void*)&entry_ondisk, (const void *)buf_ptr, entry_len);
+            HashEntry entry(entry_ondisk, 0);
+            entry_list->put(entry);
+            keyCounter_++;
+            if (entry.GetDataSize()) {
+                dataTheorySize_ += SizeOfDataHeader() + entry.GetDataSize();
+            }
+            buf_ptr += entry_len;
+        }
+    }
     return true;
 }
 
@@ -249,22 +622,29 @@ bool IndexManager::UpdateIndex(KVSlice* slice, bool gc_update) {
     const char* data = slice->GetData();
 
     uint32_t hash_index = KeyDigestHandle::Hash(digest) % htSize_;
-
+    if (!ensureLoaded(hash_index)) {
+        return false;
+    }
 
     if (gc_update) {
+        // the copy only replaces the entry it was made from, checked and
+        // put under the slot lock so a racing write is never overridden
         HashEntry entry_before_gc = slice->GetHashEntryBeforeGC();
-        if (!IsSameInMem(entry_before_gc)) {
+        std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
+        LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
+
+        HashEntry *entry_inMem = entry_list->search(entry) ? entry_list->getRef(entry) : NULL;
+        if (!entry_inMem || !(entry_inMem->GetHeaderAddress() == entry_before_gc.GetHeaderAddress())) {
             dataStor_->ModifyDeathEntry(entry);
             return true;
         }
-        else {
-            std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
-            LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
 
-            dataStor_->ModifyDeathEntry(entry_before_gc);
-            entry_list->put(entry);
-            return true;
-        }
+        // the copy keeps the sequence number of the write it carries
+        dataStor_->ModifyDeathEntry(*entry_inMem);
+        entry_list->put(entry);
+        markDirty(hash_index);
+        dataStor_->ModifyLiveEntry(entry);
+        return true;
     }
 
     std::unique_lock<std::mutex> meta_lck(mtx_, std::defer_lock);
@@ -283,6 +663,8 @@ bool IndexManager::UpdateIndex(KVSlice* slice, bool gc_update) {
             meta_lck.unlock();
 
             entry_list->put(entry);
+            markDirty(hash_index);
+            dataStor_->ModifyLiveEntry(entry);
 
             meta_lck.lock();
             keyCounter_++;
@@ -299,10 +681,7 @@ bool IndexManager::UpdateIndex(KVSlice* slice, bool gc_update) {
     }
     else {
         HashEntry *entry_inMem = entry_list->getRef(entry);
-        HashEntry::LogicStamp *lts = entry.GetLogicStamp();
-        HashEntry::LogicStamp *lts_inMem = entry_inMem->GetLogicStamp();
-
-        if ( *lts < *lts_inMem) {
+        if (entry.GetLsn() < entry_inMem->GetLsn()) {
             dataStor_->ModifyDeathEntry(entry);
             __DEBUG("Ignore the UpdateIndex request, because request is expired!");
         }
@@ -325,6 +704,8 @@ bool IndexManager::UpdateIndex(KVSlice* slice, bool gc_update) {
             meta_lck.unlock();
 
             entry_list->put(entry);
+            markDirty(hash_index);
+            dataStor_->ModifyLiveEntry(entry);
 
             __DEBUG("UpdateIndex request, because request is new than in memory!Now dataTheorySize_ is %ld", dataTheorySize_);
         }
@@ -351,6 +732,9 @@ void IndexManager::RemoveEntry(HashEntry entry) {
     Kvdb_Digest digest = entry.GetKeyDigest();
 
     uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
+    if (!ensureLoaded(hash_index)) {
+        return;
+    }
 
     std::unique_lock<std::mutex> meta_lck(mtx_, std::defer_lock);
     std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
@@ -361,12 +745,9 @@ void IndexManager::RemoveEntry(HashEntry entry) {
         __DEBUG("Already remove the index entry");
         return;
     }
-    HashEntry::LogicStamp *lts = entry.GetLogicStamp();
-    HashEntry::LogicStamp *lts_inMem = entry_inMem->GetLogicStamp();
-    KVTime &t = lts->GetSegTime();
-    KVTime &t_inMem = lts_inMem->GetSegTime();
-    if (t_inMem == t && entry_inMem->GetDataSize() == 0) {
+    if (entry_inMem->GetLsn() == entry.GetLsn() && entry_inMem->GetDataSize() == 0) {
         entry_list->remove(entry);
+        markDirty(hash_index);
         dataStor_->ModifyDeathEntry(entry);
 
         meta_lck.lock();
@@ -377,9 +758,41 @@ void IndexManager::RemoveEntry(HashEntry entry) {
     }
 }
 
+void IndexManager::DropEntry(HashEntry entry) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+
+    uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
+    if (!ensureLoaded(hash_index)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> meta_lck(mtx_, std::defer_lock);
+    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
+    LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
+
+    HashEntry *entry_inMem = entry_list->getRef(entry);
+    if (!entry_inMem) {
+        return;
+    }
+    uint16_t data_size = entry_inMem->GetDataSize();
+    entry_list->remove(entry);
+    markDirty(hash_index);
+
+    meta_lck.lock();
+    keyCounter_--;
+    if (data_size) {
+        dataTheorySize_ -= (uint64_t) (SizeOfDataHeader() + data_size);
+    }
+    meta_lck.unlock();
+    __DEBUG("Drop the stale index entry!");
+}
+
 bool IndexManager::GetHashEntry(KVSlice *slice) {
     const Kvdb_Digest *digest = &slice->GetDigest();
     uint32_t hash_index = KeyDigestHandle::Hash(digest) % htSize_;
+    if (!ensureLoaded(hash_index)) {
+        return false;
+    }
     HashEntry entry;
     entry.SetKeyDigest(*digest);
 
@@ -402,8 +815,9 @@ bool IndexManager::GetHashEntry(KVSlice *slice) {
     return false;
 }
 
+// GC updates are conditional per key and need no batch lock, so the GC
+// of several volumes never serializes here.
 void IndexManager::UpdateIndexesForGC(std::list<KVSlice*> &slice_list) {
-    std::lock_guard<std::mutex> l(batch_mtx_);
     for (list<KVSlice *>::iterator iter = slice_list.begin(); iter
             != slice_list.end(); iter++) {
         KVSlice *slice = *iter;
@@ -411,6 +825,37 @@ void IndexManager::UpdateIndexesForGC(std::list<KVSlice*> &slice_list) {
     } __DEBUG("UpdateToIndexForGC Success!");
 }
 
+// The live maps of the segments are not persisted, they are rebuilt
+// from the index once it and the data store are loaded. Ranges loaded
+// lazily mark their own.
+void IndexManager::MarkLiveEntries() {
+    for (uint32_t i = 0; i < htSize_; i++) {
+        if (rangesLeft_.load() && !rangeLoaded_[i / INDEX_LOAD_RANGE].load()) {
+            continue;
+        }
+        std::lock_guard<std::mutex> l(hashtable_[i].slotMtx_);
+        vector<HashEntry> tmp_vec = hashtable_[i].entryList_->get();
+        for (vector<HashEntry>::iterator iter = tmp_vec.begin(); iter != tmp_vec.end(); iter++) {
+            dataStor_->ModifyLiveEntry(*iter);
+        }
+    }
+}
+
+bool IndexManager::KeepTombstone(HashEntry &entry) {
+    if (entry.GetLsn() < replayStart_.load()) {
+        return false;
+    }
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
+    if (!ensureLoaded(hash_index)) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
+    HashEntry *entry_inMem = hashtable_[hash_index].entryList_->getRef(entry);
+    return !entry_inMem || entry_inMem->GetHeaderAddress() == entry.GetHeaderAddress();
+}
+
 uint64_t IndexManager::GetDataTheorySize() const {
     std::lock_guard<std::mutex> l(mtx_);
     return dataTheorySize_;
@@ -425,6 +870,9 @@ bool IndexManager::IsSameInMem(HashEntry &entry)
 {
     Kvdb_Digest digest = entry.GetKeyDigest();
     uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
+    if (!ensureLoaded(hash_index)) {
+        return false;
+    }
 
     std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
     LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
@@ -446,7 +894,7 @@ bool IndexManager::IsSameInMem(HashEntry &entry)
 }
 
 uint64_t IndexManager::CalcIndexSizeOnDevice(uint32_t ht_size) {
-    uint64_t index_size = sizeof(time_t)
+    uint64_t index_size = sizeof(uint64_t)
             + sizeof(int) * ht_size
             + IndexManager::SizeOfHashEntryOnDisk() * ht_size;
     uint64_t index_size_pages = index_size / getpagesize();
@@ -454,17 +902,15 @@ uint64_t IndexManager::CalcIndexSizeOnDevice(uint32_t ht_size) {
 }
 
 IndexManager::IndexManager(SuperBlockManager* sbm, Options &opt) :
-    hashtable_(NULL), htSize_(0), sizeOndisk_(0), keyCounter_(0), dataTheorySize_(0),
+    hashtable_(NULL), dirtySlots_(NULL), htSize_(0), sizeOndisk_(0), keyCounter_(0), dataTheorySize_(0),
             sbMgr_(sbm), dataStor_(NULL),
-            options_(opt), segRprWQ_(NULL) {
-    lastTime_ = new KVTime();
+            options_(opt), nextLsn_(1), replayStart_(0), lazyDev_(NULL), lazyOffset_(0), lazyCounters_(NULL),
+            rangeLoaded_(NULL), rangeMtx_(NULL), rangesLeft_(0), lazyDelta_(NULL), lazyT_stop_(false),
+            segRprWQ_(NULL) {
     return;
 }
 
 IndexManager::~IndexManager() {
-    if (lastTime_) {
-        delete lastTime_;
-    }
     if (hashtable_) {
         destroyHashTable();
     }
@@ -484,21 +930,44 @@ uint32_t IndexManager::CalcHashSizeForPower2(uint32_t number) {
 
 void IndexManager::initHashTable() {
     hashtable_ = new HashtableSlot[htSize_];
+    uint32_t words = (htSize_ + 63) / 64;
+    dirtySlots_ = new std::atomic<uint64_t>[words];
+    for (uint32_t i = 0; i < words; i++) {
+        dirtySlots_[i].store(0, std::memory_order_relaxed);
+    }
     return;
 }
 
 void IndexManager::destroyHashTable() {
     delete[] hashtable_;
     hashtable_ = NULL;
+    delete[] dirtySlots_;
+    dirtySlots_ = NULL;
+    delete[] rangeLoaded_;
+    rangeLoaded_ = NULL;
+    delete[] rangeMtx_;
+    rangeMtx_ = NULL;
+    free(lazyCounters_);
+    lazyCounters_ = NULL;
+    delete[] lazyDelta_;
+    lazyDelta_ = NULL;
     return;
 }
 
 void IndexManager::StartThds(){
     segRprWQ_ = new SegmentReaperWQ(this, 1);
     segRprWQ_->Start();
+    if (rangesLeft_.load()) {
+        lazyT_stop_.store(false);
+        lazyT_ = std::thread(&IndexManager::LazyLoadThdEntry, this);
+    }
 }
 
 void IndexManager::StopThds(){
+    if (lazyT_.joinable()) {
+        lazyT_stop_.store(true);
+        lazyT_.join();
+    }
     if (segRprWQ_) {
         segRprWQ_->Stop();
         delete segRprWQ_;
@@ -507,8 +976,14 @@ void IndexManager::StopThds(){
 
 void IndexManager::SegReaper(SegForReq *seg) {
     seg->CleanDeletedEntry();
+    seg->GetSelfVolume()->Unpin(seg->GetSegId());
     __DEBUG("Segment reaper delete seg_id = %d", seg->GetSegId());
-    delete seg;
+    ObjectPool<SegForReq> *pool = seg->GetPool();
+    if (pool) {
+        pool->Put(seg);
+    } else {
+        delete seg;
+    }
 }
 
 void IndexManager::AddToReaper(SegForReq* seg) {
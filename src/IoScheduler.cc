@@ -0,0 +1,215 @@
+#include <chrono>
+#include <unistd.h>
+
+#include "IoScheduler.h"
+#include "Db_Structure.h"
+
+namespace hlkvds {
+
+IoScheduler::IoScheduler(Options &opts, int queue_depth) :
+    options_(opts), depth_(queue_depth > 0 ? queue_depth : 1),
+    enabled_(opts.io_scheduler),
+    cfgRate_((uint64_t) (opts.bg_io_rate > 0 ? opts.bg_io_rate : 0) << 20),
+    rate_(cfgRate_), tokens_(0), lastRefill_(0), latCount_(0), p99_(0),
+    idleP99_(0), bgBytes_(0), windowStart_(0) {
+    for (int i = 0; i < IO_CLASS_NUM; i++) {
+        inflight_[i] = 0;
+        waiting_[i] = 0;
+    }
+    for (int i = 0; i < 64; i++) {
+        latHist_[i] = 0;
+    }
+}
+
+IoScheduler::~IoScheduler() {
+}
+
+void IoScheduler::Begin(IoClass cls, uint64_t bytes) {
+    if (!enabled_) {
+        return;
+    }
+    if (cls == IoClass::BACKGROUND) {
+        waitTokens(bytes);
+    }
+
+    int c = (int) cls;
+    std::unique_lock<std::mutex> l(mtx_);
+    waiting_[c]++;
+    if (cls == IoClass::BACKGROUND) {
+        // yield to reads in flight, but never starve
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                + std::chrono::microseconds(IO_BG_YIELD_US);
+        if (!cv_.wait_until(l, deadline, [this, cls] { return canIssue(cls, false); })) {
+            cv_.wait(l, [this, cls] { return canIssue(cls, true); });
+        }
+        bgBytes_ += bytes;
+    } else {
+        cv_.wait(l, [this, cls] { return canIssue(cls, false); });
+    }
+    waiting_[c]--;
+    inflight_[c]++;
+
+    // lower classes held back by this one may go now
+    for (int i = c + 1; i < IO_CLASS_NUM; i++) {
+        if (waiting_[i]) {
+            cv_.notify_all();
+            break;
+        }
+    }
+}
+
+void IoScheduler::End(IoClass cls, KVTime &start) {
+    if (!enabled_) {
+        return;
+    }
+    KVTime end;
+    int64_t lat = end - start;
+    {
+        std::lock_guard<std::mutex> l(mtx_);
+        inflight_[(int) cls]--;
+        if (cls == IoClass::FG_READ) {
+            recordRead(lat > 0 ? (uint64_t) lat : 0, nowUs());
+        }
+    }
+    cv_.notify_all();
+}
+
+uint64_t IoScheduler::GetBgRate() {
+    std::lock_guard<std::mutex> l(mtx_);
+    return rate_;
+}
+
+uint64_t IoScheduler::GetReadP99() {
+    std::lock_guard<std::mutex> l(mtx_);
+    return p99_;
+}
+
+// Must hold mtx_.
+bool IoScheduler::canIssue(IoClass cls, bool yielded) {
+    int c = (int) cls;
+    int total = 0;
+    for (int i = 0; i < IO_CLASS_NUM; i++) {
+        total += inflight_[i];
+    }
+    if (total >= depth_) {
+        return false;
+    }
+    if (yielded) {
+        // an aged background request goes ahead of waiting foreground
+        // ones, one at a time
+        return inflight_[c] == 0;
+    }
+    for (int i = 0; i < c; i++) {
+        if (waiting_[i]) {
+            return false;
+        }
+    }
+    if (cls == IoClass::BACKGROUND && inflight_[(int) IoClass::FG_READ]) {
+        return false;
+    }
+    return true;
+}
+
+void IoScheduler::waitTokens(uint64_t bytes) {
+    while (true) {
+        std::unique_lock<std::mutex> l(mtx_);
+        int64_t now = nowUs();
+        // a window also ends without reads, so a cut rate recovers
+        if (now - windowStart_ >= IO_P99_WINDOW_US) {
+            recordRead(0, now);
+        }
+        refillTokens(now);
+        if (rate_ == 0 || tokens_ > 0) {
+            // the bucket may go into debt for a request larger than it
+            tokens_ -= rate_ ? (double) bytes : 0;
+            return;
+        }
+        int64_t wait = (int64_t) (-tokens_ * 1000000 / rate_) + 1;
+        l.unlock();
+        usleep(wait < 10000 ? wait : 10000);
+    }
+}
+
+// Must hold mtx_.
+void IoScheduler::refillTokens(int64_t now) {
+    if (rate_ == 0) {
+        tokens_ = 0;
+    } else {
+        double burst = (double) rate_ * IO_BG_BURST_US / 1000000;
+        tokens_ += (double) (now - lastRefill_) * rate_ / 1000000;
+        if (tokens_ > burst) {
+            tokens_ = burst;
+        }
+    }
+    lastRefill_ = now;
+}
+
+// Add a foreground read latency (lat_us 0 only closes a due window).
+// Must hold mtx_.
+void IoScheduler::recordRead(uint64_t lat_us, int64_t now) {
+    if (lat_us) {
+        latHist_[63 - __builtin_clzll(lat_us)]++;
+        latCount_++;
+    }
+    if (latCount_ < IO_P99_SAMPLES && now - windowStart_ < IO_P99_WINDOW_US) {
+        return;
+    }
+
+    uint64_t p99 = 0;
+    if (latCount_ >= IO_P99_SAMPLES_MIN) {
+        uint64_t rank = latCount_ - latCount_ / 100;
+        uint64_t seen = 0;
+        for (int i = 0; i < 64; i++) {
+            seen += latHist_[i];
+            if (seen >= rank) {
+                p99 = 2ULL << i;
+                break;
+            }
+        }
+        p99_ = p99;
+    }
+    adjustRate(p99, now);
+
+    for (int i = 0; i < 64; i++) {
+        latHist_[i] = 0;
+    }
+    latCount_ = 0;
+    bgBytes_ = 0;
+    windowStart_ = now;
+}
+
+// Halve the background rate while reads suffer from it, grow it back by
+// a quarter per good window. p99 is 0 when the window had few reads.
+// Must hold mtx_.
+void IoScheduler::adjustRate(uint64_t p99, int64_t now) {
+    bool bg_active = bgBytes_ > 0;
+    if (p99 && !bg_active) {
+        idleP99_ = idleP99_ ? (idleP99_ * 3 + p99) / 4 : p99;
+    }
+
+    uint64_t target = options_.fg_p99_target > 0 ?
+            (uint64_t) options_.fg_p99_target : idleP99_ * IO_P99_RISE;
+    if (bg_active && target && p99 > target && p99 > IO_P99_FLOOR_US) {
+        int64_t elapsed = now - windowStart_;
+        uint64_t base = rate_;
+        if (!base) {
+            base = elapsed > 0 ? bgBytes_ * 1000000 / elapsed : IO_BG_RATE_MAX;
+        }
+        rate_ = base / 2 > IO_BG_RATE_MIN ? base / 2 : IO_BG_RATE_MIN;
+        __DEBUG("Read p99 %lu us over %lu us, background rate cut to %lu B/s", p99, target, rate_);
+    } else if (rate_ != cfgRate_) {
+        rate_ += rate_ / 4;
+        if (cfgRate_ && rate_ >= cfgRate_) {
+            rate_ = cfgRate_;
+        } else if (!cfgRate_ && rate_ >= IO_BG_RATE_MAX) {
+            rate_ = 0;
+        }
+    }
+}
+
+int64_t IoScheduler::nowUs() {
+    KVTime now;
+    return now - base_;
+}
+
+}// namespace hlkvds
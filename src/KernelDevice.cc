@@ -1,14 +1,18 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
+#include <linux/falloc.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include <vector>
 #include "KernelDevice.h"
@@ -18,7 +22,8 @@ using namespace std;
 
 namespace hlkvds {
 KernelDevice::KernelDevice() :
-    directFd_(-1), bufFd_(-1), capacity_(0), blockSize_(0), path_(""), isOpen_(false) {
+    directFd_(-1), bufFd_(-1), capacity_(0), blockSize_(0), queueDepth_(SSD_QUEUE_DEPTH),
+    path_(""), isOpen_(false), isBlkDev_(false) {
 }
 
 KernelDevice::~KernelDevice() {
@@ -85,6 +90,27 @@ int KernelDevice::lock_device()
     return KD_OK;
 }
 
+// A file lives on the device of its filesystem, a partition takes the
+// queue attributes of its parent disk. Unknown devices count as SSD.
+bool KernelDevice::is_rotational(struct stat &statbuf) {
+    dev_t dev = S_ISBLK(statbuf.st_mode) ? statbuf.st_rdev : statbuf.st_dev;
+    char path[128];
+    const char *fmt[] = { "/sys/dev/block/%u:%u/queue/rotational",
+                          "/sys/dev/block/%u:%u/../queue/rotational" };
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), fmt[i], major(dev), minor(dev));
+        FILE *fp = fopen(path, "r");
+        if (!fp) {
+            continue;
+        }
+        int rotational = 0;
+        int r = fscanf(fp, "%d", &rotational);
+        fclose(fp);
+        return r == 1 && rotational == 1;
+    }
+    return false;
+}
+
 int KernelDevice::Open(string path, bool dsync) {
     if (isOpen_) {
         __ERROR("This Device is already Open!!!");
@@ -132,7 +158,8 @@ int KernelDevice::Open(string path, bool dsync) {
         goto open_fail;
     }
 
-    if (S_ISBLK(statbuf.st_mode)) {
+    isBlkDev_ = S_ISBLK(statbuf.st_mode);
+    if (isBlkDev_) {
         capacity_ = get_block_device_capacity();
         blockSize_ = statbuf.st_blksize;
     } else {
@@ -140,6 +167,7 @@ int KernelDevice::Open(string path, bool dsync) {
         //TODO:() dynamic block size in file mode
         blockSize_ = getpagesize();
     }
+    queueDepth_ = is_rotational(statbuf) ? HDD_QUEUE_DEPTH : SSD_QUEUE_DEPTH;
 
     isOpen_ = true;
 
@@ -184,13 +212,59 @@ ssize_t KernelDevice::pRead(void* buf, size_t count, off_t offset) {
 }
 
 ssize_t KernelDevice::pWritev(const struct iovec *iov, int iovcnt, off_t offset) {
-    return pwritev(bufFd_, iov, iovcnt, offset);
+    bool aligned = IsSectorAligned(offset);
+    for (int i = 0; aligned && i < iovcnt; i++) {
+        aligned = IsPageAligned(iov[i].iov_base) && IsSectorAligned(iov[i].iov_len);
+    }
+    int fd = aligned ? directFd_ : bufFd_;
+
+    // pwritev accepts at most IOV_MAX entries per call
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+        int cnt = min(iovcnt, (int)IOV_MAX);
+        size_t expect = 0;
+        for (int i = 0; i < cnt; i++) {
+            expect += iov[i].iov_len;
+        }
+        ssize_t ret = pwritev(fd, iov, cnt, offset + total);
+        if (ret < 0) {
+            return ret;
+        }
+        total += ret;
+        if ((size_t)ret != expect) {
+            break;
+        }
+        iov += cnt;
+        iovcnt -= cnt;
+    }
+
+    if (!aligned) {
+        fsync(bufFd_);
+    }
+    return total;
 }
 
 ssize_t KernelDevice::pReadv(const struct iovec *iov, int iovcnt, off_t offset) {
     return preadv(bufFd_, iov, iovcnt, offset);
 }
 
+// Block devices get BLKDISCARD, files have the range punched out so
+// its blocks go back to the filesystem.
+int KernelDevice::Discard(off_t offset, size_t length) {
+    int r;
+    if (isBlkDev_) {
+        uint64_t range[2] = { (uint64_t) offset, (uint64_t) length };
+        r = ioctl(bufFd_, BLKDISCARD, range);
+    } else {
+        r = fallocate(bufFd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+    }
+    if (r < 0) {
+        __DEBUG("Discard %s at %ld, length %ld failed: %s", path_.c_str(), offset, length, strerror(errno));
+        return KD_ERR;
+    }
+    return KD_OK;
+}
+
 void KernelDevice::ClearReadCache() {
     posix_fadvise(bufFd_, 0, capacity_, POSIX_FADV_DONTNEED);
 }
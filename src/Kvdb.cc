@@ -55,8 +55,8 @@ DB::DBReaper::~DBReaper() {
 }
 
 Status DB::Insert(const char* key, uint32_t key_len, const char* data,
-                uint16_t length, bool immediately) {
-    Status s = kvds_->Insert(key, key_len, data, length, immediately);
+                uint16_t length, bool immediately, bool cold) {
+    Status s = kvds_->Insert(key, key_len, data, length, immediately, cold);
     if (!s.ok()) {
         std::cout << "DB Insert failed" << std::endl;
     }
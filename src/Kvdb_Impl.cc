@@ -67,6 +67,16 @@ void KVDS::printDbStates() {
 
     idxMgr_->printDynamicInfo();
     dataStor_->printDynamicInfo();
+
+    if (!options_.disable_cache) {
+        __INFO("\n\t Read Cache information: \n"
+                "\t Hits / Misses (Single Tier)  : %lu / %lu\n"
+                "\t Hits / Misses (Fast Tier)    : %lu / %lu\n"
+                "\t Hits / Misses (Medium Tier)  : %lu / %lu\n",
+                cacheHits_[(int) ReadTier::SINGLE].load(), cacheMisses_[(int) ReadTier::SINGLE].load(),
+                cacheHits_[(int) ReadTier::FAST].load(), cacheMisses_[(int) ReadTier::FAST].load(),
+                cacheHits_[(int) ReadTier::MEDIUM].load(), cacheMisses_[(int) ReadTier::MEDIUM].load());
+    }
 }
 
 KVDS* KVDS::Open_KVDS(const char* filename, Options opts) {
@@ -114,20 +124,24 @@ Status KVDS::openDB() {
 }
 
 Status KVDS::closeDB() {
+    // background promotion, migration and GC move records, so they are
+    // drained before the index is persisted
+    stopThds();
     if (!metaStor_->PersistMetaData()) {
         __ERROR("Could not to write metadata to device\n");
         return Status::IOError("Could not to write metadata to device");
     }
-    stopThds();
     return Status::OK();
 }
 
 void KVDS::startThds() {
     idxMgr_->StartThds();
     dataStor_->StartThds();
+    metaStor_->StartThds();
 }
 
 void KVDS::stopThds() {
+    metaStor_->StopThds();
     dataStor_->StopThds();
     idxMgr_->StopThds();
 }
@@ -183,23 +197,29 @@ KVDS::KVDS(const char* filename, Options opts) :
     if(!options_.disable_cache){
         rdCache_ = new ReadCache(CachePolicy(options_.cache_policy), (size_t) options_.cache_size, options_.slru_partition);
     }
+    for (int i = 0; i < READ_TIER_NUM; i++) {
+        cacheHits_[i] = 0;
+        cacheMisses_[i] = 0;
+    }
 
     metaStor_ = new MetaStor(filename, bdVec_, sbMgr_, idxMgr_, options_);
 }
 
 Status KVDS::Insert(const char* key, uint32_t key_len, const char* data,
-                      uint16_t length, bool immediately) {
+                      uint16_t length, bool immediately, bool cold) {
     if (key == NULL || key[0] == '\0') {
         return Status::InvalidArgument("Key is null or empty.");
     }
 
     KVSlice slice(key, key_len, data, length);
+    slice.SetCold(cold);
 
     Status s = dataStor_->WriteData(slice, immediately);
 
     if (s.ok()) {
-        if(!options_.disable_cache && !slice.GetDataLen()){
-            rdCache_->Put(slice.GetKeyStr(),slice.GetDataStr());
+        // the new value is cached once it is read from a cached tier
+        if(!options_.disable_cache){
+            rdCache_->Delete(slice.GetKeyStr());
         }
     }
 
@@ -221,6 +241,7 @@ Status KVDS::Get(const char* key, uint32_t key_len, string &data) {
     if(!options_.disable_cache) {
         if(rdCache_->Get(slice.GetKeyStr(), data)) {
             rdCache_->Put(slice.GetKeyStr(), data);
+            cacheHits_[(int) cachedTier()].fetch_add(1, std::memory_order_relaxed);
             return Status::OK();
         }
     }
@@ -231,11 +252,22 @@ Status KVDS::Get(const char* key, uint32_t key_len, string &data) {
         return Status::NotFound("Key is not found.");
     }
 
-    Status s = dataStor_->ReadData(slice, data);
+    ReadTier tier = ReadTier::SINGLE;
+    Status s = dataStor_->ReadData(slice, data, &tier);
 
     if (s.ok()) {
         if(!options_.disable_cache) {
-            rdCache_->Put(slice.GetKeyStr(), data);
+            cacheMisses_[(int) tier].fetch_add(1, std::memory_order_relaxed);
+            if (cacheAdmits(tier)) {
+                rdCache_->Put(slice.GetKeyStr(), data);
+                // a write racing with this read may have dropped the key
+                // before the put, so drop it again if the key has moved
+                KVSlice check(key, key_len, NULL, 0);
+                if (!idxMgr_->GetHashEntry(&check) ||
+                        check.GetHashEntry().GetHeaderOffset() != slice.GetHashEntry().GetHeaderOffset()) {
+                    rdCache_->Delete(slice.GetKeyStr());
+                }
+            }
         }
     }
 
@@ -253,9 +285,7 @@ Status KVDS::InsertBatch(WriteBatch *batch) {
         if(!options_.disable_cache) {
             for (std::list<KVSlice *>::iterator iter = batch->batch_.begin();
                     iter != batch->batch_.end(); iter++) {
-                if(!(*iter)->GetDataLen()) {//no "" should be put in to the cache
-                    rdCache_->Put((*iter)->GetKeyStr(), (*iter)->GetDataStr());
-                }
+                rdCache_->Delete((*iter)->GetKeyStr());
             }
         }
     }
@@ -267,6 +297,17 @@ void KVDS::Do_GC() {
     dataStor_->ManualGC();
 }
 
+// FastTier serves a miss nearly as fast as the cache would, so on a
+// multi-tier store the cache memory is kept for MediumTier values.
+bool KVDS::cacheAdmits(ReadTier tier) {
+    return tier != ReadTier::FAST;
+}
+
+// The tier the cached values come from.
+ReadTier KVDS::cachedTier() {
+    return dataStor_->GetDataStorType() == 1 ? ReadTier::MEDIUM : ReadTier::SINGLE;
+}
+
 void KVDS::ClearReadCache() {
     vector<BlockDevice*>::iterator iter;
     for (iter = bdVec_.begin(); iter != bdVec_.end(); iter++) {
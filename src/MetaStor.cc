@@ -1,9 +1,12 @@
+#include <chrono>
+
 #include "MetaStor.h"
 #include "Db_Structure.h"
 #include "BlockDevice.h"
 #include "SuperBlockManager.h"
 #include "IndexManager.h"
 #include "DataStor.h"
+#include "SegmentManager.h"
 
 using namespace std;
 
@@ -13,10 +16,14 @@ MetaStor::MetaStor(const char* paths, vector<BlockDevice*> &dev_vec,
                     SuperBlockManager *sbm, IndexManager *im, Options &opt)
     : paths_(paths), bdVec_(dev_vec), metaDev_(NULL),
     sbMgr_(sbm), idxMgr_(im), options_(opt), sbOff_(-1),
-    idxOff_(-1), sstOff_(-1) {
+    idxOff_(-1), sstOff_(-1), ckptLen_(0), ckptSeq_(0), ckptFullSeq_(0),
+    ckptFullHalf_(1), ckptFullSince_(0), ckptStart_(0), ckptForceFull_(false),
+    ckptSst_(NULL), ckptT_stop_(false) {
 }
 
-MetaStor::~MetaStor() {}
+MetaStor::~MetaStor() {
+    delete[] ckptSst_;
+}
 
 void MetaStor::InitDataStor(DataStor* ds) {
     dataStor_ = ds;
@@ -84,13 +91,16 @@ bool MetaStor::CreateMetaData() {
     index_region_length = IndexManager::CalcIndexSizeOnDevice(index_ht_size);
     __DEBUG("index region size; %ld", index_region_length);
 
-    if (meta_device_capacity < (sb_region_length + index_region_length)) {
+    //The index lives in the two halves of the checkpoint region
+    uint64_t ckpt_region_length = calcCheckpointLength(index_region_length) * 2;
+    if (meta_device_capacity < (sb_region_length + ckpt_region_length)) {
         __ERROR("The capacity of device is too small, can't store index region");
         return false;
     }
 
     index_region_offset = sb_region_length;
     idxOff_ = sb_region_length;
+    ckptLen_ = ckpt_region_length / 2;
     if (!createIndex(index_ht_size, index_region_length)) {
         return false;
     }
@@ -98,7 +108,7 @@ bool MetaStor::CreateMetaData() {
     __DEBUG("Init index region success.");
 
     //Init SST region
-    sst_region_offset = sb_region_length + index_region_length;
+    sst_region_offset = sb_region_length + ckpt_region_length;
 
     sstOff_ = sst_region_offset;
     if (!createDataStor()) {
@@ -111,7 +121,11 @@ bool MetaStor::CreateMetaData() {
     //Set zero to device.
     sst_total_num = dataStor_->GetTotalSegNum();
     sst_region_length = dataStor_->GetSSTsLengthOnDisk();
-    uint64_t db_meta_region_length = sb_region_length + index_region_length + sst_region_length;
+    if (ALIGNED_SIZE + index_region_length + sst_region_length > ckptLen_) {
+        __ERROR("The SSTs do not fit in the checkpoint region");
+        return false;
+    }
+    uint64_t db_meta_region_length = sb_region_length + ckpt_region_length + sst_region_length;
 
     if ( !zeroDeviceMetaRegion(db_meta_region_length) ) {
         return false;
@@ -128,21 +142,39 @@ bool MetaStor::CreateMetaData() {
     sbMgr_->SetSuperBlock(sb);
 
     //Set SuperBlock reserved region
-    uint64_t reserved_region_length = SuperBlockManager::ReservedRegionLength();
-    char * reserved_content = new char[reserved_region_length];
-    if ( !dataStor_->GetSBReservedContent(reserved_content, reserved_region_length) ) {
-        delete[] reserved_content;
+    if (!updateSBReservedContent()) {
         return false;
     }
-    if ( !sbMgr_->SetReservedContent(reserved_content, reserved_region_length) ) {
-        delete[] reserved_content;
+
+    // sequence numbers start at the creation time, above those in the
+    // stale segments of a former DB on the devices
+    idxMgr_->AdvanceLsn(SegmentManager::GetNowTimestamp());
+    // the store is in use from here on, a crash before its first close
+    // is recovered from the segments written after this
+    ckptStart_ = idxMgr_->GetLsn();
+    if (!Checkpoint(true) || !persistSuperBlockToDevice()) {
+        __ERROR("Could not persist the new SuperBlock and SSTs");
         return false;
     }
-
-    delete[] reserved_content;
     return true;
 }
 
+// A half holds a header page, a full index image and the SSTs of every
+// segment the devices could be cut into.
+uint64_t MetaStor::calcCheckpointLength(uint64_t index_size) {
+    uint64_t seg_size = options_.segment_size;
+    if (options_.secondary_seg_size > 0 && (uint64_t) options_.secondary_seg_size < seg_size) {
+        seg_size = options_.secondary_seg_size;
+    }
+    uint64_t seg_num = 0;
+    for (uint32_t i = 0; i < bdVec_.size(); i++) {
+        seg_num += bdVec_[i]->GetDeviceCapacity() / seg_size + 1;
+    }
+    uint64_t sst_size = SegmentManager::SizeOfSegmentStat() * seg_num + KVTime::SizeOf();
+    sst_size = (sst_size / ALIGNED_SIZE + 1) * ALIGNED_SIZE;
+    return ALIGNED_SIZE + index_size + sst_size;
+}
+
 bool MetaStor::zeroDeviceMetaRegion(uint64_t meta_size) {
     if (meta_size % 4096 != 0) {
         return false;
@@ -183,15 +215,42 @@ bool MetaStor::LoadMetaData() {
     uint64_t index_region_length = sbMgr_->GetIndexRegionLength();
 
     idxOff_ = sbOff_ + sb_region_length;
-    if(!loadIndex(index_ht_size, index_region_length)) {
-        __ERROR("Load Index failed.");
+    sstOff_ = sbMgr_->GetSSTRegionOffset();
+    if (sstOff_ > idxOff_ + (int64_t) index_region_length) {
+        //Load Index and DataStor from the checkpoints
+        ckptLen_ = (sstOff_ - idxOff_) / 2;
+        if (!loadCheckpoint(index_ht_size, index_region_length)) {
+            __ERROR("Load Checkpoint failed.");
+            return false;
+        }
+    } else {
+        if(!loadIndex(index_ht_size, index_region_length)) {
+            __ERROR("Load Index failed.");
+            return false;
+        }
+
+        //Load DataStor
+        if (!loadDataStor()) {
+            __ERROR("Load SSTs failed.");
+            return false;
+        }
+    }
+
+    if (!sbMgr_->GetGraceCloseFlag() && !FastRecovery()) {
+        __ERROR("Recovery failed.");
         return false;
     }
+    idxMgr_->MarkLiveEntries();
+    if (ckptLen_) {
+        // tombstones are kept for a replay from the full checkpoint
+        idxMgr_->SetReplayStart(ckptFullSince_);
+        ckptStart_ = idxMgr_->GetLsn();
+    }
 
-    //Load DataStor
-    sstOff_ = idxOff_ + index_region_length;
-    if (!loadDataStor()) {
-        __ERROR("Load SSTs failed.");
+    // the metadata on the device is stale until the next clean close
+    sbMgr_->SetGraceCloseFlag(false);
+    if (!persistSuperBlockToDevice()) {
+        __ERROR("Persist SB failed.");
         return false;
     }
 
@@ -199,16 +258,29 @@ bool MetaStor::LoadMetaData() {
 }
 
 bool MetaStor::PersistMetaData() {
-    if (!PersistIndexToDevice()) {
-        __WARN("Persist Index failed.");
-        return false;
-    }
+    if (ckptLen_) {
+        if (!Checkpoint(true)) {
+            __WARN("Checkpoint failed.");
+            return false;
+        }
+        idxMgr_->UpdateMetaToSB();
+        if (!updateSBReservedContent()) {
+            __WARN("Persist SB reserved content failed.");
+            return false;
+        }
+    } else {
+        if (!PersistIndexToDevice()) {
+            __WARN("Persist Index failed.");
+            return false;
+        }
 
-    if (!PersistSSTsToDevice()) {
-        __WARN("Persist SSTs failed.");
-        return false;
+        if (!PersistSSTsToDevice()) {
+            __WARN("Persist SSTs failed.");
+            return false;
+        }
     }
 
+    sbMgr_->SetGraceCloseFlag(true);
     if (!persistSuperBlockToDevice()) {
         __WARN("Persist SB failed.");
         return false;
@@ -300,23 +372,13 @@ bool MetaStor::createIndex(uint32_t ht_size, uint64_t index_size) {
 bool MetaStor::loadIndex(uint32_t ht_size, uint64_t index_size) {
     idxMgr_->InitMeta(ht_size, index_size, sbMgr_->GetDataTheorySize(), sbMgr_->GetEntryCount());
 
-    uint64_t length = index_size;
-    char *buff = new char[length];
-    memset(buff, 0, length);
-
-    if ((uint64_t) metaDev_->pRead(buff, length, idxOff_) != length) {
-        __ERROR("Could not read Index region from device at %ld\n", idxOff_);
-        delete[] buff;
-        return false;
-    }
-
-    if(!idxMgr_->Set(buff, length)){
+    bool loaded = options_.lazy_open ? idxMgr_->LoadLazy(metaDev_, idxOff_, index_size)
+            : idxMgr_->Load(metaDev_, idxOff_, index_size);
+    if (!loaded) {
         __ERROR("Can't Set Index Region, Load Failed!");
-        delete[] buff;
         return false;
     }
 
-    delete[] buff;
     return true;
 }
 
@@ -370,7 +432,7 @@ bool MetaStor::createDataStor() {
     return true;
 }
 
-bool MetaStor::loadDataStor() {
+bool MetaStor::loadDataStor(char *sst_image) {
     uint64_t reserved_region_length = SuperBlockManager::ReservedRegionLength();
 
     char *reserved_content = new char[reserved_region_length];
@@ -390,6 +452,14 @@ bool MetaStor::loadDataStor() {
     }
 
     uint64_t length = dataStor_->GetSSTsLengthOnDisk();
+    if (sst_image) {
+        if (!dataStor_->SetAllSSTs(sst_image, length)) {
+            __ERROR("Can't Set SST Region, Load Failed!");
+            return false;
+        }
+        return true;
+    }
+
     char *buff = new char[length];
     memset(buff, 0 , length);
     if ((uint64_t) metaDev_->pRead(buff, length, sstOff_) != length) {
@@ -433,6 +503,10 @@ bool MetaStor::PersistSSTsToDevice() {
 
     free(align_buf);
 
+    return updateSBReservedContent();
+}
+
+bool MetaStor::updateSBReservedContent() {
     uint64_t reserved_region_length = SuperBlockManager::ReservedRegionLength();
 
     char *reserved_content = new char[reserved_region_length];
@@ -450,9 +524,343 @@ bool MetaStor::PersistSSTsToDevice() {
     return true;
 }
 
+// The DB was not closed cleanly: the index and the SSTs on the device
+// are those of the last close or checkpoint, the segments written since
+// are replayed.
 bool MetaStor::FastRecovery() {
+    __INFO("DB was not closed cleanly, replaying the segments written since the last checkpoint.");
+    KVTime start;
+    if (!dataStor_->ReplaySegments(idxMgr_->GetReplayStart())) {
+        return false;
+    }
+    KVTime end;
+    __INFO("Recovery done in %ld ms", (end - start) / 1000);
+    return true;
+}
+
+bool MetaStor::Checkpoint(bool final) {
+    std::lock_guard<std::mutex> l(ckptMtx_);
+    if (!ckptLen_) {
+        return false;
+    }
+    uint64_t start = idxMgr_->GetLsn();
+    // a checkpoint is taken while segments are written, so one indexed
+    // after the previous checkpoint started is only sure to be in this one
+    uint64_t since = final ? start : ckptStart_;
+    uint64_t index_len = sbMgr_->GetIndexRegionLength();
+    uint64_t sst_len = sbMgr_->GetSSTRegionLength();
+    uint64_t payload_len = ckptLen_ - ALIGNED_SIZE;
+
+    char *align_buf;
+    int ret = posix_memalign((void **)&align_buf, 4096, ckptLen_);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Checkpoint, Persist Failed!");
+        return false;
+    }
+    char *payload = align_buf + ALIGNED_SIZE;
+
+    char *sst = new char[sst_len];
+    memset(sst, 0, sst_len);
+    if (!dataStor_->GetAllSSTs(sst, sst_len)) {
+        __ERROR("Can't Get SSTs, Checkpoint Failed!");
+        delete[] sst;
+        free(align_buf);
+        return false;
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CKPT_MAGIC;
+    header.seq = ckptSeq_ + 1;
+    header.since = since;
+
+    uint64_t index_used = 0;
+    uint64_t sst_used = 0;
+    uint32_t entry_num = 0;
+    bool full = !ckptFullSeq_ || ckptForceFull_;
+    if (!full) {
+        //Delta: the dirty slots, then the SST pages changed
+        char *payload_end = payload + payload_len / CKPT_DELTA_RATIO;
+        full = !idxMgr_->GetCheckpoint(payload, payload_end - payload, false, since, index_used, entry_num);
+        char *buf_ptr = payload + index_used;
+        for (uint32_t page = 0; !full && (uint64_t) page * ALIGNED_SIZE < sst_len; page++) {
+            uint64_t off = (uint64_t) page * ALIGNED_SIZE;
+            uint64_t page_len = min(sst_len - off, (uint64_t) ALIGNED_SIZE);
+            if (!memcmp(sst + off, ckptSst_ + off, page_len)) {
+                continue;
+            }
+            if (buf_ptr + sizeof(uint32_t) + ALIGNED_SIZE > payload_end) {
+                full = true;
+                break;
+            }
+            memcpy((void *)buf_ptr, (const void *)&page, sizeof(uint32_t));
+            buf_ptr += sizeof(uint32_t);
+            memcpy((void *)buf_ptr, (const void *)(sst + off), page_len);
+            buf_ptr += ALIGNED_SIZE;
+        }
+        sst_used = buf_ptr - payload - index_used;
+        header.base_seq = ckptFullSeq_;
+    }
+    if (full) {
+        memset(payload, 0, index_len);
+        if (!idxMgr_->GetCheckpoint(payload, index_len, true, since, index_used, entry_num)) {
+            __ERROR("Can't Get Index, Checkpoint Failed!");
+            ckptForceFull_ = true;
+            delete[] sst;
+            free(align_buf);
+            return false;
+        }
+        memcpy((void *)(payload + index_len), (const void *)sst, sst_len);
+        sst_used = sst_len;
+        header.base_seq = header.seq;
+    }
+    header.full = full;
+    header.index_length = index_used;
+    header.sst_length = sst_used;
+    header.entry_num = entry_num;
+
+    // never over the full checkpoint the deltas apply to
+    int half = ckptFullHalf_ ^ 1;
+    uint64_t length = (index_used + sst_used + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    if (!writeCheckpoint(half, header, align_buf, ALIGNED_SIZE + length)) {
+        // a full checkpoint cleared the dirty slots
+        ckptForceFull_ = ckptForceFull_ || full;
+        delete[] sst;
+        free(align_buf);
+        return false;
+    }
+    free(align_buf);
+
+    ckptSeq_ = header.seq;
+    if (full) {
+        ckptFullSeq_ = header.seq;
+        ckptFullHalf_ = half;
+        ckptFullSince_ = since;
+        ckptForceFull_ = false;
+        delete[] ckptSst_;
+        ckptSst_ = sst;
+    } else {
+        delete[] sst;
+    }
+    ckptStart_ = start;
+    // a torn delta falls back to the full checkpoint, whose replay needs
+    // the tombstones written since
+    idxMgr_->SetReplayStart(ckptFullSince_);
+
+    __DEBUG("Checkpoint %lu (%s) done, %lu bytes of index, %lu bytes of SSTs",
+            header.seq, full ? "full" : "delta", index_used, sst_used);
+    return true;
+}
+
+bool MetaStor::writeCheckpoint(int half, CheckpointHeader &header, char *buff, uint64_t length) {
+    int64_t offset = idxOff_ + half * ckptLen_;
+
+    // the header goes last, a torn checkpoint has none
+    memset(buff, 0, ALIGNED_SIZE);
+    if ((uint64_t) metaDev_->pWrite(buff, ALIGNED_SIZE, offset) != ALIGNED_SIZE) {
+        __ERROR("Could not write Checkpoint at position %ld\n", offset);
+        return false;
+    }
+    if ((uint64_t) metaDev_->pWrite(buff + ALIGNED_SIZE, length - ALIGNED_SIZE, offset + ALIGNED_SIZE)
+            != length - ALIGNED_SIZE) {
+        __ERROR("Could not write Checkpoint at position %ld\n", offset);
+        return false;
+    }
+    memcpy((void *)buff, (const void *)&header, sizeof(header));
+    if ((uint64_t) metaDev_->pWrite(buff, ALIGNED_SIZE, offset) != ALIGNED_SIZE) {
+        __ERROR("Could not write Checkpoint at position %ld\n", offset);
+        return false;
+    }
+    return true;
+}
+
+bool MetaStor::readCheckpointHeader(int half, CheckpointHeader &header) {
+    int64_t offset = idxOff_ + half * ckptLen_;
+    char *align_buf;
+    int ret = posix_memalign((void **)&align_buf, 4096, ALIGNED_SIZE);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Checkpoint, Load Failed!");
+        return false;
+    }
+    if ((uint64_t) metaDev_->pRead(align_buf, ALIGNED_SIZE, offset) != ALIGNED_SIZE) {
+        __ERROR("Could not read Checkpoint from device at %ld\n", offset);
+        free(align_buf);
+        return false;
+    }
+    memcpy((void *)&header, (const void *)align_buf, sizeof(header));
+    free(align_buf);
+
+    return header.magic == CKPT_MAGIC
+            && ALIGNED_SIZE + header.index_length + header.sst_length <= ckptLen_;
+}
+
+bool MetaStor::readCheckpointPayload(int half, CheckpointHeader &header, char *&payload) {
+    int64_t offset = idxOff_ + half * ckptLen_ + ALIGNED_SIZE;
+    uint64_t length = header.index_length + header.sst_length;
+    length = (length + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    int ret = posix_memalign((void **)&payload, 4096, length);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Checkpoint, Load Failed!");
+        return false;
+    }
+    if ((uint64_t) metaDev_->pRead(payload, length, offset) != length) {
+        __ERROR("Could not read Checkpoint from device at %ld\n", offset);
+        free(payload);
+        return false;
+    }
+    return true;
+}
+
+// Load the newest full checkpoint and the delta written on it, if any.
+bool MetaStor::loadCheckpoint(uint32_t ht_size, uint64_t index_size) {
+    CheckpointHeader headers[2];
+    bool valid[2];
+    for (int i = 0; i < 2; i++) {
+        valid[i] = readCheckpointHeader(i, headers[i]);
+    }
+
+    int full = -1;
+    for (int i = 0; i < 2; i++) {
+        if (valid[i] && headers[i].full && (full < 0 || headers[i].seq > headers[full].seq)) {
+            full = i;
+        }
+    }
+    if (full < 0 || headers[full].index_length != index_size) {
+        __ERROR("No valid full checkpoint on device");
+        return false;
+    }
+    CheckpointHeader &full_header = headers[full];
+    CheckpointHeader &delta_header = headers[full ^ 1];
+    bool delta = valid[full ^ 1] && !delta_header.full
+            && delta_header.base_seq == full_header.seq && delta_header.seq > full_header.seq;
+
+    //Load the SSTs of the full checkpoint and the delta on them, the
+    //volumes are open before the index loads
+    int64_t full_offset = idxOff_ + full * ckptLen_ + ALIGNED_SIZE;
+    uint64_t sst_len = full_header.sst_length;
+    uint64_t sst_read_len = (sst_len + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    char *payload;
+    int ret = posix_memalign((void **)&payload, 4096, sst_read_len);
+    if (ret < 0) {
+        __ERROR("Can't allocate memory for Checkpoint, Load Failed!");
+        return false;
+    }
+    if ((uint64_t) metaDev_->pRead(payload, sst_read_len, full_offset + index_size) != sst_read_len) {
+        __ERROR("Could not read Checkpoint from device at %ld\n", full_offset + index_size);
+        free(payload);
+        return false;
+    }
+    delete[] ckptSst_;
+    ckptSst_ = new char[sst_len];
+    memcpy((void *)ckptSst_, (const void *)payload, sst_len);
+    free(payload);
+    payload = NULL;
+
+    char *sst = new char[sst_len];
+    memcpy((void *)sst, (const void *)ckptSst_, sst_len);
+    uint64_t since = full_header.since;
+    ckptSeq_ = full_header.seq;
+
+    if (delta) {
+        if (!readCheckpointPayload(full ^ 1, delta_header, payload)) {
+            delete[] sst;
+            return false;
+        }
+        char *buf_ptr = payload + delta_header.index_length;
+        char *buf_end = buf_ptr + delta_header.sst_length;
+        while (buf_ptr < buf_end) {
+            uint32_t page;
+            memcpy((void *)&page, (const void *)buf_ptr, sizeof(uint32_t));
+            buf_ptr += sizeof(uint32_t);
+            uint64_t off = (uint64_t) page * ALIGNED_SIZE;
+            if (off >= sst_len) {
+                __ERROR("Corrupted SST checkpoint at page %u", page);
+                free(payload);
+                delete[] sst;
+                return false;
+            }
+            memcpy((void *)(sst + off), (const void *)buf_ptr, min(sst_len - off, (uint64_t) ALIGNED_SIZE));
+            buf_ptr += ALIGNED_SIZE;
+        }
+        since = delta_header.since;
+        ckptSeq_ = delta_header.seq;
+    }
+
+    if (!loadDataStor(sst)) {
+        __ERROR("Load SSTs failed.");
+        free(payload);
+        delete[] sst;
+        return false;
+    }
+    delete[] sst;
+
+    //Load the full index and apply the delta on it
+    idxMgr_->InitMeta(ht_size, index_size, 0, full_header.entry_num);
+    bool loaded = options_.lazy_open ? idxMgr_->LoadLazy(metaDev_, full_offset, index_size)
+            : idxMgr_->Load(metaDev_, full_offset, index_size);
+    if (!loaded) {
+        __ERROR("Can't Set Index Region, Load Failed!");
+        free(payload);
+        return false;
+    }
+    if (delta) {
+        if (!idxMgr_->ApplyCheckpoint(payload, delta_header.index_length)) {
+            __ERROR("Can't Apply Index Checkpoint, Load Failed!");
+            free(payload);
+            return false;
+        }
+        free(payload);
+    }
+    // a delta taken at close carries the newest sequence number in use
+    idxMgr_->AdvanceLsn(since);
+    idxMgr_->SetReplayStart(since);
+
+    ckptFullSeq_ = full_header.seq;
+    ckptFullHalf_ = full;
+    ckptFullSince_ = full_header.since;
+
+    __INFO("Loaded checkpoint %lu%s", ckptSeq_, delta ? " (delta)" : "");
     return true;
 }
 
+void MetaStor::StartThds() {
+    if (!ckptLen_ || options_.checkpoint_interval <= 0) {
+        return;
+    }
+    ckptT_stop_.store(false);
+    ckptT_ = std::thread(&MetaStor::CheckpointThdEntry, this);
+}
+
+void MetaStor::StopThds() {
+    if (!ckptT_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(ckptThdMtx_);
+        ckptT_stop_.store(true);
+    }
+    ckptCv_.notify_all();
+    ckptT_.join();
+}
+
+void MetaStor::CheckpointThdEntry() {
+    __DEBUG("Checkpoint thread start!!");
+
+    std::unique_lock<std::mutex> l(ckptThdMtx_);
+    while (!ckptT_stop_) {
+        if (ckptCv_.wait_for(l, std::chrono::seconds(options_.checkpoint_interval),
+                             [this] { return ckptT_stop_.load(); })) {
+            break;
+        }
+        l.unlock();
+        if (!Checkpoint()) {
+            __WARN("Checkpoint failed.");
+        }
+        l.lock();
+    }
+
+    __DEBUG("Checkpoint thread stop!!");
+}
+
 
 } // namespace hlkvds
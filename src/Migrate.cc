@@ -1,3 +1,4 @@
+#include <deque>
 #include "Migrate.h"
 #include "Db_Structure.h"
 #include "IndexManager.h"
@@ -9,18 +10,36 @@ using namespace std;
 
 namespace hlkvds {
 Migrate::~Migrate() {
-    free(ftDataBuf_);
-    ftDataBuf_ = NULL;
+    loadWQ_->Stop();
+    writeWQ_->Stop();
+    delete loadWQ_;
+    delete writeWQ_;
+
+    for (uint32_t i = 0; i < loadBufs_.size(); i++) {
+        free(loadBufs_[i]);
+    }
+    loadBufs_.clear();
 }
 
 Migrate::Migrate(IndexManager* im, FastTier* ft, MediumTier* mt, Options &opt) :
-    ft_(ft), mt_(mt), idxMgr_(im), options_(opt), ftDataBuf_(NULL) {
+    ft_(ft), mt_(mt), idxMgr_(im), options_(opt),
+    ioClass_(IoClass::BACKGROUND), loadWQ_(NULL), writeWQ_(NULL),
+    pendingWrites_(0), roundFree_(0) {
 
         ftSegSize_ = ft_->GetSegSize();
-        posix_memalign((void **)&ftDataBuf_, 4096, ftSegSize_);
+        for (int i = 0; i < MIG_LOAD_THREADS; i++) {
+            char *buf = NULL;
+            posix_memalign((void **)&buf, 4096, ftSegSize_);
+            loadBufs_.push_back(buf);
+        }
+
+        loadWQ_ = new MigLoadWQ(this, MIG_LOAD_THREADS);
+        loadWQ_->Start();
+        writeWQ_ = new MigWriteWQ(this, MIG_WRITE_THREADS);
+        writeWQ_->Start();
 }
 
-uint32_t Migrate::ForeMigrate(uint32_t mt_vol_id) {
+uint32_t Migrate::ForeMigrate() {
     std::lock_guard <std::mutex> lck(mtx_);
 
     //Get the sorted Segments
@@ -34,92 +53,225 @@ uint32_t Migrate::ForeMigrate(uint32_t mt_vol_id) {
     }
 
     uint32_t max_seg_num = ft_vol->GetNumberOfSeg();
-    free_seg_num = doMigrate(mt_vol_id, max_seg_num);
+    // a writer is waiting for this migration, it is not background I/O;
+    // one segment per volume is written in parallel
+    free_seg_num = doMigrate(max_seg_num, mt_->GetVolumeNum(), IoClass::FG_WRITE);
     return free_seg_num;
 }
 
-uint32_t Migrate::BackMigrate(uint32_t mt_vol_id) {
+uint32_t Migrate::BackMigrate() {
     std::lock_guard <std::mutex> lck(mtx_);
-    return doMigrate(mt_vol_id, 10000);
+    return doMigrate(MIG_CANDS_MAX, MIG_ROUND_SEGS, IoClass::BACKGROUND);
 }
 
-uint32_t Migrate::doMigrate(uint32_t mt_vol_id, uint32_t max_seg_num) {
+uint32_t Migrate::doMigrate(uint32_t max_seg_num, uint32_t max_flush, IoClass cls) {
+    // the live maps are complete only once the whole index is loaded
+    if (!idxMgr_->LoadAll()) {
+        return 0;
+    }
+    ioClass_ = cls;
     Volume *ft_vol = ft_->GetVolume();
-    Volume *mt_vol = mt_->GetVolume(mt_vol_id);
-
-    std::multimap < uint32_t, uint32_t > cands_map;
-    ft_vol->SortSegsByTS(cands_map, max_seg_num);
-
-    //do merge
-    bool ret = false;
-    std::vector <uint32_t> free_seg_vec;
 
-    std::list<KVSlice*> slice_list;
-    std::list<KVSlice*> recycle_list;
+    std::vector<uint32_t> cands;
+    ft_vol->SortSegsByHeat(cands, max_seg_num);
+
+    std::vector<char *> free_bufs(loadBufs_);
+    std::deque<MigLoadTask *> loads;
+    size_t next = 0;
+    uint32_t flushed = 0;
+
+    MigWriteTask *out = NULL;
+    while (flushed < max_flush) {
+        while (next < cands.size() && !free_bufs.empty()) {
+            MigLoadTask *task = new MigLoadTask(cands[next++], free_bufs.back());
+            free_bufs.pop_back();
+            loads.push_back(task);
+            loadWQ_->Add_task(task);
+        }
+        if (loads.empty()) {
+            break;
+        }
 
-    SegForMigrate *mig_seg = new SegForMigrate(mt_vol, idxMgr_);
-    for (std::multimap<uint32_t, uint32_t>::iterator iter = cands_map.begin(); iter
-            != cands_map.end(); ++iter) {
-        uint32_t seg_id = iter->second;
+        MigLoadTask *task = loads.front();
+        loads.pop_front();
+        waitLoad(task);
+        free_bufs.push_back(task->buf);
 
-        ret = loadKvList(seg_id, slice_list);
-        if (!ret) {
+        std::list<KVSlice*> &slice_list = task->slices;
+        if (!task->ok) {
+            cleanKvList(slice_list);
+            delete task;
             continue;
         }
 
-        if (mig_seg->TryPutList(slice_list)) {
-            mig_seg->PutList(slice_list);
-            free_seg_vec.push_back(seg_id);
-            recycle_list.splice(recycle_list.end(), slice_list);
+        if (out && !out->seg->TryPutList(slice_list)) {
+            bool ret = flushSeg(out);
+            out = NULL;
+            if (!ret || ++flushed >= max_flush) {
+                cleanKvList(slice_list);
+                delete task;
+                break;
+            }
         }
-        else {
-            recycle_list.splice(recycle_list.end(), slice_list);
-            break;
+        if (!out) {
+            SegForMigrate *seg = openSeg();
+            if (!seg) {
+                __WARN("The Medium Tier is Full, can not migrate");
+                cleanKvList(slice_list);
+                delete task;
+                break;
+            }
+            out = new MigWriteTask;
+            out->seg = seg;
+            out->vol = seg->GetSelfVolume();
+            out->seg_id = 0;
         }
+        if (!out->seg->TryPutList(slice_list)) {
+            __WARN("Live data of segment %u does not fit a Medium Tier segment", task->seg_id);
+            cleanKvList(slice_list);
+            delete task;
+            continue;
+        }
+
+        out->seg->PutList(slice_list);
+        out->slices.splice(out->slices.end(), slice_list);
+        // freed once the output segment is written
+        ft_vol->Pin(task->seg_id);
+        out->victims.push_back(task->seg_id);
+        delete task;
     }
-    
-    //Allocate segment id from volume
-    uint32_t mig_seg_id;
-    if (!mt_vol->Alloc(mig_seg_id)) {
-        __WARN("The Medium Tier Volume[%d] is Full, can not allocate segment", mig_seg_id);
-        delete mig_seg;
-        cleanKvList(recycle_list);
-        return 0;
+    if (out) {
+        flushSeg(out);
     }
-    mig_seg->SetSegId(mig_seg_id);
 
-    //Write to volume device
-    ret = mig_seg->WriteSegToDevice();
-    if (!ret) {
-        __ERROR("Write First GC segment to device failed, free 0 segments");
-        delete mig_seg;
-        mt_vol->FreeForFailed(mig_seg_id);
-        cleanKvList(recycle_list);
-        return 0;
+    // segments read ahead but not migrated this round
+    while (!loads.empty()) {
+        MigLoadTask *task = loads.front();
+        loads.pop_front();
+        task->skip.store(true);
+        waitLoad(task);
+        cleanKvList(task->slices);
+        delete task;
     }
 
-    uint32_t free_size = mig_seg->GetFreeSize();
-    mt_vol->Use(mig_seg_id, free_size);
+    uint32_t total_free = waitWrites();
+    __DEBUG("Once doMigrate total free %d segments in Fast Tier!", total_free);
+    return total_free;
+}
 
-    mig_seg->UpdateToIndex();
+// Output segment on the next MediumTier volume with a free segment.
+SegForMigrate* Migrate::openSeg() {
+    uint32_t vol_num = mt_->GetVolumeNum();
+    for (uint32_t i = 0; i < vol_num; i++) {
+        Volume *vol = mt_->GetVolume(mt_->PickVolForMigrate());
+        if (vol->GetTotalFreeSegs()) {
+            SegForMigrate *seg = new SegForMigrate(vol, idxMgr_);
+            seg->SetIoClass(ioClass_);
+            return seg;
+        }
+    }
+    return NULL;
+}
 
+// Hand the output segment to the write queue, false if its volume has
+// no segment left to write it to.
+bool Migrate::flushSeg(MigWriteTask *task) {
+    Volume *ft_vol = ft_->GetVolume();
 
-    //clean work for first segment
-    for (std::vector<uint32_t>::iterator iter = free_seg_vec.begin(); iter
-            != free_seg_vec.end(); ++iter) {
-        ft_vol->FreeForGC(*iter);
+    bool ret = true;
+    if (!task->slices.empty()) {
+        ret = task->vol->Alloc(task->seg_id);
+        if (!ret) {
+            __WARN("The Medium Tier Volume[%d] is Full, can not allocate segment", task->vol->GetId());
+        }
+    } else {
+        // nothing live in the victims, they are just freed
+        delete task->seg;
+        task->seg = NULL;
     }
-    delete mig_seg;
-    cleanKvList(recycle_list);
 
-    uint32_t total_free = free_seg_vec.size();
+    if (!ret) {
+        // the victims keep their data and become candidates again
+        for (std::vector<uint32_t>::iterator iter = task->victims.begin(); iter
+                != task->victims.end(); ++iter) {
+            ft_vol->Unpin(*iter);
+        }
+        delete task->seg;
+        cleanKvList(task->slices);
+        delete task;
+        return false;
+    }
 
-    cands_map.clear();
-    __DEBUG("Once doMigrate total free %d segments in Fast Tier!", total_free);
+    {
+        std::lock_guard<std::mutex> l(taskMtx_);
+        pendingWrites_++;
+    }
+    writeWQ_->Add_task(task);
+    return true;
+}
+
+uint32_t Migrate::waitWrites() {
+    std::unique_lock<std::mutex> l(taskMtx_);
+    taskCv_.wait(l, [this] { return pendingWrites_ == 0; });
+    uint32_t total_free = roundFree_;
+    roundFree_ = 0;
     return total_free;
 }
 
-void Migrate::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
+void Migrate::writeTask(MigWriteTask *task) {
+    Volume *ft_vol = ft_->GetVolume();
+
+    bool ret = true;
+    if (task->seg) {
+        task->seg->SetSegId(task->seg_id);
+        ret = task->seg->WriteSegToDevice();
+        if (ret) {
+            task->vol->Pin(task->seg_id);
+            task->vol->Use(task->seg_id, task->seg->GetFreeSize());
+            task->seg->UpdateToIndex();
+            task->vol->Unpin(task->seg_id);
+        } else {
+            __ERROR("Write migration segment to device failed, seg_id = %u", task->seg_id);
+            task->vol->FreeForFailed(task->seg_id);
+        }
+    }
+
+    // on failure the victims keep their data and become candidates again
+    uint32_t freed = 0;
+    for (std::vector<uint32_t>::iterator iter = task->victims.begin(); iter
+            != task->victims.end(); ++iter) {
+        if (ret) {
+            ft_vol->FreeForGC(*iter);
+            freed++;
+        }
+        ft_vol->Unpin(*iter);
+    }
+
+    delete task->seg;
+    cleanKvList(task->slices);
+    delete task;
+
+    std::lock_guard<std::mutex> l(taskMtx_);
+    pendingWrites_--;
+    roundFree_ += freed;
+    taskCv_.notify_all();
+}
+
+void Migrate::loadTask(MigLoadTask *task) {
+    if (!task->skip.load()) {
+        task->ok = loadKvList(task->seg_id, task->buf, task->slices);
+    }
+    std::lock_guard<std::mutex> l(taskMtx_);
+    task->done = true;
+    taskCv_.notify_all();
+}
+
+void Migrate::waitLoad(MigLoadTask *task) {
+    std::unique_lock<std::mutex> l(taskMtx_);
+    taskCv_.wait(l, [task] { return task->done; });
+}
+
+void Migrate::loadSegKV(char *buf, list<KVSlice*> &slice_list, uint32_t num_keys,
                           uint64_t phy_offset) {
     uint32_t head_offset = SegBase::SizeOfSegOnDisk();
 
@@ -128,7 +280,7 @@ void Migrate::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
 
     for (uint32_t index = 0; index < num_keys; index++) {
         DataHeader header;
-        memcpy(&header, &ftDataBuf_[head_offset],
+        memcpy(&header, &buf[head_offset],
                IndexManager::SizeOfDataHeader());
 
         DataHeaderAddress addrs(vol_id, phy_offset + (uint64_t)head_offset);
@@ -136,33 +288,29 @@ void Migrate::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
 
         __DEBUG("load hash_entry from seg_offset = %ld, header_offset = %d", phy_offset, head_offset );
 
-        if (idxMgr_->IsSameInMem(hash_entry)) {
-
+        uint16_t data_len = header.GetDataSize();
+        bool copy = data_len ? ft_vol->IsLiveEntry(hash_entry)
+                : idxMgr_->KeepTombstone(hash_entry);
+        if (copy) {
             Kvdb_Digest digest = header.GetDigest();
-            uint16_t data_len = header.GetDataSize();
-            if (data_len != 0) {
-                uint32_t data_offset = header.GetDataOffset();
-                char* data = new char[data_len];
-                memcpy(data, &ftDataBuf_[data_offset], data_len);
-
-                //memcpy key to KVSlice.GetNextHeadOffsetGetNextHeadOffset
-                uint16_t key_len =header.GetKeySize();
-                uint32_t next_head_offset = header.GetNextHeadOffset();
-                uint32_t key_offset;
-                if (ALIGNED_SIZE == data_len) {
-                    key_offset = next_head_offset - key_len;
-                } else {
-                    key_offset = next_head_offset - data_len - key_len;
-                }
-                char* key = new char[key_len+1];
-                memcpy(key, &ftDataBuf_[key_offset], key_len);
-                key[key_len] = '\0';
-                KVSlice *slice = new KVSlice(&digest, key, key_len, data, data_len);
-                slice->SetHashEntryBeforeGC(&hash_entry);
-
-                slice_list.push_back(slice);
-                __DEBUG("the slice key_digest = %s, value = %s, seg_offset = %ld, head_offset = %d is valid, need to write", digest.GetDigest(), data, phy_offset, head_offset);
+            char* data = NULL;
+            if (data_len) {
+                data = new char[data_len];
+                memcpy(data, &buf[header.GetDataOffset()], data_len);
             }
+
+            // the key always follows its header, an aligned value may
+            // be stored inline (append log) or at the segment tail
+            uint16_t key_len =header.GetKeySize();
+            uint32_t key_offset = head_offset + IndexManager::SizeOfDataHeader();
+            char* key = new char[key_len+1];
+            memcpy(key, &buf[key_offset], key_len);
+            key[key_len] = '\0';
+            KVSlice *slice = new KVSlice(&digest, key, key_len, data, data_len);
+            slice->SetHashEntryBeforeGC(&hash_entry);
+
+            slice_list.push_back(slice);
+            __DEBUG("the slice key_digest = %s, seg_offset = %ld, head_offset = %d is valid, need to write", digest.GetDigest(), phy_offset, head_offset);
         }
 
         head_offset = header.GetNextHeadOffset();
@@ -170,24 +318,24 @@ void Migrate::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
 
 }
 
-bool Migrate::loadKvList(uint32_t seg_id, std::list<KVSlice*> &slice_list) {
+bool Migrate::loadKvList(uint32_t seg_id, char *buf, std::list<KVSlice*> &slice_list) {
 
     uint64_t seg_phy_off;
 
     Volume *ft_vol = ft_->GetVolume();
     ft_vol->CalcSegOffsetFromId(seg_id, seg_phy_off);
 
-    memset(ftDataBuf_, 0 , ftSegSize_);
-    if (!ft_vol->Read(ftDataBuf_, ftSegSize_, seg_phy_off)) {
+    memset(buf, 0 , ftSegSize_);
+    if (!ft_vol->Read(buf, ftSegSize_, seg_phy_off, ioClass_)) {
         return false;
     }
 
     SegHeaderOnDisk seg_header;
-    memcpy(&seg_header, ftDataBuf_, SegBase::SizeOfSegOnDisk());
+    memcpy(&seg_header, buf, SegBase::SizeOfSegOnDisk());
 
     uint32_t num_keys = seg_header.number_keys;
 
-    loadSegKV(slice_list, num_keys, seg_phy_off);
+    loadSegKV(buf, slice_list, num_keys, seg_phy_off);
     return true;
 }
 
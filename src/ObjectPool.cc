@@ -0,0 +1,8 @@
+#include "ObjectPool.h"
+
+namespace hlkvds {
+
+std::atomic<uint64_t> PoolStat::allocCount_(0);
+std::atomic<uint64_t> PoolStat::reuseCount_(0);
+
+}// namespace hlkvds
@@ -15,7 +15,19 @@ Options::Options() :
         seg_full_rate(SEG_FULL_RATE),
         gc_upper_level(GC_UPPER_LEVEL),
         gc_lower_level(GC_LOWER_LEVEL),
+        gc_policy(GC_POLICY),
+        gc_generations(GC_GENERATIONS),
+        mig_upper_level(MIG_UPPER_LEVEL),
+        mig_lower_level(MIG_LOWER_LEVEL),
+        promote_threshold(PROMOTE_THRESHOLD),
+        direct_medium_size(DIRECT_MEDIUM_SIZE),
         aggregate_request(1),
+        io_scheduler(IO_SCHEDULER),
+        bg_io_rate(BG_IO_RATE),
+        fg_p99_target(FG_P99_TARGET),
+        discard_segments(DISCARD_SEGMENTS),
+        checkpoint_interval(CHECKPOINT_INTERVAL),
+        lazy_open(LAZY_OPEN),
 
         datastor_type(1),
         hashtable_size(0),
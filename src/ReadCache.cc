@@ -55,7 +55,7 @@ void ReadCache::Put(string key, string value){
 }
 
 bool ReadCache::Get(string key, string &value){
-	ReadLock r_lock(myLock);
+	WriteLock w_lock(myLock);//a hit reorders the lru lists
 	map<string, string>::iterator it_dedup = dedup_map.find(key);
 	if( it_dedup!=dedup_map.end() ){
 		return cache_map->Get(it_dedup->second, value);
@@ -76,6 +76,7 @@ void ReadCache::Delete(string key){
 				refer_map.erase(it_refer);
 				break;
 			}
+			it_refer++;
 		}
 		if(refer_map.count(it_dedup->second)==0) cache_map->Delete(it_dedup->second);
 		dedup_map.erase(it_dedup);
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "SegReplayer.h"
+#include "Db_Structure.h"
+#include "Volume.h"
+#include "Segment.h"
+
+using namespace std;
+
+namespace hlkvds {
+
+SegReplayer::SegReplayer(vector<Volume *> &vols, IndexManager *im, uint64_t since) :
+    vols_(vols), idxMgr_(im), since_(since), failed_(false), keyNum_(0),
+    droppedNum_(0), readBytes_(0) {
+    for (uint32_t i = 0; i < vols_.size(); i++) {
+        Volume *vol = vols_[i];
+        volMap_[vol->GetId()] = vol;
+        VolScan &scan = volScans_[vol->GetId()];
+        scan.states.assign(vol->GetNumberOfSeg(), SEG_UNCHANGED);
+        scan.logs.assign(vol->GetNumberOfSeg(), NULL);
+    }
+}
+
+SegReplayer::~SegReplayer() {
+    for (uint32_t i = 0; i < segLogs_.size(); i++) {
+        delete segLogs_[i];
+    }
+}
+
+bool SegReplayer::Replay() {
+    vector<thread> thds;
+    for (uint32_t i = 0; i < vols_.size(); i++) {
+        Volume *vol = vols_[i];
+        uint32_t seg_num = vol->GetNumberOfSeg();
+        uint32_t step = (seg_num + REPLAY_SCAN_THREADS - 1) / REPLAY_SCAN_THREADS;
+        for (uint32_t begin = 0; begin < seg_num; begin += step) {
+            uint32_t end = min(seg_num, begin + step);
+            thds.push_back(thread(&SegReplayer::scanRange, this, vol, begin, end));
+        }
+    }
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+    if (failed_) {
+        return false;
+    }
+
+    // a later record of a key wins, as it did when it was written
+    sort(segLogs_.begin(), segLogs_.end(), [](const SegLog *a, const SegLog *b) {
+        if (a->lsn != b->lsn) {
+            return a->lsn < b->lsn;
+        }
+        if (a->vol->GetId() != b->vol->GetId()) {
+            return a->vol->GetId() < b->vol->GetId();
+        }
+        return a->seg_id < b->seg_id;
+    });
+    for (uint32_t i = 0; i < segLogs_.size(); i++) {
+        applyLog(segLogs_[i]);
+    }
+
+    dropStaleEntries();
+    recomputeLiveSize();
+
+    __INFO("Replayed %lu keys of %lu segments, dropped %lu stale keys, read %lu bytes",
+            keyNum_, segLogs_.size(), droppedNum_, readBytes_.load());
+    return true;
+}
+
+void SegReplayer::scanRange(Volume *vol, uint32_t begin, uint32_t end) {
+    char *buf;
+    uint32_t seg_size = vol->GetSegmentSize();
+    if (posix_memalign((void **) &buf, 4096, seg_size)) {
+        __ERROR("Can't allocate memory for segment replay");
+        std::lock_guard<std::mutex> l(mtx_);
+        failed_ = true;
+        return;
+    }
+    for (uint32_t seg_id = begin; seg_id < end; seg_id++) {
+        if (!scanSeg(vol, seg_id, buf)) {
+            std::lock_guard<std::mutex> l(mtx_);
+            failed_ = true;
+            break;
+        }
+    }
+    free(buf);
+}
+
+// Read [begin, end) of the segment at phy_offset into the same offsets
+// of buf, widened to ALIGNED_SIZE boundaries.
+bool SegReplayer::readSegRange(Volume *vol, char *buf, uint64_t phy_offset, uint32_t begin, uint32_t end) {
+    uint32_t seg_size = vol->GetSegmentSize();
+    begin = begin / ALIGNED_SIZE * ALIGNED_SIZE;
+    end = std::min(seg_size, (end + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE);
+    if (begin >= end) {
+        return true;
+    }
+    if (!vol->Read(&buf[begin], end - begin, phy_offset + begin, IoClass::FG_READ)) {
+        return false;
+    }
+    readBytes_.fetch_add(end - begin, std::memory_order_relaxed);
+    return true;
+}
+
+// Walk the header chain of a segment written since the metadata was
+// persisted. A record whose key does not match its digest ends the walk:
+// the segment write was torn there, or the segment holds older data.
+bool SegReplayer::scanSeg(Volume *vol, uint32_t seg_id, char *buf) {
+    VolScan &scan = volScans_[vol->GetId()];
+    uint64_t phy_offset = 0;
+    vol->CalcSegOffsetFromId(seg_id, phy_offset);
+
+    uint32_t seg_size = vol->GetSegmentSize();
+    uint32_t read_end = std::min((uint32_t) REPLAY_HEAD_READ_SIZE, seg_size);
+    if (!readSegRange(vol, buf, phy_offset, 0, read_end)) {
+        return false;
+    }
+
+    SegHeaderOnDisk seg_header;
+    memcpy(&seg_header, buf, SegBase::SizeOfSegOnDisk());
+    uint32_t head_size = IndexManager::SizeOfDataHeader();
+    uint32_t max_keys = (seg_size - SegBase::SizeOfSegOnDisk()) / head_size;
+    if (seg_header.lsn == 0 || seg_header.number_keys == 0
+            || seg_header.number_keys > max_keys) {
+        scan.states[seg_id] = SEG_EMPTY;
+        return true;
+    }
+    if (seg_header.lsn < since_) {
+        return true;
+    }
+    // never hand out a sequence number found on the device again
+    idxMgr_->AdvanceLsn(seg_header.lsn + 1);
+
+    SegLog *log = new SegLog;
+    log->vol = vol;
+    log->seg_id = seg_id;
+    log->timestamp = seg_header.timestamp;
+    log->lsn = seg_header.lsn;
+
+    uint32_t head_offset = SegBase::SizeOfSegOnDisk();
+    uint32_t head_end = head_offset;
+    uint32_t tail_begin = seg_size;
+    for (uint32_t index = 0; index < seg_header.number_keys; index++) {
+        uint32_t need = head_offset + head_size;
+        if (need > seg_size) {
+            break;
+        }
+        if (need > read_end) {
+            uint32_t end = std::min(seg_size, std::max(need, read_end * 2));
+            if (!readSegRange(vol, buf, phy_offset, read_end, end)) {
+                delete log;
+                return false;
+            }
+            read_end = end;
+        }
+
+        SegRecord rec;
+        memcpy(&rec.header, &buf[head_offset], head_size);
+        rec.head_offset = head_offset;
+        DataHeader &header = rec.header;
+        uint32_t next_offset = header.GetNextHeadOffset();
+        uint32_t key_end = need + header.GetKeySize();
+        uint32_t data_offset = header.GetDataOffset();
+        uint32_t data_end = data_offset + header.GetDataSize();
+        bool inline_data = header.GetDataSize() && data_offset < next_offset;
+        if (key_end > seg_size || data_end > seg_size) {
+            break;
+        }
+
+        // unaligned values follow their key in the head region
+        need = inline_data ? std::max(key_end, data_end) : key_end;
+        if (need > read_end) {
+            uint32_t end = std::min(seg_size, std::max(need, read_end * 2));
+            if (!readSegRange(vol, buf, phy_offset, read_end, end)) {
+                delete log;
+                return false;
+            }
+            read_end = end;
+        }
+
+        Kvdb_Key key(&buf[head_offset + head_size], header.GetKeySize());
+        Kvdb_Digest digest;
+        KeyDigestHandle::CalcDigest(&key, digest);
+        if (!(digest == header.GetDigest())) {
+            break;
+        }
+
+        log->records.push_back(rec);
+        head_end = std::max(head_end, need);
+        if (header.GetDataSize() && !inline_data) {
+            tail_begin = std::min(tail_begin, data_offset);
+        }
+        if (next_offset <= head_offset) {
+            break;
+        }
+        head_offset = next_offset;
+    }
+
+    if (log->records.empty()) {
+        delete log;
+        scan.states[seg_id] = SEG_EMPTY;
+        return true;
+    }
+
+    uint32_t free_size = tail_begin > head_end ? tail_begin - head_end : 0;
+    vol->RecoverSeg(seg_id, free_size, log->timestamp);
+    scan.states[seg_id] = SEG_REPLAYED;
+    scan.logs[seg_id] = log;
+
+    std::lock_guard<std::mutex> l(mtx_);
+    segLogs_.push_back(log);
+    return true;
+}
+
+void SegReplayer::applyLog(SegLog *log) {
+    uint64_t phy_offset = 0;
+    log->vol->CalcSegOffsetFromId(log->seg_id, phy_offset);
+
+    for (uint32_t i = 0; i < log->records.size(); i++) {
+        SegRecord &rec = log->records[i];
+        DataHeaderAddress addrs(log->vol->GetId(), phy_offset + rec.head_offset);
+        HashEntry entry(rec.header, addrs, NULL);
+
+        // the value is not read, data only tells a write from a delete
+        Kvdb_Digest digest = rec.header.GetDigest();
+        uint16_t data_len = rec.header.GetDataSize();
+        KVSlice slice(&digest, NULL, 0, data_len ? (const char *) &rec : NULL, data_len);
+        slice.SetHashEntry(&entry);
+        idxMgr_->UpdateIndex(&slice);
+        if (!data_len) {
+            idxMgr_->RemoveEntry(entry);
+        }
+        keyNum_++;
+    }
+}
+
+// An entry is stale when its segment was rewritten or emptied since the
+// metadata was persisted and the record it points at is not there any
+// more, e.g. a deleted key whose tombstone is gone with its segment.
+bool SegReplayer::isStaleEntry(HashEntry &entry) {
+    map<int, Volume *>::iterator vol_iter = volMap_.find(entry.GetHeaderLocation());
+    if (vol_iter == volMap_.end()) {
+        return true;
+    }
+    Volume *vol = vol_iter->second;
+    uint32_t seg_id;
+    uint64_t offset = entry.GetHeaderOffset();
+    if (!vol->CalcSegIdFromOffset(offset, seg_id)) {
+        return true;
+    }
+
+    VolScan &scan = volScans_[vol->GetId()];
+    if (scan.states[seg_id] == SEG_UNCHANGED) {
+        return false;
+    }
+    if (scan.states[seg_id] == SEG_EMPTY) {
+        return true;
+    }
+
+    uint64_t seg_offset = 0;
+    vol->CalcSegOffsetFromId(seg_id, seg_offset);
+    uint32_t head_offset = (uint32_t) (offset - seg_offset);
+    vector<SegRecord> &records = scan.logs[seg_id]->records;
+    for (uint32_t i = 0; i < records.size(); i++) {
+        if (records[i].head_offset == head_offset) {
+            return !(records[i].header.GetDigest() == entry.GetKeyDigest());
+        }
+    }
+    return true;
+}
+
+void SegReplayer::dropStaleEntries() {
+    vector<HashEntry> stale;
+    uint32_t ht_size = idxMgr_->GetHashTableSize();
+    for (uint32_t i = 0; i < ht_size; i++) {
+        vector<HashEntry> entries = idxMgr_->GetEntryListByNo(i)->get();
+        for (uint32_t j = 0; j < entries.size(); j++) {
+            if (isStaleEntry(entries[j])) {
+                stale.push_back(entries[j]);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < stale.size(); i++) {
+        idxMgr_->DropEntry(stale[i]);
+    }
+    droppedNum_ = stale.size();
+}
+
+void SegReplayer::recomputeLiveSize() {
+    map<int, vector<uint64_t> > live;
+    for (uint32_t i = 0; i < vols_.size(); i++) {
+        live[vols_[i]->GetId()].assign(vols_[i]->GetNumberOfSeg(), 0);
+    }
+
+    uint32_t ht_size = idxMgr_->GetHashTableSize();
+    for (uint32_t i = 0; i < ht_size; i++) {
+        vector<HashEntry> entries = idxMgr_->GetEntryListByNo(i)->get();
+        for (uint32_t j = 0; j < entries.size(); j++) {
+            HashEntry &entry = entries[j];
+            Volume *vol = volMap_[entry.GetHeaderLocation()];
+            uint32_t seg_id;
+            if (vol->CalcSegIdFromOffset(entry.GetHeaderOffset(), seg_id)) {
+                live[vol->GetId()][seg_id] += IndexManager::SizeOfDataHeader()
+                        + entry.GetKeySize() + entry.GetDataSize();
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < vols_.size(); i++) {
+        Volume *vol = vols_[i];
+        vector<uint64_t> &vol_live = live[vol->GetId()];
+        for (uint32_t seg_id = 0; seg_id < vol_live.size(); seg_id++) {
+            vol->SetSegLiveSize(seg_id, vol_live[seg_id]);
+        }
+    }
+}
+
+}// namespace hlkvds
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <new>
+
+#include "SegShardTable.h"
+
+namespace hlkvds {
+
+SegShardTable::SegShardTable(int shard_num) :
+        shardNum_(shard_num), shards_(NULL) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, CACHE_LINE_SIZE, sizeof(SegShard) * shardNum_)) {
+        throw std::bad_alloc();
+    }
+    shards_ = static_cast<SegShard *>(buf);
+    for (int i = 0; i < shardNum_; i++) {
+        new (&shards_[i]) SegShard();
+    }
+}
+
+SegShardTable::~SegShardTable() {
+    for (int i = 0; i < shardNum_; i++) {
+        shards_[i].~SegShard();
+    }
+    free(shards_);
+}
+
+Request* SegShardTable::NewRequest(int shard_id, KVSlice& slice) {
+    Request *req = shards_[shard_id].reqPool_.Get();
+    if (req) {
+        req->Reset(slice);
+    } else {
+        req = new Request(slice);
+    }
+    req->SetShardsWQId(shard_id);
+    return req;
+}
+
+void SegShardTable::FreeRequest(Request *req) {
+    int shard_id = req->GetShardsWQId();
+    shards_[shard_id].reqPool_.Put(req);
+}
+
+SegForReq* SegShardTable::NewSeg(int shard_id, Volume* vol, IndexManager* im, uint32_t timeout) {
+    ObjectPool<SegForReq> *pool = &shards_[shard_id].segPool_;
+    SegForReq *seg = pool->Get();
+    if (seg) {
+        seg->Reset(vol);
+    } else {
+        seg = new SegForReq(vol, im, timeout);
+    }
+    seg->SetPool(pool);
+    return seg;
+}
+
+}// namespace hlkvds
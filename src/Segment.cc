@@ -4,17 +4,22 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <algorithm>
 
 #include "Segment.h"
 #include "IndexManager.h"
 #include "Volume.h"
+#include "SegmentManager.h"
 
 using namespace std;
 
 namespace hlkvds {
 
+std::atomic<uint64_t> SegWriteStat::copiedBytes_(0);
+std::atomic<uint64_t> SegWriteStat::zeroCopyBytes_(0);
+
 SegHeaderOnDisk::SegHeaderOnDisk() :
-        timestamp(0), trx_id(0), trx_segs(0), checksum_data(0),
+        timestamp(0), lsn(0), trx_id(0), trx_segs(0), checksum_data(0),
         checksum_length(0), number_keys(0) {
 }
 
@@ -23,6 +28,7 @@ SegHeaderOnDisk::~SegHeaderOnDisk() {
 
 SegHeaderOnDisk::SegHeaderOnDisk(const SegHeaderOnDisk& toBeCopied) {
     timestamp = toBeCopied.timestamp;
+    lsn = toBeCopied.lsn;
     trx_id = toBeCopied.trx_id;
     trx_segs = toBeCopied.trx_segs;
     checksum_data = toBeCopied.checksum_data;
@@ -32,6 +38,7 @@ SegHeaderOnDisk::SegHeaderOnDisk(const SegHeaderOnDisk& toBeCopied) {
 
 SegHeaderOnDisk& SegHeaderOnDisk::operator=(const SegHeaderOnDisk& toBeCopied) {
     timestamp = toBeCopied.timestamp;
+    lsn = toBeCopied.lsn;
     trx_id = toBeCopied.trx_id;
     trx_segs = toBeCopied.trx_segs;
     checksum_data = toBeCopied.checksum_data;
@@ -40,16 +47,16 @@ SegHeaderOnDisk& SegHeaderOnDisk::operator=(const SegHeaderOnDisk& toBeCopied) {
     return *this;
 }
 
-SegHeaderOnDisk::SegHeaderOnDisk(uint64_t ts, uint64_t id, uint32_t segs,
+SegHeaderOnDisk::SegHeaderOnDisk(uint64_t ts, uint64_t seq, uint64_t id, uint32_t segs,
                                 uint32_t data, uint32_t len, uint32_t keys_num) :
-        timestamp(ts), trx_id(id), trx_segs(segs), checksum_data(data),
+        timestamp(ts), lsn(seq), trx_id(id), trx_segs(segs), checksum_data(data),
         checksum_length(len), number_keys(keys_num) {
 }
 
 
 KVSlice::KVSlice() :
-    key_(NULL), keyLength_(0), data_(NULL), dataLength_(0), digest_(NULL),
-            entry_(NULL), segId_(0), entryGC_(NULL) {
+    key_(NULL), keyLength_(0), data_(NULL), dataLength_(0),
+            entry_(NULL), segId_(0), deepCopy_(false), entryGC_(NULL), cold_(false) {
 }
 
 KVSlice::~KVSlice() {
@@ -57,9 +64,6 @@ KVSlice::~KVSlice() {
         delete[] key_;
         delete[] data_;
     }
-    if (digest_) {
-        delete digest_;
-    }
     if (entry_) {
         delete entry_;
     }
@@ -69,8 +73,8 @@ KVSlice::~KVSlice() {
 }
 
 KVSlice::KVSlice(const KVSlice& toBeCopied) :
-    key_(NULL), keyLength_(0), data_(NULL), dataLength_(0), digest_(NULL),
-            entry_(NULL), segId_(0), deepCopy_(false), entryGC_(NULL) {
+    key_(NULL), keyLength_(0), data_(NULL), dataLength_(0),
+            entry_(NULL), segId_(0), deepCopy_(false), entryGC_(NULL), cold_(false) {
     copy_helper(toBeCopied);
 }
 
@@ -84,22 +88,26 @@ void KVSlice::copy_helper(const KVSlice& toBeCopied) {
     dataLength_ = toBeCopied.GetDataLen();
     key_ = toBeCopied.GetKey();
     data_ = toBeCopied.GetData();
-    *digest_ = *toBeCopied.digest_;
+    digest_ = toBeCopied.digest_;
     *entry_ = *toBeCopied.entry_;
     segId_ = toBeCopied.segId_;
     deepCopy_ = toBeCopied.deepCopy_;
     *entryGC_ = *toBeCopied.entryGC_;
+    cold_ = toBeCopied.cold_;
 }
 
 KVSlice::KVSlice(const char* key, int key_len, const char* data, int data_len, bool deep_copy) :
     key_(NULL), keyLength_(key_len), data_(NULL), dataLength_(data_len),
-            digest_(NULL), entry_(NULL), segId_(0), deepCopy_(deep_copy),
-            entryGC_(NULL) {
+            entry_(NULL), segId_(0), deepCopy_(deep_copy),
+            entryGC_(NULL), cold_(false) {
     if (deepCopy_) {
         key_ = new char[key_len];
-        data_ = new char[data_len];
         memcpy((void*)key_, key, key_len);
-        memcpy((void*)data_, data, data_len);
+        // a delete keeps its NULL data
+        if (data) {
+            data_ = new char[data_len];
+            memcpy((void*)data_, data, data_len);
+        }
     } else {
         key_ = key;
         data_ = data;
@@ -110,9 +118,8 @@ KVSlice::KVSlice(const char* key, int key_len, const char* data, int data_len, b
 KVSlice::KVSlice(Kvdb_Digest *digest, const char* key, int key_len,
                 const char* data, int data_len) :
     key_(key), keyLength_(key_len), data_(data), dataLength_(data_len),
-            digest_(NULL), entry_(NULL), segId_(0), deepCopy_(false),
-            entryGC_(NULL) {
-    digest_ = new Kvdb_Digest(*digest);
+            digest_(*digest), entry_(NULL), segId_(0), deepCopy_(false),
+            entryGC_(NULL), cold_(false) {
 }
 
 void KVSlice::SetKeyValue(const char* key, int key_len, const char* data,
@@ -126,13 +133,8 @@ void KVSlice::SetKeyValue(const char* key, int key_len, const char* data,
 }
 
 void KVSlice::calcDigest() {
-    if (digest_) {
-        delete digest_;
-        digest_=nullptr;
-    }
-    digest_ = new Kvdb_Digest();
     Kvdb_Key vkey(key_, keyLength_);
-    KeyDigestHandle::CalcDigest(&vkey, *digest_);
+    KeyDigestHandle::CalcDigest(&vkey, digest_);
 }
 
 string KVSlice::GetKeyStr() const {
@@ -144,6 +146,10 @@ string KVSlice::GetDataStr() const {
 }
 
 void KVSlice::SetHashEntry(const HashEntry *hash_entry) {
+    if (entry_) {
+        *entry_ = *hash_entry;
+        return;
+    }
     entry_ = new HashEntry(*hash_entry);
 }
 
@@ -175,7 +181,16 @@ Request& Request::operator=(const Request& toBeCopied) {
     return *this;
 }
 Request::Request(KVSlice& slice) : 
-    done_(false), stat_(ReqStat::INIT), slice_(&slice), segPtr_(NULL) {
+    done_(false), stat_(ReqStat::INIT), slice_(&slice), segPtr_(NULL), shardsWqId_(-1) {
+}
+
+void Request::Reset(KVSlice& slice) {
+    std::lock_guard<std::mutex> l(mtx_);
+    done_ = false;
+    stat_ = ReqStat::INIT;
+    slice_ = &slice;
+    segPtr_ = NULL;
+    shardsWqId_ = -1;
 }
 
 void Request::SetWriteStat(bool stat) {
@@ -197,12 +212,15 @@ void Request::Signal() {
 }
 
 SegBase::SegBase() :
-    segId_(-1), vol_(NULL), segSize_(-1),
+    idxMgr_(NULL), segId_(-1), vol_(NULL), segSize_(-1),
         headPos_(0), tailPos_(0), keyNum_(0),
-        keyAlignedNum_(0), dataBuf_(NULL) {
+        keyAlignedNum_(0), lsn_(0), dataBuf_(NULL), ioClass_(IoClass::FG_WRITE) {
 }
 
 SegBase::~SegBase() {
+    if (dataBuf_) {
+        free(dataBuf_);
+    }
 }
 
 SegBase::SegBase(const SegBase& toBeCopied) {
@@ -215,6 +233,7 @@ SegBase& SegBase::operator=(const SegBase& toBeCopied) {
 }
 
 void SegBase::copyHelper(const SegBase& toBeCopied) {
+    idxMgr_ = toBeCopied.idxMgr_;
     segId_ = toBeCopied.segId_;
     vol_ = toBeCopied.vol_;
     segSize_ = toBeCopied.segSize_;
@@ -222,15 +241,35 @@ void SegBase::copyHelper(const SegBase& toBeCopied) {
     tailPos_ = toBeCopied.tailPos_;
     keyNum_ = toBeCopied.keyNum_;
     keyAlignedNum_ = toBeCopied.keyAlignedNum_;
-    memcpy(dataBuf_, toBeCopied.dataBuf_, segSize_);
+    lsn_ = toBeCopied.lsn_;
+    dataBuf_ = NULL;
     sliceList_ = toBeCopied.sliceList_;
+    ioClass_ = toBeCopied.ioClass_;
 }
 
-SegBase::SegBase(Volume* vol) :
-        segId_(-1), vol_(vol),
+SegBase::SegBase(Volume* vol, IndexManager* im) :
+        idxMgr_(im), segId_(-1), vol_(vol),
         segSize_(vol_->GetSegmentSize()),
         headPos_(SegBase::SizeOfSegOnDisk()), tailPos_(segSize_),
-        keyNum_(0), keyAlignedNum_(0), dataBuf_(NULL) {
+        keyNum_(0), keyAlignedNum_(0), lsn_(0), dataBuf_(NULL),
+        ioClass_(IoClass::FG_WRITE) {
+}
+
+void SegBase::Reset(Volume* vol) {
+    if (dataBuf_ && segSize_ != (int32_t)vol->GetSegmentSize()) {
+        free(dataBuf_);
+        dataBuf_ = NULL;
+    }
+    segId_ = -1;
+    vol_ = vol;
+    segSize_ = vol_->GetSegmentSize();
+    headPos_ = SegBase::SizeOfSegOnDisk();
+    tailPos_ = segSize_;
+    keyNum_ = 0;
+    keyAlignedNum_ = 0;
+    lsn_ = 0;
+    sliceList_.clear();
+    ioClass_ = IoClass::FG_WRITE;
 }
 
 bool SegBase::TryPut(KVSlice* slice) {
@@ -286,16 +325,31 @@ void SegBase::fillEntryToSlice() {
     uint32_t head_pos = SegBase::SizeOfSegOnDisk();
     uint32_t tail_pos = segSize_;
     int vol_id = vol_->GetId();
+
+    // the records get consecutive sequence numbers, copies keep theirs;
+    // the segment is stamped with the last one handed out for it
+    uint32_t lsn_num = 0;
+    for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
+            != sliceList_.end(); iter++) {
+        if (!(*iter)->IsCopy()) {
+            lsn_num++;
+        }
+    }
+    lsn_num = lsn_num ? lsn_num : 1;
+    uint64_t lsn = idxMgr_->AllocLsn(lsn_num);
+    lsn_ = lsn + lsn_num - 1;
+
     for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
             != sliceList_.end(); iter++) {
 
         KVSlice *slice = *iter;
         slice->SetSegId(segId_);
+        uint64_t rec_lsn = slice->IsCopy() ? slice->GetHashEntryBeforeGC().GetLsn() : lsn++;
         if (slice->IsAlignedData()) {
             uint32_t data_offset = tail_pos - ALIGNED_SIZE;
             uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
             DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
-                                   data_offset, next_offset);
+                                   data_offset, next_offset, rec_lsn);
 
             uint64_t seg_offset = 0;
             vol_->CalcSegOffsetFromId(segId_, seg_offset);
@@ -314,7 +368,7 @@ void SegBase::fillEntryToSlice() {
                     + slice->GetKeyLen() + slice->GetDataLen();
 
             DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
-                                   data_offset, next_offset);
+                                   data_offset, next_offset, rec_lsn);
             uint64_t seg_offset = 0;
             vol_->CalcSegOffsetFromId(segId_, seg_offset);
             uint64_t header_offset = seg_offset + head_pos;
@@ -335,30 +389,58 @@ void SegBase::fillEntryToSlice() {
 
 
 bool SegBase::_writeDataToDevice() {
-    posix_memalign((void **)&dataBuf_, 4096, segSize_);
+    if (!dataBuf_) {
+        if (posix_memalign((void **)&dataBuf_, 4096, segSize_)) {
+            dataBuf_ = NULL;
+            __ERROR("Could not allocate segment buffer");
+            return false;
+        }
+    }
 
-    copyToDataBuf();
+    fillIovec();
     uint64_t offset = 0;
     vol_->CalcSegOffsetFromId(segId_, offset);
 
-    bool ret = vol_->Write(dataBuf_, segSize_, offset);
+    return vol_->Writev(iovs_.data(), iovs_.size(), offset, ioClass_);
+}
 
-    free(dataBuf_);
-    dataBuf_ = NULL;
+char* SegBase::getZeroBuf() {
+    static char *zero_buf = NULL;
+    static std::once_flag flag;
+    std::call_once(flag, []() {
+        if (posix_memalign((void **)&zero_buf, 4096, ZERO_BUF_SIZE)) {
+            zero_buf = NULL;
+            return;
+        }
+        memset(zero_buf, 0, ZERO_BUF_SIZE);
+    });
+    return zero_buf;
+}
 
-    return ret;
+void SegBase::appendIovec(char *base, size_t len) {
+    if (!iovs_.empty()) {
+        struct iovec &last = iovs_.back();
+        if ((char *)last.iov_base + last.iov_len == base) {
+            last.iov_len += len;
+            return;
+        }
+    }
+    struct iovec iov;
+    iov.iov_base = base;
+    iov.iov_len = len;
+    iovs_.push_back(iov);
 }
 
-void SegBase::copyToDataBuf() {
-    uint64_t offset = 0;
-    vol_->CalcSegOffsetFromId(segId_, offset);
+// Describe the segment as an iovec list instead of building a full copy:
+// headers, keys and inline values are packed into the head of dataBuf_,
+// the unused middle comes from the shared zero buffer, and aligned values
+// are written straight from the caller when their memory is page aligned.
+void SegBase::fillIovec() {
+    iovs_.clear();
 
-    uint32_t offset_begin = 0;
+    uint32_t offset_begin = SegBase::SizeOfSegOnDisk();
     uint32_t offset_end = segSize_;
 
-    offset_begin += SegBase::SizeOfSegOnDisk();
-
-    //aggregate iovec
     for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
             != sliceList_.end(); iter++) {
         KVSlice *slice = *iter;
@@ -377,7 +459,6 @@ void SegBase::copyToDataBuf() {
 
         if (slice->IsAlignedData()) {
             offset_end -= data_len;
-            memcpy(&(dataBuf_[offset_end]), data, data_len);
             __DEBUG("write key = %s, data position: %u", slice->GetKey(), offset_end);
         } else {
             memcpy(&(dataBuf_[offset_begin]), data, data_len);
@@ -387,27 +468,69 @@ void SegBase::copyToDataBuf() {
     }
 
     // Generate SegHeaderOnDisk
-    uint64_t timestamp = KVTime::GetNow();
+    uint64_t timestamp = SegmentManager::GetNowTimestamp();
     uint64_t trx_id = 0;
     uint32_t trx_segs = 0;
     uint32_t checksum_data = 0;
     uint32_t checksum_length = 0;
-    SegHeaderOnDisk seg_header(timestamp, trx_id, trx_segs, checksum_data, checksum_length, keyNum_);
+    SegHeaderOnDisk seg_header(timestamp, lsn_, trx_id, trx_segs, checksum_data, checksum_length, keyNum_);
     memcpy(dataBuf_, &seg_header, SegBase::SizeOfSegOnDisk());
 
-    //set 0 to free data buffer
-    memset(&(dataBuf_[offset_begin]), 0, (offset_end - offset_begin));
+    // only the partial page behind the head needs zeroing
+    uint32_t head_end = (offset_begin + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    if (head_end > offset_end) {
+        head_end = offset_end;
+    }
+    memset(&(dataBuf_[offset_begin]), 0, head_end - offset_begin);
+    appendIovec(dataBuf_, head_end);
+    uint64_t copied = head_end;
+    uint64_t zero_copy = 0;
+
+    char *zero_buf = getZeroBuf();
+    for (uint32_t pos = head_end; pos < offset_end; ) {
+        uint32_t len = min((uint32_t)ZERO_BUF_SIZE, offset_end - pos);
+        if (zero_buf) {
+            appendIovec(zero_buf, len);
+        } else {
+            memset(&(dataBuf_[pos]), 0, len);
+            appendIovec(&(dataBuf_[pos]), len);
+        }
+        pos += len;
+    }
+
+    // aligned values were laid out backwards from the segment end
+    for (list<KVSlice *>::reverse_iterator iter = sliceList_.rbegin(); iter
+            != sliceList_.rend(); iter++) {
+        KVSlice *slice = *iter;
+        if (!slice->IsAlignedData()) {
+            continue;
+        }
+        char *data = (char *) slice->GetData();
+        uint16_t data_len = slice->GetDataLen();
+        if ((uint64_t)data % ALIGNED_SIZE == 0) {
+            appendIovec(data, data_len);
+            zero_copy += data_len;
+        } else {
+            memcpy(&(dataBuf_[offset_end]), data, data_len);
+            appendIovec(&(dataBuf_[offset_end]), data_len);
+            copied += data_len;
+        }
+        offset_end += data_len;
+    }
+
+    SegWriteStat::AddCopied(copied);
+    SegWriteStat::AddZeroCopy(zero_copy);
 }
 
 SegForReq::SegForReq() :
-    SegBase(), idxMgr_(NULL), timeout_(0), startTime_(KVTime()), persistTime_(KVTime()),
-        isCompletion_(false), hasReq_(false), reqCommited_(0) {
+    SegBase(), timeout_(0), startTime_(KVTime()),
+        isCompletion_(false), hasReq_(false), reqCommited_(0), pool_(NULL) {
 }
 
 SegForReq::~SegForReq() {
 }
 
-SegForReq::SegForReq(const SegForReq& toBeCopied) : SegBase(toBeCopied) {
+SegForReq::SegForReq(const SegForReq& toBeCopied) : SegBase(toBeCopied), pool_(NULL) {
 }
 
 SegForReq& SegForReq::operator=(const SegForReq& toBeCopied) {
@@ -416,10 +539,8 @@ SegForReq& SegForReq::operator=(const SegForReq& toBeCopied) {
     }
 
     SegBase::operator=(toBeCopied);
-    idxMgr_ = toBeCopied.idxMgr_;
     timeout_ = toBeCopied.timeout_;
     startTime_ = toBeCopied.startTime_;
-    persistTime_ = toBeCopied.persistTime_;
     isCompletion_ = toBeCopied.isCompletion_;
     hasReq_ = toBeCopied.hasReq_;
     reqCommited_.store(toBeCopied.reqCommited_.load());
@@ -429,8 +550,18 @@ SegForReq& SegForReq::operator=(const SegForReq& toBeCopied) {
 }
 
 SegForReq::SegForReq(Volume* vol, IndexManager* im, uint32_t timeout) :
-    SegBase(vol), idxMgr_(im), timeout_(timeout), startTime_(KVTime()), persistTime_(KVTime()),
-    isCompletion_(false), hasReq_(false), reqCommited_(0) {
+    SegBase(vol, im), timeout_(timeout), startTime_(KVTime()),
+    isCompletion_(false), hasReq_(false), reqCommited_(0), pool_(NULL) {
+}
+
+void SegForReq::Reset(Volume* vol) {
+    SegBase::Reset(vol);
+    startTime_.Update();
+    isCompletion_ = false;
+    hasReq_ = false;
+    reqCommited_.store(0);
+    reqList_.clear();
+    delReqList_.clear();
 }
 
 bool SegForReq::TryPut(Request* req) {
@@ -463,17 +594,13 @@ void SegForReq::Completion() {
 void SegForReq::Notify(bool stat) {
     std::lock_guard < std::mutex > l(mtx_);
 
-    //Set logic timestamp to hashentry
     reqCommited_.store(GetKeyNum());
 
-    int32_t keyNo = 0;
-    persistTime_.Update();
-    for (list<Request *>::iterator iter = reqList_.begin(); iter
+    // entries are only filled in once the segment got an id
+    for (list<Request *>::iterator iter = reqList_.begin(); stat && iter
             != reqList_.end(); iter++) {
-        keyNo++;
         KVSlice *slice = &(*iter)->GetSlice();
         HashEntry &entry = slice->GetHashEntry();
-        entry.SetLogicStamp(persistTime_, keyNo);
 
         if (!slice->GetData()) {
             delReqList_.push_back(entry);
@@ -509,14 +636,13 @@ void SegForReq::CleanDeletedEntry() {
 }
 
 SegForSlice::SegForSlice() :
-    SegBase(), idxMgr_(NULL) {
+    SegBase() {
 }
 
 SegForSlice::~SegForSlice() {
 }
 
 SegForSlice::SegForSlice(const SegForSlice& toBeCopied) : SegBase(toBeCopied) {
-    idxMgr_ = toBeCopied.idxMgr_;
 }
 
 SegForSlice& SegForSlice::operator=(const SegForSlice& toBeCopied) {
@@ -524,12 +650,11 @@ SegForSlice& SegForSlice::operator=(const SegForSlice& toBeCopied) {
         return *this;
     }
     SegBase::operator=(toBeCopied);
-    idxMgr_ = toBeCopied.idxMgr_;
     return *this;
 }
 
 SegForSlice::SegForSlice(Volume* vol, IndexManager* im) :
-    SegBase(vol), idxMgr_(im) {
+    SegBase(vol, im) {
 }
 
 void SegForSlice::UpdateToIndex() {
@@ -539,7 +664,7 @@ void SegForSlice::UpdateToIndex() {
 }
 
 SegForMigrate::SegForMigrate() :
-    SegBase(), idxMgr_(NULL) {
+    SegBase() {
 }
 
 SegForMigrate::~SegForMigrate() {
@@ -550,12 +675,11 @@ SegForMigrate& SegForMigrate::operator=(const SegForMigrate& toBeCopied) {
         return *this;
     }
     SegBase::operator=(toBeCopied);
-    idxMgr_ = toBeCopied.idxMgr_;
     return *this;
 }
 
 SegForMigrate::SegForMigrate(Volume* vol, IndexManager* im) :
-    SegBase(vol), idxMgr_(im) {
+    SegBase(vol, im) {
 }
 
 void SegForMigrate::UpdateToIndex() {
@@ -564,173 +688,122 @@ void SegForMigrate::UpdateToIndex() {
 }
 
 
-SegLatencyFriendly::SegLatencyFriendly() :
-    vol_(NULL), idxMgr_(NULL), segId_(-1), segSize_(-1),
-    headPos_(0), keyNum_(0), checksumSize_(0), dataBuf_(NULL) {
-}
-
-SegLatencyFriendly::~SegLatencyFriendly() {
-}
-
-SegLatencyFriendly::SegLatencyFriendly(const SegLatencyFriendly& toBeCopied) {
-    copyHelper(toBeCopied);
-}
-
-SegLatencyFriendly& SegLatencyFriendly::operator=(const SegLatencyFriendly& toBeCopied) {
-    copyHelper(toBeCopied);
-    return *this;
+SegAppendLog::SegAppendLog(Volume* vol, IndexManager* im) :
+    vol_(vol), idxMgr_(im), segId_(-1), segSize_(vol_->GetSegmentSize()), segOffset_(0),
+    headPos_(0), keyNum_(0), lsn_(0), dataBuf_(NULL) {
+    if (posix_memalign((void **)&dataBuf_, 4096, segSize_)) {
+        dataBuf_ = NULL;
+        __ERROR("Could not allocate append log buffer");
+    }
 }
 
-SegLatencyFriendly::SegLatencyFriendly(Volume* vol, IndexManager* im) :
-    vol_(vol), idxMgr_(im), segId_(-1), segSize_(vol_->GetSegmentSize()),
-    headPos_(SegBase::SizeOfSegOnDisk()), keyNum_(0), checksumSize_(0),
-    dataBuf_(NULL){
+SegAppendLog::~SegAppendLog() {
+    if (dataBuf_) {
+        free(dataBuf_);
+    }
 }
 
-void SegLatencyFriendly::copyHelper(const SegLatencyFriendly& toBeCopied) {
-    segId_ = toBeCopied.segId_;
-    vol_ = toBeCopied.vol_;
-    segSize_ = toBeCopied.segSize_;
-
-    headPos_ = toBeCopied.headPos_;
-    keyNum_ = toBeCopied.keyNum_;
-    checksumSize_ = toBeCopied.checksumSize_;
+bool SegAppendLog::Open(uint32_t seg_id) {
+    if (!dataBuf_) {
+        return false;
+    }
+    segId_ = seg_id;
+    vol_->CalcSegOffsetFromId(segId_, segOffset_);
+    headPos_ = SegBase::SizeOfSegOnDisk();
+    keyNum_ = 0;
+    lsn_ = 0;
+
+    // a valid empty header first, stale records of the former owner of
+    // this segment must never be parsed
+    memset(dataBuf_, 0, ALIGNED_SIZE);
+    fillSegHeader();
+    if (!writePages(0, ALIGNED_SIZE)) {
+        segId_ = -1;
+        return false;
+    }
+    vol_->Use(segId_, segSize_ - headPos_);
+    vol_->Pin(segId_);
+    __DEBUG("Open append log, seg_id = %d", segId_);
+    return true;
 }
 
-bool SegLatencyFriendly::TryPut(KVSlice* slice) {
+bool SegAppendLog::TryPut(KVSlice* slice) {
+    if (segId_ < 0) {
+        return false;
+    }
     uint32_t free_size = segSize_ - headPos_;
     uint32_t need_size = slice->GetDataLen() + slice->GetKeyLen() + IndexManager::SizeOfDataHeader();
     return free_size > need_size;
 }
 
-void SegLatencyFriendly::Put(KVSlice* slice) {
-    headPos_ += IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
-    keyNum_++;
-    sliceList_.push_back(slice);
-    __DEBUG("Put request key = %s", slice->GetKeyStr().c_str());
-}
-
-bool SegLatencyFriendly::TryPutList(std::list<KVSlice*> &slice_list) {
-    uint32_t free_size = segSize_ - headPos_;
-    uint32_t need_size = 0;
-    for (list<KVSlice *>::iterator iter = slice_list.begin(); iter != slice_list.end(); iter++) {
-        KVSlice *slice = *iter;
-        need_size += slice->GetDataLen() + slice->GetKeyLen() + IndexManager::SizeOfDataHeader();
+bool SegAppendLog::Append(KVSlice* slice) {
+    uint32_t head_pos = headPos_;
+    uint16_t key_len = slice->GetKeyLen();
+    uint16_t data_len = slice->GetDataLen();
+    uint32_t data_offset = head_pos + IndexManager::SizeOfDataHeader() + key_len;
+    uint32_t next_offset = data_offset + data_len;
+    // the log is stamped anew with every record, a copy keeps its own
+    uint64_t lsn_before = lsn_;
+    lsn_ = idxMgr_->AllocLsn(1);
+    uint64_t rec_lsn = slice->IsCopy() ? slice->GetHashEntryBeforeGC().GetLsn() : lsn_;
+
+    DataHeader data_header(slice->GetDigest(), key_len, data_len,
+                           data_offset, next_offset, rec_lsn);
+    memcpy(&dataBuf_[head_pos], &data_header, IndexManager::SizeOfDataHeader());
+    memcpy(&dataBuf_[head_pos + IndexManager::SizeOfDataHeader()], slice->GetKey(), key_len);
+    if (data_len) {
+        memcpy(&dataBuf_[data_offset], slice->GetData(), data_len);
     }
-    return free_size > need_size;
-}
 
-void SegLatencyFriendly::PutList(std::list<KVSlice*> &slice_list) {
-    for (list<KVSlice *>::iterator iter = slice_list.begin(); iter != slice_list.end(); iter++) {
-        KVSlice *slice = *iter;
-        Put(slice);
+    headPos_ = next_offset;
+    keyNum_++;
+    fillSegHeader();
+
+    // rewrite the pages the record touched, the tail of the last one
+    // is zeroed so a reader never sees leftovers behind the log end
+    uint32_t begin = head_pos / ALIGNED_SIZE * ALIGNED_SIZE;
+    uint32_t end = (headPos_ + ALIGNED_SIZE - 1) / ALIGNED_SIZE * ALIGNED_SIZE;
+    if (end > segSize_) {
+        end = segSize_;
     }
-}
-
-bool SegLatencyFriendly::WriteSegToDevice() {
-    if (segId_ < 0)
-    {
-        __ERROR("Not set seg_id to segment");
+    memset(&dataBuf_[headPos_], 0, end - headPos_);
+    // then the header page, crash replay trusts its number_keys
+    if (!writePages(begin, end) || (begin && !writePages(0, ALIGNED_SIZE))) {
+        headPos_ = head_pos;
+        keyNum_--;
+        lsn_ = lsn_before;
+        fillSegHeader();
         return false;
     }
-    fillEntryToSlice();
-    __DEBUG("Begin write seg, free size %u, seg id: %d, key num: %d", tailPos_-headPos_ , segId_, keyNum_);
-    return _writeDataToDevice();
-}
+    vol_->UpdateFreeSize(segId_, segSize_ - headPos_);
 
-void SegLatencyFriendly::fillEntryToSlice() {
-    uint32_t head_pos = SegBase::SizeOfSegOnDisk();
-    int vol_id = vol_->GetId();
-
-    for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
-            != sliceList_.end(); iter++) {
-        KVSlice *slice = *iter;
-        slice->SetSegId(segId_);
-
-        uint32_t data_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
-        uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
-        DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
-                               data_offset, next_offset);
-        uint64_t seg_offset = 0;
-        vol_->CalcSegOffsetFromId(segId_, seg_offset);
-        uint64_t header_offset = seg_offset + head_pos;
-
-        DataHeaderAddress addrs(vol_id, header_offset);
-        HashEntry hash_entry(data_header, addrs, NULL);
-        slice->SetHashEntry(&hash_entry);
-
-        head_pos += IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
-        __DEBUG("SegmentSlice: key=%s, data_offset=%u, header_offset=%lu, seg_id=%u, head_pos=%u", slice->GetKey(), data_offset, header_offset, segId_, head_pos);
-    }
+    slice->SetSegId(segId_);
+    DataHeaderAddress addrs(vol_->GetId(), segOffset_ + head_pos);
+    HashEntry hash_entry(data_header, addrs, NULL);
+    slice->SetHashEntry(&hash_entry);
+    __DEBUG("Append key = %s, seg_id = %d, header offset = %u", slice->GetKey(), segId_, head_pos);
+    return true;
+}
 
-    if (head_pos != headPos_ ) {
-        __ERROR("Segment fillEntryToSlice  Failed!!! head_pos= %u, headPos_=%u", head_pos, headPos_);
+bool SegAppendLog::Seal() {
+    if (segId_ < 0) {
+        return true;
     }
+    vol_->Unpin(segId_);
+    __DEBUG("Seal append log, seg_id = %d, key num: %d", segId_, keyNum_);
+    segId_ = -1;
+    return true;
 }
 
-bool SegLatencyFriendly::_writeDataToDevice() {
-    checksumSize_ = headPos_ - SegBase::SizeOfSegOnDisk();
-    uint32_t pages_num = headPos_ / getpagesize();
-    uint32_t aligned_size = ( pages_num + 1 ) * getpagesize();
-
-    posix_memalign((void**)&dataBuf_, 4096, aligned_size);
-
-    copyToDataBuf();
-    uint64_t offset = 0;
-    vol_->CalcSegOffsetFromId(segId_, offset);
-
-    bool ret = vol_->Write(dataBuf_, aligned_size, offset);
-
-    free(dataBuf_);
-    dataBuf_ = NULL;
-
-
-    return ret;
+bool SegAppendLog::writePages(uint32_t begin, uint32_t end) {
+    return vol_->Write(&dataBuf_[begin], end - begin, segOffset_ + begin);
 }
 
-void SegLatencyFriendly::copyToDataBuf() {
-    uint64_t offset = 0;
-    vol_->CalcSegOffsetFromId(segId_, offset);
-
-    uint32_t offset_begin = 0;
-
-    offset_begin += SegBase::SizeOfSegOnDisk();
-
-    //aggregate iovec
-    for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
-            != sliceList_.end(); iter++) {
-        KVSlice *slice = *iter;
-        DataHeader *header =
-                &slice->GetHashEntry().GetEntryOnDisk().GetDataHeader();
-        char *data = (char *) slice->GetData();
-        uint16_t data_len = slice->GetDataLen();
-
-        char *key = (char *) slice->GetKey();
-        uint16_t key_len = slice->GetKeyLen();
-        memcpy(&(dataBuf_[offset_begin]), header, IndexManager::SizeOfDataHeader());
-        __DEBUG("write key = %s, seg_id: %u, header offset: %u", slice->GetKey(), segId_, offset_begin);
-        offset_begin += IndexManager::SizeOfDataHeader();
-        memcpy(&(dataBuf_[offset_begin]), key, key_len);
-        __DEBUG("write key = %s, key offset: %u", slice->GetKey(), offset_begin);
-        offset_begin += key_len;
-        memcpy(&(dataBuf_[offset_begin]), data, data_len);
-        __DEBUG("write key = %s, data position: %u", slice->GetKey(), offset_begin);
-        offset_begin += data_len;
-    }
-
-    // Generate SegHeaderOnDisk
-    uint64_t timestamp = KVTime::GetNow();
-    uint64_t trx_id = 0;
-    uint32_t trx_segs = 0;
-    uint32_t checksum_data = 0;
-    SegHeaderOnDisk seg_header(timestamp, trx_id, trx_segs, checksum_data, checksumSize_, keyNum_);
+void SegAppendLog::fillSegHeader() {
+    uint64_t timestamp = SegmentManager::GetNowTimestamp();
+    uint32_t checksum_length = headPos_ - SegBase::SizeOfSegOnDisk();
+    SegHeaderOnDisk seg_header(timestamp, lsn_, 0, 0, 0, checksum_length, keyNum_);
     memcpy(dataBuf_, &seg_header, SegBase::SizeOfSegOnDisk());
-
-}
-
-void SegLatencyFriendly::UpdateToIndex() {
-    list<KVSlice *> &slice_list = GetSliceList();
-    idxMgr_->UpdateIndexes(slice_list);
 }
 
 }
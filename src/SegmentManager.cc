@@ -1,9 +1,14 @@
+#include <stdint.h>
+#include <functional>
+#include <algorithm>
 #include "SegmentManager.h"
 #include "IndexManager.h"
 #include "Volume.h"
 
 namespace hlkvds {
 
+static const uint32_t SEG_NONE = UINT32_MAX;
+
 bool SegmentManager::Get(char* buf, uint64_t length) {
     uint64_t stat_size = SegmentManager::SizeOfSegmentStat();
     uint64_t stat_table_size = stat_size * segNum_;
@@ -11,11 +16,13 @@ bool SegmentManager::Get(char* buf, uint64_t length) {
         return false;
     }
     char *buf_ptr = buf;
+    // checkpoints copy the table while segments are written
+    std::lock_guard <std::mutex> l(mtx_);
     for (uint32_t seg_idx = 0; seg_idx < segNum_; seg_idx++) {
         if (segTable_[seg_idx].state != SegUseStat::RESERVED) {
             memcpy((void *)buf_ptr, (const void *)&segTable_[seg_idx], stat_size);
         } else {
-            __WARN("Segment Maybe not write to device! seg_id = %d", seg_idx);
+            __DEBUG("Segment Maybe not write to device! seg_id = %d", seg_idx);
         }
         buf_ptr += stat_size;
     }
@@ -41,12 +48,20 @@ bool SegmentManager::Set(char* buf, uint64_t length) {
         buf_ptr += stat_size;
     }
 
+    std::lock_guard <std::mutex> l(mtx_);
+    for (uint32_t seg_idx = 0; seg_idx < segNum_; seg_idx++) {
+        refreshBucket(seg_idx);
+        if (segTable_[seg_idx].state == SegUseStat::FREE) {
+            setFree(seg_idx);
+        }
+    }
+
     return true;
 }
 
 bool SegmentManager::Alloc(uint32_t& seg_id) {
     std::unique_lock <std::mutex> l(mtx_);
-    if (freedCounter_ <= SEG_RESERVED_FOR_GC) {
+    if (freedCounter_ - discardingNum_ <= SEG_RESERVED_FOR_GC) {
         return false;
     }
 
@@ -54,37 +69,26 @@ bool SegmentManager::Alloc(uint32_t& seg_id) {
     return AllocForGC(seg_id);
 }
 
+// Allocation goes on from the last allocated segment and wraps around,
+// so segments are written in device order while they are free.
 bool SegmentManager::AllocForGC(uint32_t& seg_id) {
-    //for first use !!
     std::lock_guard <std::mutex> l(mtx_);
-    if (segTable_[curSegId_].state == SegUseStat::FREE) {
-        seg_id = curSegId_;
-        segTable_[curSegId_].state = SegUseStat::RESERVED;
-
-        reservedCounter_++;
-        freedCounter_--;
-        return true;
+    uint32_t seg_index = findFree(curSegId_);
+    if (seg_index == SEG_NONE) {
+        seg_index = findFree(0);
+    }
+    if (seg_index == SEG_NONE) {
+        return false;
     }
 
-    uint32_t seg_index = curSegId_ + 1;
-
-    while (seg_index != curSegId_) {
-        if (seg_index == segNum_) {
-            seg_index = 0;
-        }
-        if (segTable_[seg_index].state == SegUseStat::FREE) {
-            seg_id = seg_index;
-            // set seg used
-            curSegId_ = seg_id;
-            segTable_[curSegId_].state = SegUseStat::RESERVED;
+    seg_id = seg_index;
+    curSegId_ = seg_id;
+    segTable_[seg_id].state = SegUseStat::RESERVED;
+    clearFree(seg_id);
 
-            reservedCounter_++;
-            freedCounter_--;
-            return true;
-        }
-        seg_index++;
-    }
-    return false;
+    reservedCounter_++;
+    freedCounter_--;
+    return true;
 }
 
 void SegmentManager::FreeForFailed(uint32_t seg_id) {
@@ -92,6 +96,10 @@ void SegmentManager::FreeForFailed(uint32_t seg_id) {
     segTable_[seg_id].state = SegUseStat::FREE;
     segTable_[seg_id].free_size = 0;
     segTable_[seg_id].death_size = 0;
+    segTable_[seg_id].gc_gen = 0;
+    segTable_[seg_id].timestamp = 0;
+    refreshBucket(seg_id);
+    setFree(seg_id);
 
     reservedCounter_--;
     freedCounter_++;
@@ -103,16 +111,28 @@ void SegmentManager::FreeForGC(uint32_t seg_id) {
     segTable_[seg_id].state = SegUseStat::FREE;
     segTable_[seg_id].free_size = 0;
     segTable_[seg_id].death_size = 0;
+    segTable_[seg_id].gc_gen = 0;
+    segTable_[seg_id].timestamp = 0;
+    refreshBucket(seg_id);
+    setFree(seg_id);
 
     usedCounter_--;
     freedCounter_++;
+    if (options_.discard_segments) {
+        discardSegs_.insert(seg_id);
+    }
     __DEBUG("Free Segment For GC, seg_id = %d", seg_id);
 }
 
-void SegmentManager::Use(uint32_t seg_id, uint32_t free_size) {
+void SegmentManager::Use(uint32_t seg_id, uint32_t free_size, uint64_t timestamp,
+                         uint32_t gc_gen) {
     std::lock_guard <std::mutex> l(mtx_);
     segTable_[seg_id].state = SegUseStat::USED;
     segTable_[seg_id].free_size = free_size;
+    segTable_[seg_id].gc_gen = gc_gen;
+    segTable_[seg_id].timestamp = timestamp ? timestamp : GetNowTimestamp();
+    refreshBucket(seg_id);
+    segHeat_[seg_id].store(0, std::memory_order_relaxed);
 
     reservedCounter_--;
     usedCounter_++;
@@ -128,11 +148,246 @@ void SegmentManager::Use(uint32_t seg_id, uint32_t free_size) {
 void SegmentManager::AddDeathSize(uint32_t seg_id, uint32_t death_size) {
     std::lock_guard <std::mutex> l(mtx_);
     segTable_[seg_id].death_size += death_size;
+    refreshBucket(seg_id);
+}
+
+void SegmentManager::UpdateFreeSize(uint32_t seg_id, uint32_t free_size) {
+    std::lock_guard <std::mutex> l(mtx_);
+    segTable_[seg_id].free_size = free_size;
+    segTable_[seg_id].timestamp = GetNowTimestamp();
+    refreshBucket(seg_id);
+}
+
+void SegmentManager::Recover(uint32_t seg_id, uint32_t free_size, uint64_t timestamp) {
+    std::lock_guard <std::mutex> l(mtx_);
+    if (segTable_[seg_id].state == SegUseStat::FREE) {
+        clearFree(seg_id);
+        freedCounter_--;
+        usedCounter_++;
+    }
+    segTable_[seg_id].state = SegUseStat::USED;
+    segTable_[seg_id].free_size = free_size;
+    segTable_[seg_id].death_size = 0;
+    segTable_[seg_id].gc_gen = 0;
+    segTable_[seg_id].timestamp = timestamp;
+    refreshBucket(seg_id);
+}
+
+void SegmentManager::SetLiveSize(uint32_t seg_id, uint64_t live_size) {
+    std::lock_guard <std::mutex> l(mtx_);
+    if (segTable_[seg_id].state != SegUseStat::USED) {
+        return;
+    }
+    uint64_t written = (uint64_t) segSize_ - segTable_[seg_id].free_size - SegBase::SizeOfSegOnDisk();
+    segTable_[seg_id].death_size = written > live_size ? (uint32_t) (written - live_size) : 0;
+    refreshBucket(seg_id);
+}
+
+uint64_t SegmentManager::GetTimestamp(uint32_t seg_id) {
+    std::lock_guard <std::mutex> l(mtx_);
+    return segTable_[seg_id].timestamp;
+}
+
+uint32_t SegmentManager::GetGeneration(uint32_t seg_id) {
+    std::lock_guard <std::mutex> l(mtx_);
+    return segTable_[seg_id].gc_gen;
+}
+
+SegmentManager::LiveWord* SegmentManager::liveMapOf(uint32_t seg_id, bool create) {
+    LiveWord *map = liveMap_[seg_id].load(std::memory_order_acquire);
+    if (map || !create) {
+        return map;
+    }
+
+    LiveWord *fresh = new LiveWord[liveWords_];
+    for (uint32_t i = 0; i < liveWords_; i++) {
+        fresh[i].store(0, std::memory_order_relaxed);
+    }
+    if (liveMap_[seg_id].compare_exchange_strong(map, fresh, std::memory_order_acq_rel)) {
+        return fresh;
+    }
+    delete[] fresh;
+    return map;
+}
+
+// Bits of one segment are set and cleared under the slot locks of
+// different keys, hence the atomic word updates.
+void SegmentManager::SetLive(uint32_t seg_id, uint32_t seg_pos) {
+    uint32_t bit = seg_pos / IndexManager::SizeOfDataHeader();
+    LiveWord *map = liveMapOf(seg_id, true);
+    map[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+}
+
+void SegmentManager::ClearLive(uint32_t seg_id, uint32_t seg_pos) {
+    uint32_t bit = seg_pos / IndexManager::SizeOfDataHeader();
+    LiveWord *map = liveMapOf(seg_id, false);
+    if (map) {
+        map[bit / 64].fetch_and(~(1ULL << (bit % 64)), std::memory_order_relaxed);
+    }
+}
+
+bool SegmentManager::IsLive(uint32_t seg_id, uint32_t seg_pos) {
+    uint32_t bit = seg_pos / IndexManager::SizeOfDataHeader();
+    LiveWord *map = liveMapOf(seg_id, false);
+    if (!map) {
+        return false;
+    }
+    return map[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64));
+}
+
+uint32_t SegmentManager::GetUsedSize(uint32_t seg_id) {
+    std::lock_guard <std::mutex> l(mtx_);
+    return getUsedSize(seg_id);
+}
+
+uint64_t SegmentManager::GetNowTimestamp() {
+    KVTime now;
+    timeval tv = now.GetTimeval();
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+uint32_t SegmentManager::getUsedSize(uint32_t seg_id) {
+    // death_size may overshoot under concurrent updates, never wrap around
+    uint64_t unused = (uint64_t) segTable_[seg_id].free_size
+            + segTable_[seg_id].death_size + SegBase::SizeOfSegOnDisk();
+    return unused < segSize_ ? segSize_ - (uint32_t) unused : 0;
+}
+
+void SegmentManager::setFree(uint32_t seg_id) {
+    uint32_t word = seg_id / 64;
+    freeMap_[word] |= 1ULL << (seg_id % 64);
+    freeSum_[word / 64] |= 1ULL << (word % 64);
 }
 
+void SegmentManager::clearFree(uint32_t seg_id) {
+    uint32_t word = seg_id / 64;
+    freeMap_[word] &= ~(1ULL << (seg_id % 64));
+    if (!freeMap_[word]) {
+        freeSum_[word / 64] &= ~(1ULL << (word % 64));
+    }
+}
+
+// The first allocable segment from seg_id on, SEG_NONE if none.
+uint32_t SegmentManager::findFree(uint32_t seg_id) {
+    if (seg_id >= segNum_) {
+        return SEG_NONE;
+    }
+    uint32_t word = seg_id / 64;
+    uint64_t bits = freeMap_[word] & (~0ULL << (seg_id % 64));
+    if (bits) {
+        return word * 64 + __builtin_ctzll(bits);
+    }
+
+    // the next word with a free segment, from the summary
+    word++;
+    uint32_t sum = word / 64;
+    if (sum >= freeSum_.size()) {
+        return SEG_NONE;
+    }
+    bits = freeSum_[sum] & (~0ULL << (word % 64));
+    while (!bits) {
+        if (++sum == freeSum_.size()) {
+            return SEG_NONE;
+        }
+        bits = freeSum_[sum];
+    }
+    word = sum * 64 + __builtin_ctzll(bits);
+    return word * 64 + __builtin_ctzll(freeMap_[word]);
+}
+
+uint32_t SegmentManager::bucketOf(uint32_t used_size) {
+    return (uint32_t) ((uint64_t) used_size * GC_UTIL_BUCKETS / ((uint64_t) segSize_ + 1));
+}
+
+void SegmentManager::refreshBucket(uint32_t seg_id) {
+    uint32_t bucket = SEG_NONE;
+    if (segTable_[seg_id].state == SegUseStat::USED && !pinnedSegs_.count(seg_id)) {
+        bucket = bucketOf(getUsedSize(seg_id));
+    }
+    if (bucket == segBucket_[seg_id]) {
+        return;
+    }
+    unlinkBucket(seg_id);
+    if (bucket != SEG_NONE) {
+        linkBucket(seg_id, bucket);
+    }
+}
+
+void SegmentManager::linkBucket(uint32_t seg_id, uint32_t bucket) {
+    uint32_t head = bucketHead_[bucket];
+    segPrev_[seg_id] = SEG_NONE;
+    segNext_[seg_id] = head;
+    if (head != SEG_NONE) {
+        segPrev_[head] = seg_id;
+    }
+    bucketHead_[bucket] = seg_id;
+    segBucket_[seg_id] = bucket;
+}
+
+void SegmentManager::unlinkBucket(uint32_t seg_id) {
+    uint32_t bucket = segBucket_[seg_id];
+    if (bucket == SEG_NONE) {
+        return;
+    }
+    uint32_t prev = segPrev_[seg_id];
+    uint32_t next = segNext_[seg_id];
+    if (prev != SEG_NONE) {
+        segNext_[prev] = next;
+    } else {
+        bucketHead_[bucket] = next;
+    }
+    if (next != SEG_NONE) {
+        segPrev_[next] = prev;
+    }
+    segBucket_[seg_id] = SEG_NONE;
+}
+
+void SegmentManager::Pin(uint32_t seg_id) {
+    std::lock_guard <std::mutex> l(mtx_);
+    pinnedSegs_.insert(seg_id);
+    refreshBucket(seg_id);
+}
+
+void SegmentManager::Unpin(uint32_t seg_id) {
+    std::lock_guard <std::mutex> l(mtx_);
+    pinnedSegs_.erase(seg_id);
+    refreshBucket(seg_id);
+}
+
+// Taken in id order, so neighbours can be discarded as one range.
+void SegmentManager::TakeForDiscard(std::vector<uint32_t> &segs, uint32_t max_num) {
+    std::lock_guard <std::mutex> l(mtx_);
+    uint32_t limit = freedCounter_ / 2;
+    if (discardingNum_ >= limit) {
+        return;
+    }
+    uint32_t num = std::min(max_num, limit - discardingNum_);
+    std::set<uint32_t>::iterator iter = discardSegs_.begin();
+    while (iter != discardSegs_.end() && segs.size() < num) {
+        uint32_t seg_id = *iter;
+        iter = discardSegs_.erase(iter);
+        // reallocated since it was freed
+        if (segTable_[seg_id].state != SegUseStat::FREE) {
+            continue;
+        }
+        clearFree(seg_id);
+        discardingNum_++;
+        segs.push_back(seg_id);
+    }
+}
+
+void SegmentManager::DiscardDone(std::vector<uint32_t> &segs) {
+    std::lock_guard <std::mutex> l(mtx_);
+    for (uint32_t i = 0; i < segs.size(); i++) {
+        setFree(segs[i]);
+    }
+    discardingNum_ -= segs.size();
+}
+
+// Segments being discarded are free but not allocatable yet.
 uint32_t SegmentManager::GetTotalFreeSegs() {
     std::lock_guard <std::mutex> l(mtx_);
-    return freedCounter_;
+    return freedCounter_ - discardingNum_;
 }
 
 uint32_t SegmentManager::GetTotalUsedSegs() {
@@ -142,55 +397,120 @@ uint32_t SegmentManager::GetTotalUsedSegs() {
 
 void SegmentManager::SortSegsByUtils( std::multimap<uint32_t, uint32_t> &cand_map, double utils) {
     std::lock_guard <std::mutex> lck(mtx_);
-    uint32_t used_size;
     uint32_t thld = (uint32_t)(segSize_ * utils);
 
-    for (uint32_t index = 0; index < segNum_; index++) {
-        if (segTable_[index].state == SegUseStat::USED) {
-            used_size = segSize_ - (segTable_[index].free_size
-                    + segTable_[index].death_size
-                    + (uint32_t) SegBase::SizeOfSegOnDisk());
+    if (options_.gc_policy == GC_POLICY_COST_BENEFIT) {
+        sortByCostBenefit(cand_map, thld);
+        __DEBUG("There is tatal %lu segments utils under %f", cand_map.size(), utils);
+        return;
+    }
+
+    // from the emptiest bucket up, segments in one bucket are unordered
+    for (uint32_t bucket = 0; bucket < GC_UTIL_BUCKETS; bucket++) {
+        for (uint32_t index = bucketHead_[bucket]; index != SEG_NONE; index = segNext_[index]) {
+            if (cand_map.size() >= GC_CANDS_MAX) {
+                return;
+            }
+            uint32_t used_size = getUsedSize(index);
             if (used_size < thld) {
                 cand_map.insert(std::pair<uint32_t, uint32_t>(used_size, index));
             }
         }
-    } __DEBUG("There is tatal %lu segments utils under %f", cand_map.size(), utils);
-}
-
-void SegmentManager::SortSegsByTS(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t max_seg_num)
-{
-    std::unique_lock<std::mutex> lck(mtx_, std::defer_lock);
-    uint32_t used_size;
-
-    lck.lock();
-    std::multimap<uint32_t, uint32_t> used_map;
-    for (uint32_t index = 0; index < segNum_; index++) {
-        if (segTable_[index].state == SegUseStat::USED) {
-            used_size = segSize_ - (segTable_[index].free_size
-                    + segTable_[index].death_size
-                    + (uint32_t) SegBase::SizeOfSegOnDisk());
-            used_map.insert(std::pair<uint32_t, uint32_t>(used_size, index));
+    }
+    __DEBUG("There is tatal %lu segments utils under %f", cand_map.size(), utils);
+}
+
+// LFS cost-benefit: (1 - u) * age / (1 + u). A cold segment is worth
+// cleaning at a higher utilization than a hot one, whose remaining live
+// data is likely to die soon anyway. Only the GC_CB_SCAN_MAX emptiest
+// segments are scored. cand_map is keyed by rank.
+void SegmentManager::sortByCostBenefit(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t thld) {
+    uint64_t now = GetNowTimestamp();
+    std::multimap<double, uint32_t, std::greater<double> > score_map;
+    uint32_t scanned = 0;
+
+    for (uint32_t bucket = 0; bucket < GC_UTIL_BUCKETS && scanned < GC_CB_SCAN_MAX; bucket++) {
+        for (uint32_t index = bucketHead_[bucket];
+                index != SEG_NONE && scanned < GC_CB_SCAN_MAX; index = segNext_[index]) {
+            uint32_t used_size = getUsedSize(index);
+            if (used_size >= thld) {
+                continue;
+            }
+            double u = (double) used_size / (double) segSize_;
+            uint64_t ts = segTable_[index].timestamp;
+            double age = (double) (now > ts ? now - ts : 0) + 1;
+            score_map.insert(std::make_pair((1 - u) * age / (1 + u), index));
+            scanned++;
+        }
+    }
+
+    uint32_t rank = 0;
+    for (std::multimap<double, uint32_t, std::greater<double> >::iterator iter =
+            score_map.begin(); iter != score_map.end() && rank < GC_CANDS_MAX; ++iter) {
+        cand_map.insert(std::make_pair(rank++, iter->second));
+    }
+}
+
+void SegmentManager::AddHeat(uint32_t seg_id) {
+    segHeat_[seg_id].fetch_add(1, std::memory_order_relaxed);
+}
+
+// A read racing with the decay may be lost, that is fine for a hint.
+void SegmentManager::DecayHeat() {
+    for (uint32_t i = 0; i < segNum_; i++) {
+        uint32_t heat = segHeat_[i].load(std::memory_order_relaxed);
+        if (heat) {
+            segHeat_[i].store(heat / 2, std::memory_order_relaxed);
         }
     }
-    lck.unlock();
+}
 
-    for(std::multimap<uint32_t, uint32_t>::iterator iter = used_map.begin(); iter != used_map.end(); iter++) {
-        if (max_seg_num == 0) {
-            break;
+void SegmentManager::SortSegsByHeat(std::vector<uint32_t> &cands, uint32_t max_seg_num) {
+    // (heat, timestamp) of each used, unpinned segment
+    std::vector<std::pair<std::pair<uint32_t, uint64_t>, uint32_t> > segs;
+    {
+        std::lock_guard <std::mutex> lck(mtx_);
+        for (uint32_t bucket = 0; bucket < GC_UTIL_BUCKETS; bucket++) {
+            for (uint32_t index = bucketHead_[bucket]; index != SEG_NONE; index = segNext_[index]) {
+                uint32_t heat = segHeat_[index].load(std::memory_order_relaxed);
+                segs.push_back(std::make_pair(std::make_pair(heat, segTable_[index].timestamp), index));
+            }
         }
-        cand_map.insert(*iter);
-        max_seg_num --;
+    }
+
+    uint32_t num = std::min((uint32_t) segs.size(), max_seg_num);
+    std::partial_sort(segs.begin(), segs.begin() + num, segs.end());
+    for (uint32_t i = 0; i < num; i++) {
+        cands.push_back(segs[i].second);
     }
 }
 
 SegmentManager::SegmentManager(Options &opt, uint32_t segment_size, uint32_t segment_num, uint32_t cur_seg_id, uint32_t seg_size_bit)
     : segSize_(segment_size), segSizeBit_(seg_size_bit), segNum_(segment_num),
         curSegId_(cur_seg_id), usedCounter_(0), freedCounter_(segNum_),
-        reservedCounter_(0), options_(opt) {
+        reservedCounter_(0), bucketHead_(GC_UTIL_BUCKETS, SEG_NONE),
+        segBucket_(segNum_, SEG_NONE), segPrev_(segNum_, SEG_NONE),
+        segNext_(segNum_, SEG_NONE), freeMap_((segNum_ + 63) / 64, 0),
+        freeSum_((segNum_ + 64 * 64 - 1) / (64 * 64), 0),
+        discardingNum_(0), liveMap_(NULL), liveWords_(0), segHeat_(NULL),
+        options_(opt) {
+    uint32_t live_bits = segSize_ / IndexManager::SizeOfDataHeader() + 1;
+    liveWords_ = (live_bits + 63) / 64;
+    liveMap_ = new std::atomic<LiveWord *>[segNum_];
+    segHeat_ = new std::atomic<uint32_t>[segNum_];
+    for (uint32_t i = 0; i < segNum_; i++) {
+        liveMap_[i].store(NULL, std::memory_order_relaxed);
+        segHeat_[i].store(0, std::memory_order_relaxed);
+    }
 }
 
 SegmentManager::~SegmentManager() {
     segTable_.clear();
+    for (uint32_t i = 0; i < segNum_; i++) {
+        delete[] liveMap_[i].load(std::memory_order_relaxed);
+    }
+    delete[] liveMap_;
+    delete[] segHeat_;
 }
 
 } //end namespace hlkvds
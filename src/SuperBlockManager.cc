@@ -104,4 +104,9 @@ void SuperBlockManager::SetDataTheorySize(uint64_t size) {
     sb_.entry_theory_data_size = size;
 }
 
+void SuperBlockManager::SetGraceCloseFlag(bool flag) {
+    std::lock_guard<std::mutex> l(mtx_);
+    sb_.grace_close_flag = flag;
+}
+
 } // namespace hlkvds
@@ -21,26 +21,24 @@ Tier::~Tier() {
 
 FastTier::FastTier(Options& opts, SuperBlockManager* sb, IndexManager* idx, MediumTier* mt) :
         options_(opts), sbMgr_(sb), idxMgr_(idx), maxValueLen_(0),
-        segSize_(0), segNum_(0), vol_(NULL), mig_(NULL), mt_(mt),
+        segSize_(0), segNum_(0), vol_(NULL), appendLog_(NULL), mig_(NULL), mt_(mt),
         segWteWQ_(NULL) {
     shardsNum_ = options_.shards_num;
+    segShards_ = new SegShardTable(shardsNum_);
 }
 
 FastTier::~FastTier() {
     deleteAllSegments();
+    delete segShards_;
     if(vol_) {
         delete vol_;
     }
 }
 
 void FastTier::CreateAllSegments() {
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_);
     for (int i = 0; i < shardsNum_; i++) {
-        SegForReq * seg = new SegForReq(vol_, idxMgr_, options_.expired_time);
-        segMap_.insert(make_pair(i, seg));
-
-        std::mutex *seg_mtx = new mutex();
-        segMtxVec_.push_back(seg_mtx);
+        SegForReq * seg = segShards_->NewSeg(i, vol_, idxMgr_, options_.expired_time);
+        segShards_->Swap(i, seg);
     }
 
     //Create Migrate;
@@ -54,13 +52,16 @@ void FastTier::StartThds() {
         reqWQVec_.push_back(req_wq);
     }
 
-    segWteWQ_ = new SegmentWriteWQ(this, options_.seg_write_thread);
+    int depth = min(vol_->GetQueueDepth(), options_.seg_write_thread);
+    segWteWQ_ = new SegmentWriteWQ(this, max(depth, 1));
     segWteWQ_->Start();
 
     segTimeoutT_stop_.store(false);
     segTimeoutT_ = std::thread(&FastTier::SegTimeoutThdEntry, this);
 
     //vol_->StartThds();
+    vol_->StartDiscardThd();
+    appendLog_ = new SegAppendLog(vol_, idxMgr_);
 
     migrationT_stop_.store(false);
     migrationT_ = std::thread(&FastTier::MigrationThdEntry, this);
@@ -68,6 +69,14 @@ void FastTier::StartThds() {
 
 void FastTier::StopThds() {
     //vol_->StopThds();
+    vol_->StopDiscardThd();
+    if (appendLog_) {
+        if (!appendLog_->Seal()) {
+            __ERROR("Seal append log failed");
+        }
+        delete appendLog_;
+        appendLog_ = NULL;
+    }
 
     migrationT_stop_.store(true);
     migrationT_.join();
@@ -148,8 +157,10 @@ Status FastTier::WriteBatchData(WriteBatch *batch) {
     }
 
     uint32_t free_size = seg->GetFreeSize();
+    vol_->Pin(seg_id);
     vol_->Use(seg_id, free_size);
     seg->UpdateToIndex();
+    vol_->Unpin(seg_id);
     delete seg;
     return Status::OK();
 }
@@ -178,6 +189,7 @@ Status FastTier::ReadData(KVSlice &slice, std::string &data) {
     }
     data.assign(mdata, data_len);
     delete[] mdata;
+    vol_->AddReadHeat(*entry);
 
     __DEBUG("get key: %s, data offset %ld, head_offset is %ld", slice.GetKeyStr().c_str(), data_offset, entry->GetHeaderOffset());
 
@@ -299,6 +311,10 @@ void FastTier::ModifyDeathEntry(HashEntry &entry) {
     vol_->ModifyDeathEntry(entry);
 }
 
+void FastTier::ModifyLiveEntry(HashEntry &entry) {
+    vol_->ModifyLiveEntry(entry);
+}
+
 std::string FastTier::GetKeyByHashEntry(HashEntry *entry) {
     uint64_t key_offset = 0;
 
@@ -346,57 +362,62 @@ std::string FastTier::GetValueByHashEntry(HashEntry *entry) {
     return res;
 }
 
-Status FastTier::writeDataAggregate(KVSlice& slice) {
+Status FastTier::PromoteData(KVSlice &slice) {
+    if (slice.GetDataLen() > maxValueLen_) {
+        return Status::NotSupported("Data length cann't be longer than max segment size");
+    }
+    return writeDataAggregate(slice, true);
+}
 
-    Request *req = new Request(slice);
+Status FastTier::writeDataAggregate(KVSlice& slice, bool promote) {
 
     int shards_id = calcShardId(slice);
-    req->SetShardsWQId(shards_id);
+    Request *req = segShards_->NewRequest(shards_id, slice);
     ReqsMergeWQ *req_wq = reqWQVec_[shards_id];
     req_wq->Add_task(req);
 
     req->Wait();
-    Status s = updateMeta(req);
-    delete req;
+    Status s = updateMeta(req, promote);
+    segShards_->FreeRequest(req);
     return s;
 }
 
 Status FastTier::writeDataImmediately(KVSlice& slice){
-    uint32_t seg_id = 0;
-    bool ret = false;
+    std::lock_guard<std::mutex> l(appendLog_->GetMutex());
+    if (!appendLog_->TryPut(&slice)) {
+        if (!appendLog_->Seal()) {
+            __ERROR("Seal append log failed, seg_id = %d", appendLog_->GetSegId());
+        }
 
-    ret = allocSegment(seg_id);
-    if (!ret) {
-        __ERROR("Cann't get a new Empty Segment.\n");
-        return Status::Aborted("Can't allocate a Empty Segment.");
+        uint32_t seg_id = 0;
+        if (!allocSegment(seg_id)) {
+            __ERROR("Cann't get a new Empty Segment.\n");
+            return Status::Aborted("Can't allocate a Empty Segment.");
+        }
+        if (!appendLog_->Open(seg_id)) {
+            __ERROR("Open append log failed");
+            vol_->FreeForFailed(seg_id);
+            return Status::IOError("could not open append log on device");
+        }
     }
 
-    SegLatencyFriendly *seg = new SegLatencyFriendly(vol_, idxMgr_);
-    seg->Put(&slice);
-    seg->SegSegId(seg_id);
-    ret = seg->WriteSegToDevice();
-    if(!ret) {
-        __ERROR("Write batch segment to device failed");
-        vol_->FreeForFailed(seg_id);
-        delete seg;
-        return Status::IOError("could not write batch segment to device ");
+    if (!appendLog_->Append(&slice)) {
+        __ERROR("Append to log failed");
+        return Status::IOError("could not append data to device");
     }
-    uint32_t free_size = seg->GetFreeSize();
-    vol_->Use(seg_id, free_size);
-    seg->UpdateToIndex();
-    delete seg;
+    idxMgr_->UpdateIndex(&slice);
     return Status::OK();
-
 }
 
-Status FastTier::updateMeta(Request *req) {
+Status FastTier::updateMeta(Request *req, bool promote) {
     bool res = req->GetWriteStat();
     // update index
     if (!res) {
         return Status::Aborted("Write failed");
     }
     KVSlice *slice = &req->GetSlice();
-    res = idxMgr_->UpdateIndex(slice);
+    // a promoted copy is put like a GC copy, never over a newer write
+    res = idxMgr_->UpdateIndex(slice, promote);
     // minus the segment delete counter
     SegForReq *seg = req->GetSeg();
     if (!seg->CommitedAndGetNum()) {
@@ -408,15 +429,11 @@ Status FastTier::updateMeta(Request *req) {
 void FastTier::deleteAllSegments() {
     delete mig_;
 
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_);
     for (int i = 0; i< shardsNum_; i++) {
-        SegForReq* seg = segMap_[i];
+        std::lock_guard<std::mutex> l(segShards_->GetMutex(i));
+        SegForReq* seg = segShards_->Swap(i, NULL);
         delete seg;
-        std::mutex *seg_mtx = segMtxVec_[i];
-        delete seg_mtx;
     }
-    segMap_.clear();
-    segMtxVec_.clear();
 }
 
 void FastTier::initSBReservedContentForCreate() {
@@ -450,10 +467,9 @@ bool FastTier::allocSegment(uint32_t &seg_id) {
         if (mt_vol_num == 0) {
             return false;
         }
-        uint32_t mt_vol_id = mt_->PickVolForMigrate();
         mt_vol_num--;
-        uint32_t free_num = mig_->ForeMigrate(mt_vol_id);
-        __DEBUG("After migration total free %d segments on Medium Tier Volume [%d].", free_num, mt_vol_id);
+        uint32_t free_num = mig_->ForeMigrate();
+        __DEBUG("After migration total free %d segments on Fast Tier.", free_num);
     }
 
     return true;
@@ -462,14 +478,8 @@ bool FastTier::allocSegment(uint32_t &seg_id) {
 void FastTier::ReqMerge(Request* req) {
     int shard_id = req->GetShardsWQId();
 
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_, std::defer_lock);
-
-    std::mutex *seg_mtx = segMtxVec_[shard_id];
-    std::unique_lock<std::mutex> lck_seg(*seg_mtx);
-
-    lck_seg_map.lock();
-    SegForReq *seg = segMap_[shard_id];
-    lck_seg_map.unlock();
+    std::unique_lock<std::mutex> lck_seg(segShards_->GetMutex(shard_id));
+    SegForReq *seg = segShards_->Get(shard_id);
 
     if (seg->TryPut(req)) {
         seg->Put(req);
@@ -477,13 +487,8 @@ void FastTier::ReqMerge(Request* req) {
         seg->Completion();
         segWteWQ_->Add_task(seg);
 
-        seg = new SegForReq(vol_, idxMgr_, options_.expired_time);
-
-        lck_seg_map.lock();
-        std::map<int, SegForReq*>::iterator iter = segMap_.find(shard_id);
-        segMap_.erase(iter);
-        segMap_.insert( make_pair(shard_id, seg) );
-        lck_seg_map.unlock();
+        seg = segShards_->NewSeg(shard_id, vol_, idxMgr_, options_.expired_time);
+        segShards_->Swap(shard_id, seg);
 
         seg->Put(req);
     }
@@ -505,6 +510,9 @@ void FastTier::SegWrite(SegForReq *seg) {
     seg->SetSegId(seg_id);
     ret = seg->WriteSegToDevice();
     if (ret) {
+        // GC must not take the segment before its requests are indexed,
+        // the segment reaper unpins it
+        vol_->Pin(seg_id);
         vol_->Use(seg_id, free_size);
     } else {
         vol_->FreeForFailed(seg_id);
@@ -514,28 +522,18 @@ void FastTier::SegWrite(SegForReq *seg) {
 
 void FastTier::SegTimeoutThdEntry() {
     __DEBUG("Segment Timeout thread start!!");
-    std::unique_lock<std::mutex> lck_seg_map(segMapMtx_, std::defer_lock);
 
     while (!segTimeoutT_stop_) {
         for ( int i = 0; i < shardsNum_; i++) {
-            std::mutex *mtx = segMtxVec_[i];
-            std::unique_lock<std::mutex> l(*mtx);
-
-            lck_seg_map.lock();
-            SegForReq *seg = segMap_[i];
-            lck_seg_map.unlock();
+            std::unique_lock<std::mutex> l(segShards_->GetMutex(i));
+            SegForReq *seg = segShards_->Get(i);
 
             if (seg->IsExpired()) {
                 seg->Completion();
 
                 segWteWQ_->Add_task(seg);
-                seg = new SegForReq(vol_, idxMgr_, options_.expired_time);
-
-                lck_seg_map.lock();
-                std::map<int, SegForReq*>::iterator iter = segMap_.find(i);
-                segMap_.erase(iter);
-                segMap_.insert( make_pair(i, seg) );
-                lck_seg_map.unlock();
+                seg = segShards_->NewSeg(i, vol_, idxMgr_, options_.expired_time);
+                segShards_->Swap(i, seg);
             }
         }
 
@@ -543,41 +541,37 @@ void FastTier::SegTimeoutThdEntry() {
     } __DEBUG("Segment Timeout thread stop!!");
 }
 
+// Over the upper watermark the coldest segments are demoted until the
+// utilization is down to the lower one.
 void FastTier::MigrationThdEntry() {
     __DEBUG("Migration thread start!!");
+    KVTime last_decay;
     while (!migrationT_stop_) {
-        uint32_t free_seg_num = vol_->GetTotalFreeSegs();
-        uint32_t total_seg_num = vol_->GetNumberOfSeg();
-        uint32_t used_seg_num = total_seg_num - free_seg_num;
-
-        double util_rate = (double)used_seg_num / (double)total_seg_num;
-
-        //if ( util_rate > 0.3) {
-        //    uint32_t mt_vol_id = mt_->PickVolForMigrate();
-        //    uint32_t free_num = mig_->BackMigrate(mt_vol_id);
-        //    __DEBUG("Once migration done, free %d segments", free_num);
-
-        //    int sleep_time;
-        //    if (util_rate > 0.8) {
-        //        sleep_time = 10;
-        //    }
-        //    else if (util_rate > 0.5) {
-        //        sleep_time = 1000;
-        //    }
-        //    else{
-        //        sleep_time = 100000;
-        //    }
-        //    usleep(sleep_time);
-        //}
-        if (util_rate > 0.1) {
-            uint32_t mt_vol_id = mt_->PickVolForMigrate();
-            uint32_t free_num = mig_->BackMigrate(mt_vol_id);
-            __DEBUG("Once migration done, free %d segments", free_num);
+        KVTime now;
+        if (now - last_decay >= MIG_HEAT_DECAY_US) {
+            vol_->DecayHeat();
+            last_decay = now;
+        }
+
+        if (GetUtilRate() > options_.mig_upper_level) {
+            while (!migrationT_stop_ && GetUtilRate() > options_.mig_lower_level) {
+                uint32_t free_num = mig_->BackMigrate();
+                __DEBUG("Once migration done, free %d segments", free_num);
+                if (!free_num) {
+                    break;
+                }
+            }
         }
-        usleep(1000);
+        usleep(MIG_INTERVAL_US);
     }__DEBUG("Migration thread stop!!");
 }
 
+double FastTier::GetUtilRate() {
+    uint32_t total_seg_num = vol_->GetNumberOfSeg();
+    uint32_t used_seg_num = total_seg_num - vol_->GetTotalFreeSegs();
+    return (double)used_seg_num / (double)total_seg_num;
+}
+
 MediumTier::MediumTier(Options& opts, SuperBlockManager* sb, IndexManager* idx) :
         options_(opts), sbMgr_(sb), idxMgr_(idx),
         segSize_(0), segTotalNum_(0), volNum_(0), pickVolId_(-1) {
@@ -590,10 +584,19 @@ MediumTier::~MediumTier() {
 void MediumTier::StartThds() {
     for (uint32_t i = 0; i < volNum_; i++) {
         volMap_[i]->StartThds();
+        appendLogs_.push_back(new SegAppendLog(volMap_[i], idxMgr_));
     }
 }
 
 void MediumTier::StopThds() {
+    for (uint32_t i = 0; i < appendLogs_.size(); i++) {
+        if (!appendLogs_[i]->Seal()) {
+            __ERROR("Seal append log failed, vol_id = %d", i);
+        }
+        delete appendLogs_[i];
+    }
+    appendLogs_.clear();
+
     for (uint32_t i = 0; i < volNum_; i++) {
         volMap_[i]->StopThds();
     }
@@ -649,6 +652,42 @@ Status MediumTier::ReadData(KVSlice &slice, std::string &data) {
     return Status::OK();
 }
 
+Status MediumTier::WriteData(KVSlice &slice) {
+    for (uint32_t i = 0; i < volNum_; i++) {
+        uint32_t vol_id = PickVolForMigrate();
+        SegAppendLog *log = appendLogs_[vol_id];
+        std::lock_guard<std::mutex> l(log->GetMutex());
+        if (!log->TryPut(&slice)) {
+            if (!log->Seal()) {
+                __ERROR("Seal append log failed, vol_id = %d", vol_id);
+            }
+
+            // a full volume passes the write on to the next one
+            uint32_t seg_id = 0;
+            Volume *vol = volMap_[vol_id];
+            if (!vol->Alloc(seg_id)) {
+                continue;
+            }
+            if (!log->Open(seg_id)) {
+                __ERROR("Open append log failed");
+                vol->FreeForFailed(seg_id);
+                return Status::IOError("could not open append log on device");
+            }
+            if (!log->TryPut(&slice)) {
+                return Status::NotSupported("Data length cann't be longer than max segment size");
+            }
+        }
+
+        if (!log->Append(&slice)) {
+            __ERROR("Append to log failed");
+            return Status::IOError("could not append data to device");
+        }
+        idxMgr_->UpdateIndex(&slice);
+        return Status::OK();
+    }
+    return Status::Aborted("Can't allocate a Empty Segment.");
+}
+
 void MediumTier::ManualGC() {
     map<int, Volume *>::iterator iter;
     for (iter = volMap_.begin(); iter != volMap_.end(); ) {
@@ -815,6 +854,11 @@ void MediumTier::ModifyDeathEntry(HashEntry &entry) {
     volMap_[vol_id]->ModifyDeathEntry(entry);
 }
 
+void MediumTier::ModifyLiveEntry(HashEntry &entry) {
+    int vol_id = getVolIdFromEntry(&entry);
+    volMap_[vol_id]->ModifyLiveEntry(entry);
+}
+
 std::string MediumTier::GetKeyByHashEntry(HashEntry *entry){
     uint64_t key_offset = 0;
 
@@ -29,6 +29,10 @@ time_t KVTime::GetTime() {
     return (time_t) tm_.tv_sec;
 }
 
+void KVTime::SetTimeval(timeval _time) {
+    tm_ = _time;
+}
+
 timeval KVTime::GetTimeval() {
     return tm_;
 }
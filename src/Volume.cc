@@ -13,31 +13,52 @@ Volume::Volume(BlockDevice* dev, IndexManager* im,
                 Options& opts, int vol_id, uint64_t start_off,
                 uint32_t segment_size, uint32_t segment_num,
                 uint32_t cur_seg_id)
-    : bdev_(dev), segMgr_(NULL), gcMgr_(NULL), idxMgr_(im),
+    : bdev_(dev), segMgr_(NULL), gcMgr_(NULL), ioSched_(NULL), idxMgr_(im),
         options_(opts), volId_(vol_id), startOff_(start_off), segSize_(segment_size),
-        segNum_(segment_num), segSizeBit_(0) {
+        segNum_(segment_num), segSizeBit_(0), pendingWrites_(0), writeLat_(0),
+        discardT_stop_(true), discardOk_(true) {
 
     segSizeBit_ = log2(segSize_);
 
     segMgr_ = new SegmentManager(options_, segSize_, segNum_, cur_seg_id, segSizeBit_);
+    ioSched_ = new IoScheduler(options_, bdev_->GetQueueDepth());
     gcMgr_ = new GcManager(idxMgr_, this, options_);
 }
 
 Volume::~Volume() {
     delete segMgr_;
     delete gcMgr_;
+    delete ioSched_;
 }
 
 void Volume::StartThds() {
     gcT_stop_.store(false);
     gcT_ = std::thread(&Volume::GCThdEntry, this);
+    StartDiscardThd();
 } 
 
 void Volume::StopThds() {
+    StopDiscardThd();
     gcT_stop_.store(true);
     gcT_.join();
 }
 
+void Volume::StartDiscardThd() {
+    if (!options_.discard_segments) {
+        return;
+    }
+    discardT_stop_.store(false);
+    discardT_ = std::thread(&Volume::DiscardThdEntry, this);
+}
+
+void Volume::StopDiscardThd() {
+    if (discardT_stop_) {
+        return;
+    }
+    discardT_stop_.store(true);
+    discardT_.join();
+}
+
 void Volume::GCThdEntry() {
     __DEBUG("GC thread start!!");
     while (!gcT_stop_) {
@@ -46,6 +67,45 @@ void Volume::GCThdEntry() {
     } __DEBUG("GC thread stop!!");
 }
 
+void Volume::DiscardThdEntry() {
+    __DEBUG("Discard thread start!!");
+    while (!discardT_stop_) {
+        DiscardFreeSegs();
+        usleep(DISCARD_INTERVAL_US);
+    } __DEBUG("Discard thread stop!!");
+}
+
+// Runs of neighbouring segments go to the device as one range. A device
+// that does not support discard is not asked again.
+void Volume::DiscardFreeSegs() {
+    if (!discardOk_) {
+        return;
+    }
+    vector<uint32_t> segs;
+    segMgr_->TakeForDiscard(segs, DISCARD_BATCH_SEGS);
+
+    uint32_t i = 0;
+    while (i < segs.size() && discardOk_) {
+        uint32_t j = i + 1;
+        while (j < segs.size() && segs[j] == segs[j - 1] + 1) {
+            j++;
+        }
+        uint64_t offset = ((uint64_t) segs[i] << segSizeBit_) + startOff_;
+        uint64_t length = (uint64_t) (j - i) << segSizeBit_;
+        ioSched_->Begin(IoClass::BACKGROUND, 0);
+        KVTime start;
+        int r = bdev_->Discard(offset, length);
+        ioSched_->End(IoClass::BACKGROUND, start);
+        if (r < 0) {
+            __WARN("Device %s does not support discard, freed segments stay allocated",
+                    bdev_->GetDevicePath().c_str());
+            discardOk_ = false;
+        }
+        i = j;
+    }
+    segMgr_->DiscardDone(segs);
+}
+
 bool Volume::Alloc(uint32_t& seg_id) {
     return segMgr_->Alloc(seg_id);
 }
@@ -58,24 +118,68 @@ bool Volume::SetSST(char* buf, uint64_t length) {
     return segMgr_->Set(buf, length);
 }
 
-bool Volume::Read(char* data, size_t count, off_t offset) {
+bool Volume::Read(char* data, size_t count, off_t offset, IoClass cls) {
     uint64_t phy_offset = offset + startOff_;
-    if (bdev_->pRead(data, count, phy_offset) != (ssize_t)count) {
+    ioSched_->Begin(cls, count);
+    KVTime start;
+    ssize_t ret = bdev_->pRead(data, count, phy_offset);
+    ioSched_->End(cls, start);
+    if (ret != (ssize_t)count) {
         __ERROR("Read data error!!!");
         return false;
     }
     return true;
 }
 
-bool Volume::Write(char* data, size_t count, off_t offset) {
+bool Volume::Write(char* data, size_t count, off_t offset, IoClass cls) {
     uint64_t phy_offset = offset + startOff_;
-    if (bdev_->pWrite(data, count, phy_offset) != (ssize_t)count) {
+    ioSched_->Begin(cls, count);
+    KVTime start;
+    ssize_t ret = bdev_->pWrite(data, count, phy_offset);
+    ioSched_->End(cls, start);
+    if (ret != (ssize_t)count) {
         __ERROR("Write data error!!!");
         return false;
     }
+    updateWriteLatency(start);
     return true;
 }
 
+bool Volume::Writev(const struct iovec *iov, int iovcnt, off_t offset, IoClass cls) {
+    uint64_t phy_offset = offset + startOff_;
+    ssize_t count = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        count += iov[i].iov_len;
+    }
+    ioSched_->Begin(cls, count);
+    KVTime start;
+    ssize_t ret = bdev_->pWritev(iov, iovcnt, phy_offset);
+    ioSched_->End(cls, start);
+    if (ret != count) {
+        __ERROR("Writev data error!!!");
+        return false;
+    }
+    updateWriteLatency(start);
+    return true;
+}
+
+void Volume::updateWriteLatency(KVTime &start) {
+    KVTime end;
+    uint64_t lat = (uint64_t)(end - start);
+    uint64_t avg = writeLat_.load(std::memory_order_relaxed);
+    // racing updates may drop a sample, that is fine for a hint
+    avg = avg ? (avg * (WRITE_LAT_EWMA_WEIGHT - 1) + lat) / WRITE_LAT_EWMA_WEIGHT : lat;
+    writeLat_.store(avg, std::memory_order_relaxed);
+}
+
+bool Volume::IsGCRunning() {
+    return gcMgr_->IsRunning();
+}
+
+int Volume::GetQueueDepth() {
+    return bdev_->GetQueueDepth();
+}
+
 uint32_t Volume::GetCurSegId() {
     return segMgr_->GetNowSegId();
 }
@@ -101,8 +205,12 @@ void Volume::SortSegsByUtils(std::multimap<uint32_t, uint32_t> &cand_map, double
     return segMgr_->SortSegsByUtils(cand_map, utils);
 }
 
-void Volume::SortSegsByTS(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t max_seg_num) {
-    return segMgr_->SortSegsByTS(cand_map, max_seg_num);
+void Volume::SortSegsByHeat(std::vector<uint32_t> &cands, uint32_t max_seg_num) {
+    return segMgr_->SortSegsByHeat(cands, max_seg_num);
+}
+
+void Volume::DecayHeat() {
+    segMgr_->DecayHeat();
 }
 
 bool Volume::AllocForGC(uint32_t& seg_id) {
@@ -114,12 +222,45 @@ void Volume::FreeForFailed(uint32_t seg_id) {
 void Volume::FreeForGC(uint32_t seg_id) {
     return segMgr_->FreeForGC(seg_id);
 }
-void Volume::Use(uint32_t seg_id, uint32_t free_size) {
-    return segMgr_->Use(seg_id, free_size);
+void Volume::Use(uint32_t seg_id, uint32_t free_size, uint64_t timestamp,
+                 uint32_t gc_gen) {
+    return segMgr_->Use(seg_id, free_size, timestamp, gc_gen);
 }
 
 //////////////////////////////////////////////////
 
+void Volume::UpdateFreeSize(uint32_t seg_id, uint32_t free_size) {
+    segMgr_->UpdateFreeSize(seg_id, free_size);
+}
+
+uint64_t Volume::GetSegTimestamp(uint32_t seg_id) {
+    return segMgr_->GetTimestamp(seg_id);
+}
+
+uint32_t Volume::GetSegGeneration(uint32_t seg_id) {
+    return segMgr_->GetGeneration(seg_id);
+}
+
+uint32_t Volume::GetSegUsedSize(uint32_t seg_id) {
+    return segMgr_->GetUsedSize(seg_id);
+}
+
+void Volume::RecoverSeg(uint32_t seg_id, uint32_t free_size, uint64_t timestamp) {
+    segMgr_->Recover(seg_id, free_size, timestamp);
+}
+
+void Volume::SetSegLiveSize(uint32_t seg_id, uint64_t live_size) {
+    segMgr_->SetLiveSize(seg_id, live_size);
+}
+
+void Volume::Pin(uint32_t seg_id) {
+    segMgr_->Pin(seg_id);
+}
+
+void Volume::Unpin(uint32_t seg_id) {
+    segMgr_->Unpin(seg_id);
+}
+
 bool Volume::ForeGC() {
     return gcMgr_->ForeGC();
 }
@@ -177,6 +318,35 @@ void Volume::ModifyDeathEntry(HashEntry &entry) {
             + (uint32_t) IndexManager::SizeOfDataHeader();
 
     segMgr_->AddDeathSize(seg_id, death_size);
+    segMgr_->ClearLive(seg_id, (uint32_t) (offset & ((1ULL << segSizeBit_) - 1)));
+}
+
+void Volume::ModifyLiveEntry(HashEntry &entry) {
+    uint32_t seg_id;
+    uint64_t offset = entry.GetHeaderOffset();
+    if (!CalcSegIdFromOffset(offset, seg_id)) {
+        __ERROR("Calculate Seg Id Wrong!!! offset = %ld", offset);
+        return;
+    }
+    segMgr_->SetLive(seg_id, (uint32_t) (offset & ((1ULL << segSizeBit_) - 1)));
+}
+
+// Whether the index points at the record of entry, without a probe of
+// the index.
+bool Volume::IsLiveEntry(HashEntry &entry) {
+    uint32_t seg_id;
+    uint64_t offset = entry.GetHeaderOffset();
+    if (!CalcSegIdFromOffset(offset, seg_id)) {
+        return false;
+    }
+    return segMgr_->IsLive(seg_id, (uint32_t) (offset & ((1ULL << segSizeBit_) - 1)));
+}
+
+void Volume::AddReadHeat(HashEntry &entry) {
+    uint32_t seg_id;
+    if (CalcSegIdFromOffset(entry.GetHeaderOffset(), seg_id)) {
+        segMgr_->AddHeat(seg_id);
+    }
 }
 
 }// namespace hlkvds
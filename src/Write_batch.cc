@@ -16,7 +16,7 @@ void WriteBatch::put(const char *key, uint32_t key_len, const char* data,
 }
 
 void WriteBatch::del(const char *key, uint32_t key_len) {
-    KVSlice *slice = new KVSlice(key, key_len, NULL, 0);
+    KVSlice *slice = new KVSlice(key, key_len, NULL, 0, true);
     batch_.push_back(slice);
 }
 void WriteBatch::clear() {
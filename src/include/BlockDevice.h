@@ -25,11 +25,18 @@ public:
     virtual int GetPageSize() = 0;
     virtual int GetBlockSize() = 0;
 
+    // Number of segment writes worth keeping in flight on this device.
+    virtual int GetQueueDepth() = 0;
+    virtual void SetQueueDepth(int depth) = 0;
+
     virtual ssize_t pWrite(const void* buf, size_t count, off_t offset) = 0;
     virtual ssize_t pRead(void* buf, size_t count, off_t offset) = 0;
     virtual ssize_t pWritev(const struct iovec *iov, int iovcnt, off_t offset) = 0;
     virtual ssize_t pReadv(const struct iovec *iov, int iovcnt, off_t offset) = 0;
 
+    // Tell the device a range holds no data anymore.
+    virtual int Discard(off_t offset, size_t length) = 0;
+
     virtual void ClearReadCache() = 0;
 };
 }//namespace hlkvds
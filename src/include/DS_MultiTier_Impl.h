@@ -31,6 +31,7 @@ class SegForReq;
 
 class FastTier;
 class MediumTier;
+class FreqSketch;
 
 class DS_MultiTier_Impl : public DataStor {
 public:
@@ -69,7 +70,7 @@ public:
 
     Status WriteData(KVSlice& slice, bool immediately) override;
     Status WriteBatchData(WriteBatch *batch) override;
-    Status ReadData(KVSlice &slice, std::string &data) override;
+    Status ReadData(KVSlice &slice, std::string &data, ReadTier *tier) override;
 
     void ManualGC() override;
 
@@ -86,8 +87,11 @@ public:
     uint32_t GetTotalSegNum() override;
     uint64_t GetSSTsLengthOnDisk() override;
 
+    bool ReplaySegments(uint64_t since) override;
+
     // Called by IndexManager
     void ModifyDeathEntry(HashEntry &entry) override;
+    void ModifyLiveEntry(HashEntry &entry) override;
 
     // Called by Iterator
     std::string GetKeyByHashEntry(HashEntry *entry) override;
@@ -110,9 +114,29 @@ private:
 
     KVTime* lastTime_;
 
+    // Keys read often from MediumTier are written back to FastTier
+    FreqSketch *promoteSketch_;
+    std::atomic<uint64_t> promotedNum_;
+
 private:
     uint32_t getTotalFreeSegs();
     TierType locateTierFromEntry(HashEntry *entry);
+    void countMediumRead(KVSlice &slice, std::string &data);
+    void promote(KVSlice *slice);
+
+    // Promotion WorkQueue
+protected:
+    class PromoteWQ : public dslab::WorkQueue<KVSlice> {
+    public:
+        explicit PromoteWQ(DS_MultiTier_Impl *ds, int thd_num=1) : dslab::WorkQueue<KVSlice>(thd_num), ds_(ds) {}
+    protected:
+        void _process(KVSlice* slice) override {
+            ds_->promote(slice);
+        }
+    private:
+        DS_MultiTier_Impl *ds_;
+    };
+    PromoteWQ *promoteWQ_;
 
 };    
 
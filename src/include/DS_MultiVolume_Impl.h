@@ -13,6 +13,7 @@
 #include "hlkvds/Write_batch.h"
 #include "Utils.h"
 #include "Segment.h"
+#include "SegShardTable.h"
 #include "WorkQueue.h"
 
 namespace hlkvds {
@@ -72,7 +73,7 @@ public:
 
     Status WriteData(KVSlice& slice, bool immediately) override;
     Status WriteBatchData(WriteBatch *batch) override;
-    Status ReadData(KVSlice &slice, std::string &data) override;
+    Status ReadData(KVSlice &slice, std::string &data, ReadTier *tier) override;
 
     void ManualGC() override;
 
@@ -94,8 +95,11 @@ public:
         return sstLengthOnDisk_;
     }
 
+    bool ReplaySegments(uint64_t since) override;
+
     // Called by IndexManager
     void ModifyDeathEntry(HashEntry &entry) override;
+    void ModifyLiveEntry(HashEntry &entry) override;
 
     // Called by Iterator
     std::string GetKeyByHashEntry(HashEntry *entry) override;
@@ -134,11 +138,11 @@ private:
     IndexManager *idxMgr_;
 
     std::map<int, Volume *> volMap_;
+    // one append log for immediate writes per volume, indexed by vol id
+    std::vector<SegAppendLog *> logVec_;
 
     int shardsNum_;
-    std::mutex segMapMtx_;
-    std::map<int, SegForReq *> segMap_;
-    std::vector<std::mutex*> segMtxVec_;
+    SegShardTable *segShards_;
 
     KVTime* lastTime_;
 
@@ -183,7 +187,9 @@ protected:
     private:
         DS_MultiVolume_Impl *ds_;
     };
-    SegmentWriteWQ * segWteWQ_;
+    // one writer queue per volume, its threads match the device queue depth
+    std::vector<SegmentWriteWQ *> segWteWQVec_;
+    void addToSegWrite(SegForReq* seg);
     void SegWrite(SegForReq* req);
 
     // Seg Timeout thread
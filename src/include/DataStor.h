@@ -1,6 +1,7 @@
 #ifndef _HLKVDS_DATASTOR_H_
 #define _HLKVDS_DATASTOR_H_
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -22,6 +23,15 @@ class HashEntry;
 class Request;
 class SegForReq;
 
+// The tier a read was served from, SINGLE on a single-tier store.
+enum struct ReadTier {
+    SINGLE = 0,
+    FAST = 1,
+    MEDIUM = 2
+};
+
+#define READ_TIER_NUM 3
+
 class DataStor {
 public:
     DataStor() {}
@@ -40,7 +50,7 @@ public:
 
     virtual Status WriteData(KVSlice& slice, bool immediately) = 0;
     virtual Status WriteBatchData(WriteBatch *batch) =0;
-    virtual Status ReadData(KVSlice &slice, std::string &data) = 0;
+    virtual Status ReadData(KVSlice &slice, std::string &data, ReadTier *tier) = 0;
 
     virtual void ManualGC() = 0;
 
@@ -57,8 +67,13 @@ public:
     virtual uint32_t GetTotalSegNum() = 0;
     virtual uint64_t GetSSTsLengthOnDisk() = 0;
 
+    // Replay the segments stamped from sequence number since on into the
+    // index, after an unclean shutdown
+    virtual bool ReplaySegments(uint64_t since) = 0;
+
     // Called by IndexManager
     virtual void ModifyDeathEntry(HashEntry &entry) = 0;
+    virtual void ModifyLiveEntry(HashEntry &entry) = 0;
 
     // Called by Iterator
     virtual std::string GetKeyByHashEntry(HashEntry *entry) = 0;
@@ -2,6 +2,8 @@
 #define _HLKVDS_DB_STRUCTURE_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 
 namespace hlkvds {
 #define MAGIC_NUMBER 0xffff0001
@@ -13,14 +15,128 @@ namespace hlkvds {
 
 #define SEG_RESERVED_FOR_GC 2
 
+// free list capacity of every shard on the aggregated write path
+#define REQ_POOL_SIZE 64
+#define SEG_POOL_SIZE 4
+
+// size of the shared zero buffer the unused middle of a segment is written from
+#define ZERO_BUF_SIZE 64 * 1024
+
 //default Options
 #define SEGMENT_SIZE 256 * 1024
 #define EXPIRED_TIME 1000 // unit microseconds
 #define ALIGNED_SIZE 4096
+#define CACHE_LINE_SIZE 64
 
 #define SEG_WRITE_THREAD 10
+// segment writes kept in flight per device, seg_write_thread caps both
+#define HDD_QUEUE_DEPTH 2
+#define SSD_QUEUE_DEPTH 8
+
+// volume picking: weight of old samples in the write latency average,
+// cost factors for a volume under GC and one about to need ForeGC
+#define WRITE_LAT_EWMA_WEIGHT 8
+#define PICK_GC_PENALTY 4
+#define PICK_FULL_PENALTY 16
 #define SEG_FULL_RATE 0.9
+#define GC_POLICY_GREEDY 0
+#define GC_POLICY_COST_BENEFIT 1
+#define GC_POLICY 0 // 0:greedy 1:cost-benefit
+// GC candidates are kept in buckets by utilization. A round takes the
+// lowest GC_CANDS_MAX of them, cost-benefit scores up to GC_CB_SCAN_MAX.
+#define GC_GENERATIONS 2 // GC survivors: 1 stream per generation
+#define GC_UTIL_BUCKETS 64
+#define GC_CANDS_MAX 32
+#define GC_CB_SCAN_MAX 256
+// victims read in parallel, writers of full GC segments, and output
+// segments of one background GC round
+#define GC_LOAD_THREADS 4
+#define GC_WRITE_THREADS 2
+#define GC_ROUND_SEGS 4
+// GC reads a victim's header region from GC_HEAD_READ_SIZE on, doubling
+// it as needed, then only its live tail extents, merging extents less
+// than GC_READ_GAP apart
+#define GC_HEAD_READ_SIZE 4 * 1024
+#define GC_READ_GAP 8 * 1024
+
+// I/O scheduler: background I/O waits up to IO_BG_YIELD_US for reads in
+// flight, its token bucket holds IO_BG_BURST_US worth of its rate. The
+// read p99 is taken over IO_P99_SAMPLES reads or IO_P99_WINDOW_US, and
+// is too low to act on under IO_P99_FLOOR_US. Without fg_p99_target the
+// target is IO_P99_RISE times the p99 seen without background I/O.
+#define IO_SCHEDULER true
+#define BG_IO_RATE 0 // MB/s, 0 is unlimited
+#define FG_P99_TARGET 0 // us, 0 is relative to the idle p99
+#define IO_BG_YIELD_US 2000
+#define IO_BG_BURST_US 100000
+#define IO_BG_RATE_MIN (1ULL << 20)
+#define IO_BG_RATE_MAX (1ULL << 30)
+#define IO_P99_SAMPLES 1024
+#define IO_P99_SAMPLES_MIN 32
+#define IO_P99_WINDOW_US 1000000
+#define IO_P99_FLOOR_US 200
+#define IO_P99_RISE 2
 #define CAPACITY_THRESHOLD_TODO_GC 0.5
+// Freed segments are discarded on the device in batches of at most
+// DISCARD_BATCH_SEGS, one batch per DISCARD_INTERVAL_US.
+#define DISCARD_SEGMENTS true
+#define DISCARD_BATCH_SEGS 16
+#define DISCARD_INTERVAL_US 100000
+
+// FastTier migration starts over MIG_UPPER_LEVEL utilization and demotes
+// the coldest segments, at most MIG_CANDS_MAX a pass, until it is down to
+// MIG_LOWER_LEVEL. Read heat of segments halves every MIG_HEAT_DECAY_US.
+#define MIG_UPPER_LEVEL 0.7
+#define MIG_LOWER_LEVEL 0.5
+#define MIG_CANDS_MAX 32
+#define MIG_HEAT_DECAY_US 1000000
+#define MIG_INTERVAL_US 100000
+// FastTier segments read in parallel, writers of MediumTier segments, and
+// output segments of one background migration round
+#define MIG_LOAD_THREADS 4
+#define MIG_WRITE_THREADS 4
+#define MIG_ROUND_SEGS 8
+
+// A key read PROMOTE_THRESHOLD times from MediumTier, as counted by a
+// sketch of PROMOTE_SKETCH_ROWS x PROMOTE_SKETCH_WIDTH counters, is
+// written back to FastTier by PROMOTE_THREADS, at most PROMOTE_QUEUE_MAX
+// keys waiting. The sketch halves its counters every PROMOTE_SKETCH_AGE
+// x PROMOTE_SKETCH_WIDTH reads.
+#define PROMOTE_THRESHOLD 4 // 0 disables promotion
+#define PROMOTE_SKETCH_WIDTH 65536
+#define PROMOTE_SKETCH_ROWS 4
+#define PROMOTE_SKETCH_AGE 8
+#define PROMOTE_QUEUE_MAX 256
+#define PROMOTE_THREADS 4
+
+// Values of DIRECT_MEDIUM_SIZE bytes or more, and values inserted as
+// cold, are written straight to MediumTier. 0 keeps every value on
+// FastTier unless it is tagged cold.
+#define DIRECT_MEDIUM_SIZE 32768
+
+// Crash recovery scans the segments of each volume with
+// REPLAY_SCAN_THREADS threads, reading a segment's header region from
+// REPLAY_HEAD_READ_SIZE on and doubling it as needed.
+#define REPLAY_SCAN_THREADS 4
+#define REPLAY_HEAD_READ_SIZE 4 * 1024
+
+// The index and the SSTs are checkpointed every CHECKPOINT_INTERVAL
+// seconds (0 only at close) into the two halves of the checkpoint
+// region. A delta larger than 1/CKPT_DELTA_RATIO of a half is written
+// as a full checkpoint instead.
+#define CKPT_MAGIC 0x434b5054
+#define CHECKPOINT_INTERVAL 60
+#define CKPT_DELTA_RATIO 2
+
+// An index image is read INDEX_READ_CHUNK bytes at a time by one thread,
+// while INDEX_LOAD_THREADS fill the hash table INDEX_LOAD_RANGE slots at
+// a time from the chunks read. With LAZY_OPEN a range is also the slice
+// read when a request needs a range not loaded yet.
+#define INDEX_READ_CHUNK (4 * 1024 * 1024)
+#define INDEX_LOAD_THREADS 4
+#define INDEX_LOAD_RANGE (4 * 1024)
+#define LAZY_OPEN false
+
 #define GC_UPPER_LEVEL 0.3
 #define GC_LOWER_LEVEL 0.1
 
@@ -30,7 +146,6 @@ namespace hlkvds {
 #define ERROR
 
 #ifdef DEBUG
-#include <pthread.h>
 #define __DEBUG(x...) do {                                    \
         fprintf(stderr,"[DEBUG] [Pid:%ld] %s (%s:%d) : ",(uint64_t)pthread_self(), __FUNCTION__, __FILE__,__LINE__); \
         fprintf(stderr,##x);             \
@@ -41,7 +156,6 @@ namespace hlkvds {
 #endif
 
 #ifdef INFO
-#include <pthread.h>
 #define __INFO(x...) do {                                    \
         fprintf(stderr,"[INFO]  [Pid:%ld] %s (%s:%d) : ",(uint64_t)pthread_self(), __FUNCTION__, __FILE__,__LINE__); \
         fprintf(stderr,##x);             \
@@ -52,7 +166,6 @@ namespace hlkvds {
 #endif
 
 #ifdef WARN
-#include <pthread.h>
 #define __WARN(x...) do {                                    \
         fprintf(stderr,"[WARN]  [Pid:%ld] %s (%s:%d) : ",(uint64_t)pthread_self(), __FUNCTION__, __FILE__,__LINE__); \
         fprintf(stderr,##x);             \
@@ -63,7 +176,6 @@ namespace hlkvds {
 #endif
 
 #ifdef ERROR
-#include <pthread.h>
 #define __ERROR(x...) do {                                    \
         fprintf(stderr,"[ERROR] [Pid:%ld] %s (%s:%d) : ",(uint64_t)pthread_self(), __FUNCTION__, __FILE__,__LINE__); \
         fprintf(stderr,##x);             \
@@ -0,0 +1,39 @@
+#ifndef _HLKVDS_FREQSKETCH_H_
+#define _HLKVDS_FREQSKETCH_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+namespace hlkvds {
+
+class Kvdb_Digest;
+
+// Count-min sketch of key accesses, a few saturating counters per key
+// in as many rows, indexed by different words of the key digest. Once
+// width * PROMOTE_SKETCH_AGE accesses are counted all counters are
+// halved, so the estimate follows recent accesses.
+class FreqSketch {
+public:
+    explicit FreqSketch(uint32_t width);
+    ~FreqSketch();
+
+    // Count one access, return the new estimate for the key.
+    uint32_t Add(const Kvdb_Digest &digest);
+
+private:
+    FreqSketch(const FreqSketch &);
+    FreqSketch& operator=(const FreqSketch &);
+
+    void age();
+
+    uint32_t mask_;
+    std::vector<uint8_t> counters_;
+    uint64_t adds_;
+    uint64_t ageAdds_;
+    std::mutex mtx_;
+};
+
+}// namespace hlkvds
+
+#endif //#ifndef _HLKVDS_FREQSKETCH_H_
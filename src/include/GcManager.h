@@ -3,16 +3,23 @@
 
 #include <sys/types.h>
 #include <mutex>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <deque>
+#include <atomic>
+#include <vector>
 
 #include "hlkvds/Options.h"
+#include "WorkQueue.h"
+#include "IoScheduler.h"
 
 namespace hlkvds {
 
 class IndexManager;
 class Volume;
 class KVSlice;
+class SegForSlice;
 
 class GcManager {
 public:
@@ -23,14 +30,105 @@ public:
     void BackGC();
     void FullGC();
 
+    bool IsRunning() const {
+        return running_.load(std::memory_order_relaxed);
+    }
+
+    // Live bytes copied by GC on all volumes, the write amplification
+    // is (user bytes + relocated bytes) / user bytes.
+    static uint64_t GetRelocatedBytes() {
+        return relocatedBytes_.load(std::memory_order_relaxed);
+    }
+
+    // Bytes read from victim segments by GC on all volumes.
+    static uint64_t GetReadBytes() {
+        return readBytes_.load(std::memory_order_relaxed);
+    }
+
 private:
-    uint32_t doMerge(std::multimap<uint32_t, uint32_t> &cands_map);
+    // Survivors are written by generation: records copied out of a
+    // segment of generation g go to the stream of generation g + 1,
+    // capped at options_.gc_generations. Data that keeps surviving GC
+    // gathers in cold segments that stay full, apart from fresh writes
+    // (generation 0).
+    struct GcStream {
+        SegForSlice *seg;
+        uint64_t timestamp;
+        uint64_t bytes;
+        std::list<KVSlice*> slices;
+        std::vector<uint32_t> victims;
+
+        GcStream() : seg(NULL), timestamp(0), bytes(0) {}
+    };
+
+    // A merge round is a pipeline: up to GC_LOAD_THREADS victims are read
+    // and filtered for live records in parallel, while full output
+    // segments are written and indexed by the write queue.
+    struct GcLoadTask {
+        uint32_t seg_id;
+        uint32_t gen;
+        uint32_t live_size;
+        char *buf;
+        bool ok;
+        bool done;
+        std::atomic<bool> skip;
+        std::list<KVSlice*> slices;
+
+        GcLoadTask(uint32_t id, char *b) :
+            seg_id(id), gen(0), live_size(0), buf(b), ok(false), done(false), skip(false) {}
+    };
+
+    struct GcWriteTask {
+        SegForSlice *seg;
+        uint32_t seg_id;
+        uint32_t gen;
+        uint64_t timestamp;
+        uint64_t bytes;
+        std::list<KVSlice*> slices;
+        std::vector<uint32_t> victims;
+    };
 
-    void loadSegKV(std::list<KVSlice*> &slice_list, uint32_t num_keys,
-                   uint64_t phy_offset);
+    class GcLoadWQ : public dslab::WorkQueue<GcLoadTask> {
+    public:
+        explicit GcLoadWQ(GcManager *gc, int thd_num=1) : dslab::WorkQueue<GcLoadTask>(thd_num), gc_(gc) {}
+    protected:
+        void _process(GcLoadTask* task) override {
+            gc_->loadTask(task);
+        }
+    private:
+        GcManager *gc_;
+    };
 
-    bool loadKvList(uint32_t seg_id, std::list<KVSlice*> &slice_list);
+    class GcWriteWQ : public dslab::WorkQueue<GcWriteTask> {
+    public:
+        explicit GcWriteWQ(GcManager *gc, int thd_num=1) : dslab::WorkQueue<GcWriteTask>(thd_num), gc_(gc) {}
+    protected:
+        void _process(GcWriteTask* task) override {
+            gc_->writeTask(task);
+        }
+    private:
+        GcManager *gc_;
+    };
+
+    // max_flush bounds the output segments of one round, ForeGC keeps
+    // it at 1 so a writer waits for a single segment only.
+    uint32_t doMerge(std::multimap<uint32_t, uint32_t> &cands_map, uint32_t max_flush);
+    uint32_t mergeSegs(std::multimap<uint32_t, uint32_t> &cands_map, uint32_t max_flush);
+    uint32_t flushStreams();
+    bool flushStream(GcStream &stream, uint32_t gen);
+    uint32_t waitWrites();
+
+    void loadTask(GcLoadTask *task);
+    void writeTask(GcWriteTask *task);
+    void waitLoad(GcLoadTask *task);
+
+    bool loadSegKV(char *buf, std::list<KVSlice*> &slice_list, uint32_t num_keys,
+                   uint64_t phy_offset, uint32_t read_end);
+    bool readSegRange(char *buf, uint64_t phy_offset, uint32_t begin, uint32_t end);
+
+    bool loadKvList(uint32_t seg_id, char *buf, std::list<KVSlice*> &slice_list);
     void cleanKvList(std::list<KVSlice*> &slice_list);
+    static uint64_t sizeOfSlice(KVSlice *slice);
 
 private:
     Volume* vol_;
@@ -38,8 +136,22 @@ private:
     Options &options_;
 
     std::mutex gcMtx_;
+    std::atomic<bool> running_;
+    // class of the current round's I/O, set under gcMtx_
+    IoClass ioClass_;
+
+    std::vector<char *> loadBufs_;
+    std::vector<GcStream> streams_;
+
+    GcLoadWQ *loadWQ_;
+    GcWriteWQ *writeWQ_;
+    std::mutex taskMtx_;
+    std::condition_variable taskCv_;
+    uint32_t pendingWrites_;
+    int32_t roundFree_;
 
-    char *dataBuf_;
+    static std::atomic<uint64_t> relocatedBytes_;
+    static std::atomic<uint64_t> readBytes_;
 };
 
 }//namespace hlkvds
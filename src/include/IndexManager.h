@@ -5,6 +5,11 @@
 #include <sys/time.h>
 #include <mutex>
 #include <list>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <condition_variable>
 
 #include "hlkvds/Options.h"
 #include "Utils.h"
@@ -19,6 +24,7 @@ namespace hlkvds {
 class SuperBlockManager;
 class KVSlice;
 class DataStor;
+class BlockDevice;
 
 class DataHeader {
 private:
@@ -27,11 +33,13 @@ private:
     uint16_t data_size;
     uint32_t data_offset;
     uint32_t next_header_offset;
+    // sequence number of the write, a GC copy keeps that of the original
+    uint64_t lsn;
 
 public:
     DataHeader();
     DataHeader(const Kvdb_Digest &digest, uint16_t key_len, uint16_t data_len,
-               uint32_t data_offset, uint32_t next_header_offset);
+               uint32_t data_offset, uint32_t next_header_offset, uint64_t lsn);
 
     ~DataHeader();
 
@@ -47,6 +55,9 @@ public:
     uint32_t GetNextHeadOffset() const {
         return next_header_offset;
     }
+    uint64_t GetLsn() const {
+        return lsn;
+    }
     Kvdb_Digest GetDigest() const {
         return key_digest;
     }
@@ -128,6 +139,9 @@ public:
     uint32_t GetNextHeadOffsetInSeg() const {
         return header.GetNextHeadOffset();
     }
+    uint64_t GetLsn() const {
+        return header.GetLsn();
+    }
     Kvdb_Digest GetKeyDigest() const {
         return header.GetDigest();
     }
@@ -139,68 +153,12 @@ public:
 
 }__attribute__((__packed__));
 
+// The entry of a key in the index. Of two entries of a key, the one
+// with the higher sequence number is the newer write.
 class HashEntry {
 public:
-    class LogicStamp {
-    private:
-        KVTime segTime_;
-        int32_t keyNo_;
-    public:
-        LogicStamp() :
-            segTime_(KVTime()), keyNo_(0) {
-        }
-        LogicStamp(KVTime seg_time, int32_t key_no) :
-            segTime_(seg_time), keyNo_(key_no) {
-        }
-        LogicStamp(const LogicStamp& toBeCopied) {
-            segTime_ = toBeCopied.segTime_;
-            keyNo_ = toBeCopied.keyNo_;
-        }
-        ~LogicStamp() {
-        }
-        LogicStamp& operator=(const LogicStamp& toBeCopied) {
-            segTime_ = toBeCopied.segTime_;
-            keyNo_ = toBeCopied.keyNo_;
-            return *this;
-        }
-
-        bool operator<(const LogicStamp& toBeCopied) {
-            if ((segTime_ < toBeCopied.segTime_) || (segTime_
-                    == toBeCopied.segTime_ && (keyNo_ < toBeCopied.keyNo_))) {
-                return true;
-            }
-            return false;
-        }
-
-        bool operator>(const LogicStamp& toBeCopied) {
-            if ((segTime_ > toBeCopied.segTime_) || (segTime_
-                    == toBeCopied.segTime_ && (keyNo_ > toBeCopied.keyNo_))) {
-                return true;
-            }
-            return false;
-        }
-
-        bool operator==(const LogicStamp& toBeCopied) {
-            return ((segTime_ == toBeCopied.segTime_) && (keyNo_
-                    == toBeCopied.keyNo_));
-        }
-
-        KVTime& GetSegTime() {
-            return segTime_;
-        }
-
-        int32_t GetKeyNo() {
-            return keyNo_;
-        }
-
-        void Set(KVTime seg_time, int32_t seg_key_no) {
-            segTime_ = seg_time;
-            keyNo_ = seg_key_no;
-        }
-    };
-
     HashEntry();
-    HashEntry(HashEntryOnDisk& entry_ondisk, KVTime time_stamp, void* read_ptr);
+    HashEntry(HashEntryOnDisk& entry_ondisk, void* read_ptr);
     HashEntry(DataHeader& data_header, DataHeaderAddress& addrs, void* read_ptr);
     HashEntry(const HashEntry&);
     ~HashEntry();
@@ -234,6 +192,10 @@ public:
         return entryPtr_->GetNextHeadOffsetInSeg();
     }
 
+    uint64_t GetLsn() const {
+        return entryPtr_->GetLsn();
+    }
+
     void* GetReadCachePtr() const {
         return cachePtr_;
     }
@@ -246,20 +208,48 @@ public:
         return *entryPtr_;
     }
 
-    LogicStamp* GetLogicStamp() {
-        return stampPtr_;
-    }
-
     void SetKeyDigest(const Kvdb_Digest& digest);
-    void SetLogicStamp(KVTime seg_time, int32_t seg_key_no);
 
 private:
     HashEntryOnDisk *entryPtr_;
-    LogicStamp *stampPtr_;
     void* cachePtr_;
 
 };
 
+// Bytes of an index image read into memory so far, so that the hash
+// table is filled while the rest is read.
+class IndexLoadProgress {
+public:
+    IndexLoadProgress() : loaded_(0), failed_(false) {}
+
+    void Advance(uint64_t loaded) {
+        std::lock_guard<std::mutex> l(mtx_);
+        loaded_ = loaded;
+        cv_.notify_all();
+    }
+    void Fail() {
+        std::lock_guard<std::mutex> l(mtx_);
+        failed_ = true;
+        cv_.notify_all();
+    }
+    bool Failed() {
+        std::lock_guard<std::mutex> l(mtx_);
+        return failed_;
+    }
+    // Wait for the first bytes of the image, false if its read failed.
+    bool WaitFor(uint64_t bytes) {
+        std::unique_lock<std::mutex> l(mtx_);
+        cv_.wait(l, [this, bytes] { return failed_ || loaded_ >= bytes; });
+        return !failed_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    uint64_t loaded_;
+    bool failed_;
+};
+
 class IndexManager{
 public:
     static inline size_t SizeOfDataHeader() {
@@ -278,7 +268,25 @@ public:
     void InitMeta(uint32_t ht_size, uint64_t ondisk_size, uint64_t data_theory_size, uint32_t element_num);
     void UpdateMetaToSB();
     bool Get(char* buff, uint64_t length);
-    bool Set(char* buff, uint64_t length);
+    // With progress, the image is still being read into buff.
+    bool Set(char* buff, uint64_t length, IndexLoadProgress *progress = NULL);
+    // Read the image at offset and Set it while it is read.
+    bool Load(BlockDevice *bdev, int64_t offset, uint64_t length);
+    // Read only the counter table of the image at offset. The ranges of
+    // slots are read from the image when first needed, or by the thread
+    // of StartThds.
+    bool LoadLazy(BlockDevice *bdev, int64_t offset, uint64_t length);
+    // Load the ranges of slots left, false on a read failure.
+    bool LoadAll();
+
+    // Checkpoints of the index, taken slot by slot while it is updated.
+    // A full one has the layout of Get and is loaded by Set, a delta
+    // holds the slots changed since the last full one. Both are stamped
+    // with since, the sequence number the segments are replayed from.
+    // used is set to the bytes taken, false if they would exceed length.
+    bool GetCheckpoint(char* buff, uint64_t length, bool full, uint64_t since,
+                       uint64_t &used, uint32_t &entry_num);
+    bool ApplyCheckpoint(char* buff, uint64_t length);
 
     void InitDataStor(DataStor *ds);
 
@@ -286,8 +294,41 @@ public:
     void UpdateIndexes(std::list<KVSlice*> &slice_list);
     bool GetHashEntry(KVSlice *slice);
     void RemoveEntry(HashEntry entry);
+    // Drop the entry of a key whose record is gone, found by recovery.
+    void DropEntry(HashEntry entry);
 
     void UpdateIndexesForGC(std::list<KVSlice*> &slice_list);
+    void MarkLiveEntries();
+
+    // Segments stamped with this sequence number or a later one are
+    // replayed into the index after a crash. It is the stamp of the
+    // index image on the device.
+    uint64_t GetReplayStart() const {
+        return replayStart_.load();
+    }
+    void SetReplayStart(uint64_t since) {
+        replayStart_.store(since);
+    }
+    // Whether GC and migration must copy a tombstone: a crash replay
+    // would otherwise bring back the value it deleted. That is while the
+    // index still points at it or no longer holds the key at all.
+    bool KeepTombstone(HashEntry &entry);
+
+    // Sequence numbers of writes, persisted in the records and segment
+    // headers. AllocLsn reserves num consecutive ones and returns the
+    // first, GetLsn is the next to be handed out. AdvanceLsn makes sure
+    // none below lsn is handed out again after an open.
+    uint64_t AllocLsn(uint32_t num) {
+        return nextLsn_.fetch_add(num);
+    }
+    uint64_t GetLsn() const {
+        return nextLsn_.load();
+    }
+    void AdvanceLsn(uint64_t lsn) {
+        uint64_t next = nextLsn_.load();
+        while (next < lsn && !nextLsn_.compare_exchange_weak(next, lsn)) {
+        }
+    }
 
     uint32_t GetHashTableSize() const {
         return htSize_;
@@ -310,6 +351,7 @@ public:
     bool IsSameInMem(HashEntry &entry);
 
     LinkedList<HashEntry>* GetEntryListByNo(uint32_t no) {
+        ensureLoaded(no);
         return hashtable_[no].entryList_;
     }
 public:
@@ -331,8 +373,23 @@ private:
 
     void initHashTable();
     void destroyHashTable();
+    bool calcRangeOffsets(char *counters, uint64_t length, std::vector<uint64_t> &range_offset,
+                          uint32_t &entry_num);
+    uint64_t loadSlots(char *counters, char *entries, uint32_t first, uint32_t last, bool mark_live);
+    bool loadRange(uint32_t range);
+    // Must not hold the slot lock.
+    bool ensureLoaded(uint32_t slot) {
+        return !rangesLeft_.load(std::memory_order_acquire) || loadRange(slot / INDEX_LOAD_RANGE);
+    }
+    void LazyLoadThdEntry();
+    // Must hold the slot lock.
+    void markDirty(uint32_t slot) {
+        dirtySlots_[slot / 64].fetch_or(1ULL << (slot % 64), std::memory_order_relaxed);
+    }
 
     HashtableSlot *hashtable_;
+    // one bit per slot changed since the last full checkpoint
+    std::atomic<uint64_t> *dirtySlots_;
     uint32_t htSize_;
     uint64_t sizeOndisk_;
     uint32_t keyCounter_;
@@ -341,10 +398,27 @@ private:
     DataStor* dataStor_;
     Options &options_;
 
-    KVTime* lastTime_;
+    std::atomic<uint64_t> nextLsn_;
+    std::atomic<uint64_t> replayStart_;
     mutable std::mutex mtx_;
     std::mutex batch_mtx_;
 
+    // lazy load: the counter table of the image on lazyDev_, where the
+    // entries of each range of slots start and which ranges are loaded
+    BlockDevice *lazyDev_;
+    int64_t lazyOffset_;
+    char *lazyCounters_;
+    std::vector<uint64_t> rangeOffset_;
+    std::atomic<bool> *rangeLoaded_;
+    std::mutex *rangeMtx_;
+    std::atomic<uint32_t> rangesLeft_;
+    // slots of a delta checkpoint, at their counter in lazyDelta_, that
+    // replace those of the image as their ranges load
+    char *lazyDelta_;
+    std::unordered_map<uint32_t, uint64_t> deltaSlots_;
+    std::thread lazyT_;
+    std::atomic<bool> lazyT_stop_;
+
 // Seg Reaper thread
 private:
     class SegmentReaperWQ : public dslab::WorkQueue<SegForReq> {
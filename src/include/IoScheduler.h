@@ -0,0 +1,81 @@
+#ifndef _HLKVDS_IOSCHEDULER_H_
+#define _HLKVDS_IOSCHEDULER_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+
+#include "hlkvds/Options.h"
+#include "Utils.h"
+
+namespace hlkvds {
+
+// Priority classes of device I/O, highest first. GC and migration that
+// a writer waits for (ForeGC, ForeMigrate) are foreground writes.
+enum struct IoClass {
+    FG_READ = 0,
+    FG_WRITE = 1,
+    BACKGROUND = 2
+};
+
+#define IO_CLASS_NUM 3
+
+// Admission of the I/O of one device. At most queue depth requests are
+// issued at a time and a free slot goes to the highest class waiting.
+// Background I/O also lets in-flight reads drain first and is paced by
+// a token bucket, whose rate is cut while the foreground read p99 is
+// above target (options.fg_p99_target, or twice the p99 seen while no
+// background I/O ran) and raised again once it recovers.
+class IoScheduler {
+public:
+    IoScheduler(Options &opts, int queue_depth);
+    ~IoScheduler();
+
+    void Begin(IoClass cls, uint64_t bytes);
+    void End(IoClass cls, KVTime &start);
+
+    // Current background budget in bytes per second, 0 for unlimited.
+    uint64_t GetBgRate();
+    // Foreground read p99 of the last full window, in microseconds.
+    uint64_t GetReadP99();
+
+private:
+    IoScheduler(const IoScheduler &);
+    IoScheduler& operator=(const IoScheduler &);
+
+    bool canIssue(IoClass cls, bool yielded);
+    void waitTokens(uint64_t bytes);
+    void refillTokens(int64_t now);
+    void recordRead(uint64_t lat_us, int64_t now);
+    void adjustRate(uint64_t p99, int64_t now);
+    int64_t nowUs();
+
+    Options &options_;
+    int depth_;
+    bool enabled_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    int inflight_[IO_CLASS_NUM];
+    int waiting_[IO_CLASS_NUM];
+
+    // token bucket of background bytes, rate 0 is unlimited
+    uint64_t cfgRate_;
+    uint64_t rate_;
+    double tokens_;
+    int64_t lastRefill_;
+
+    // log2 histogram of foreground read latencies in microseconds
+    uint64_t latHist_[64];
+    uint64_t latCount_;
+    uint64_t p99_;
+    uint64_t idleP99_;
+    uint64_t bgBytes_;
+    int64_t windowStart_;
+
+    KVTime base_;
+};
+
+}// namespace hlkvds
+
+#endif //#ifndef _HLKVDS_IOSCHEDULER_H_
@@ -4,6 +4,7 @@
 #include <string>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "BlockDevice.h"
 
@@ -31,6 +32,12 @@ public:
     int GetBlockSize() {
         return blockSize_;
     }
+    int GetQueueDepth() {
+        return queueDepth_;
+    }
+    void SetQueueDepth(int depth) {
+        queueDepth_ = depth;
+    }
 
     std::string GetDevicePath() { return path_; };
 
@@ -39,18 +46,23 @@ public:
     ssize_t pWritev(const struct iovec *iov, int iovcnt, off_t offset);
     ssize_t pReadv(const struct iovec *iov, int iovcnt, off_t offset);
 
+    int Discard(off_t offset, size_t length);
+
 private:
     int directFd_;
     int bufFd_;
     uint64_t capacity_;
     int blockSize_;
+    int queueDepth_;
     std::string path_;
     bool isOpen_;
+    bool isBlkDev_;
 
     int set_device_zero();
     int fill_file_with_zeros();
     uint64_t get_block_device_capacity();
     int lock_device();
+    bool is_rotational(struct stat &statbuf);
 
     ssize_t DirectWriteAligned(const void* buf, size_t count, off_t offset);
 
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 #include "hlkvds/Options.h"
 #include "hlkvds/Status.h"
@@ -10,6 +11,7 @@
 #include "hlkvds/Iterator.h"
 
 #include "ReadCache.h"
+#include "DataStor.h"
 
 namespace hlkvds {
 
@@ -19,7 +21,6 @@ class BlockDevice;
 class SuperBlockManager;
 class IndexManager;
 class MetaStor;
-class DataStor;
 
 class KVDS {
 public:
@@ -27,7 +28,7 @@ public:
     static KVDS* Open_KVDS(const char* filename, Options opts);
 
     Status Insert(const char* key, uint32_t key_len, const char* data,
-                  uint16_t length, bool immediately = false);
+                  uint16_t length, bool immediately = false, bool cold = false);
     Status Get(const char* key, uint32_t key_len, std::string &data);
     Status Delete(const char* key, uint32_t key_len);
 
@@ -51,6 +52,9 @@ private:
     bool openAllDevices(std::string paths);
     void closeAllDevices();
 
+    bool cacheAdmits(ReadTier tier);
+    ReadTier cachedTier();
+
 private:
     std::string paths_;
 
@@ -58,6 +62,9 @@ private:
     IndexManager* idxMgr_;
 
     dslab::ReadCache* rdCache_;// readcache, rmd160, slru/lru
+    // per tier, a hit counts under the tier its value was read from
+    std::atomic<uint64_t> cacheHits_[READ_TIER_NUM];
+    std::atomic<uint64_t> cacheMisses_[READ_TIER_NUM];
 
     MetaStor *metaStor_;
     DataStor *dataStor_;
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <vector>
+#include <utility>
 
 namespace hlkvds {
 
@@ -17,6 +18,10 @@ public:
         data(value), next(nd) {
     }
     ;
+    template<typename... Args>
+    Node(Node<T>* nd, Args&&... args) :
+        data(std::forward<Args>(args)...), next(nd) {
+    }
 };
 
 template<typename T>
@@ -33,6 +38,9 @@ public:
     //if put T is existed, return false
     bool put(T& toBePuted);
     bool remove(T& toBeRemoved);
+    //put T built in place at the head, T must not be in the list yet
+    template<typename... Args>
+    T& putFront(Args&&... args);
 
     T* getRef(T toBeGeted);
     std::vector<T> get();
@@ -145,6 +153,14 @@ bool LinkedList<T>::put(T& toBePuted) {
     return is_new;
 }
 
+template<typename T>
+template<typename... Args>
+T& LinkedList<T>::putFront(Args&&... args) {
+    head_ = new Node<T> (head_, std::forward<Args>(args)...);
+    size_++;
+    return head_->data;
+}
+
 template<typename T>
 bool LinkedList<T>::remove(T& toBeRemoved) {
     bool flag = false;
@@ -3,6 +3,10 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "hlkvds/Options.h"
 
@@ -13,6 +17,20 @@ class SuperBlockManager;
 class IndexManager;
 class DataStor;
 
+// Header of a checkpoint, the first page of its half of the checkpoint
+// region. It is written last, so a torn checkpoint has none.
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t full;
+    uint64_t seq;
+    uint64_t base_seq;  // seq of the full checkpoint a delta applies to
+    uint64_t since;     // segments stamped with this sequence number on are replayed
+    uint64_t index_length;
+    uint64_t sst_length;
+    uint32_t entry_num;
+    uint32_t reserved;
+};
+
 class MetaStor {
 public:
     bool TryLoadSB(int &datastor_type);
@@ -25,6 +43,14 @@ public:
     bool PersistSSTsToDevice();
     bool FastRecovery();
 
+    // Write the index and the SSTs into the checkpoint region, as a delta
+    // of the last full checkpoint while it is small enough. A final
+    // checkpoint is taken with no writes in flight.
+    bool Checkpoint(bool final = false);
+
+    void StartThds();
+    void StopThds();
+
     MetaStor(const char* paths, std::vector<BlockDevice*> &dev_vec, SuperBlockManager *sbm, IndexManager *im, Options &opt);
     ~MetaStor();
 
@@ -36,7 +62,15 @@ private:
     bool createDataStor();
     bool loadSuperBlock();
     bool loadIndex(uint32_t ht_size, uint64_t index_size);
-    bool loadDataStor();
+    bool loadDataStor(char *sst_image = NULL);
+    bool loadCheckpoint(uint32_t ht_size, uint64_t index_size);
+    bool readCheckpointHeader(int half, CheckpointHeader &header);
+    bool readCheckpointPayload(int half, CheckpointHeader &header, char *&payload);
+    bool writeCheckpoint(int half, CheckpointHeader &header, char *buff, uint64_t length);
+    uint64_t calcCheckpointLength(uint64_t index_size);
+    bool updateSBReservedContent();
+
+    void CheckpointThdEntry();
 
     bool persistSuperBlockToDevice();
 
@@ -56,6 +90,24 @@ private:
     int64_t sbOff_;
     int64_t idxOff_;
     int64_t sstOff_;
+
+    // two halves of ckptLen_ bytes from idxOff_, 0 for a store whose
+    // index is persisted in place at close
+    uint64_t ckptLen_;
+    uint64_t ckptSeq_;
+    uint64_t ckptFullSeq_;
+    int ckptFullHalf_;
+    uint64_t ckptFullSince_;
+    uint64_t ckptStart_;
+    bool ckptForceFull_;
+    // SST image of the full checkpoint, deltas hold the pages changed
+    char *ckptSst_;
+    std::mutex ckptMtx_;
+
+    std::thread ckptT_;
+    std::atomic<bool> ckptT_stop_;
+    std::mutex ckptThdMtx_;
+    std::condition_variable ckptCv_;
 };
     
 }// namespace hlkvds
@@ -3,10 +3,15 @@
 
 #include <sys/types.h>
 #include <mutex>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <atomic>
+#include <vector>
 
 #include "hlkvds/Options.h"
+#include "WorkQueue.h"
+#include "IoScheduler.h"
 
 namespace hlkvds {
 
@@ -15,23 +20,81 @@ class Volume;
 class FastTier;
 class MediumTier;
 class KVSlice;
+class SegForMigrate;
 
 class Migrate {
 public:
     ~Migrate();
     Migrate(IndexManager* im, FastTier* ft, MediumTier* mt, Options &opt);
 
-    uint32_t ForeMigrate(uint32_t mt_vol_id);
-    uint32_t BackMigrate(uint32_t mt_vol_id);
+    // Output segments are striped over the MediumTier volumes in the
+    // order of MediumTier::PickVolForMigrate.
+    uint32_t ForeMigrate();
+    uint32_t BackMigrate();
 
 private:
-    void loadSegKV(std::list<KVSlice*> &slice_list, uint32_t num_keys,
+    // A migration round is a pipeline: up to MIG_LOAD_THREADS FastTier
+    // segments are read in parallel, while full MediumTier segments are
+    // written and indexed by the write queue. A FastTier segment always
+    // moves into a single output segment and is freed once it is written.
+    struct MigLoadTask {
+        uint32_t seg_id;
+        char *buf;
+        bool ok;
+        bool done;
+        std::atomic<bool> skip;
+        std::list<KVSlice*> slices;
+
+        MigLoadTask(uint32_t id, char *b) :
+            seg_id(id), buf(b), ok(false), done(false), skip(false) {}
+    };
+
+    struct MigWriteTask {
+        SegForMigrate *seg;
+        Volume *vol;
+        uint32_t seg_id;
+        std::list<KVSlice*> slices;
+        std::vector<uint32_t> victims;
+    };
+
+    class MigLoadWQ : public dslab::WorkQueue<MigLoadTask> {
+    public:
+        explicit MigLoadWQ(Migrate *mig, int thd_num=1) : dslab::WorkQueue<MigLoadTask>(thd_num), mig_(mig) {}
+    protected:
+        void _process(MigLoadTask* task) override {
+            mig_->loadTask(task);
+        }
+    private:
+        Migrate *mig_;
+    };
+
+    class MigWriteWQ : public dslab::WorkQueue<MigWriteTask> {
+    public:
+        explicit MigWriteWQ(Migrate *mig, int thd_num=1) : dslab::WorkQueue<MigWriteTask>(thd_num), mig_(mig) {}
+    protected:
+        void _process(MigWriteTask* task) override {
+            mig_->writeTask(task);
+        }
+    private:
+        Migrate *mig_;
+    };
+
+    void loadSegKV(char *buf, std::list<KVSlice*> &slice_list, uint32_t num_keys,
                    uint64_t phy_offset);
 
-    bool loadKvList(uint32_t seg_id, std::list<KVSlice*> &slice_list);
+    bool loadKvList(uint32_t seg_id, char *buf, std::list<KVSlice*> &slice_list);
     void cleanKvList(std::list<KVSlice*> &slice_list);
 
-    uint32_t doMigrate(uint32_t mt_vol_id, uint32_t max_seg_num);
+    // max_flush bounds the output segments of one round, ForeMigrate
+    // keeps it at one per volume so a writer waits for a single stripe.
+    uint32_t doMigrate(uint32_t max_seg_num, uint32_t max_flush, IoClass cls);
+    SegForMigrate* openSeg();
+    bool flushSeg(MigWriteTask *task);
+    uint32_t waitWrites();
+
+    void loadTask(MigLoadTask *task);
+    void writeTask(MigWriteTask *task);
+    void waitLoad(MigLoadTask *task);
 
 private:
     FastTier *ft_;
@@ -40,9 +103,18 @@ private:
     Options &options_;
 
     std::mutex mtx_;
+    // class of the current round's I/O, set under mtx_
+    IoClass ioClass_;
 
-    char *ftDataBuf_;
     uint32_t ftSegSize_;
+    std::vector<char *> loadBufs_;
+
+    MigLoadWQ *loadWQ_;
+    MigWriteWQ *writeWQ_;
+    std::mutex taskMtx_;
+    std::condition_variable taskCv_;
+    uint32_t pendingWrites_;
+    uint32_t roundFree_;
 };
 
 }//namespace hlkvds
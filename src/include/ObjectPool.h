@@ -0,0 +1,83 @@
+#ifndef _HLKVDS_OBJECTPOOL_H_
+#define _HLKVDS_OBJECTPOOL_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+namespace hlkvds {
+
+// Process wide counters of the pooled write path, a benchmark reads
+// them to check that steady state inserts no longer hit the allocator.
+class PoolStat {
+public:
+    static void IncAlloc() {
+        allocCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+    static void IncReuse() {
+        reuseCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+    static uint64_t GetAllocCount() {
+        return allocCount_.load(std::memory_order_relaxed);
+    }
+    static uint64_t GetReuseCount() {
+        return reuseCount_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<uint64_t> allocCount_;
+    static std::atomic<uint64_t> reuseCount_;
+};
+
+// Bounded free list of recycled objects. Get() returns NULL on a miss,
+// the caller then constructs a new object; Put() keeps at most
+// capacity objects and deletes the rest.
+template<typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(size_t capacity) : capacity_(capacity) {
+        freeList_.reserve(capacity_);
+    }
+
+    ~ObjectPool() {
+        for (size_t i = 0; i < freeList_.size(); i++) {
+            delete freeList_[i];
+        }
+    }
+
+    T* Get() {
+        std::lock_guard<std::mutex> l(mtx_);
+        if (freeList_.empty()) {
+            PoolStat::IncAlloc();
+            return NULL;
+        }
+        T* obj = freeList_.back();
+        freeList_.pop_back();
+        PoolStat::IncReuse();
+        return obj;
+    }
+
+    void Put(T* obj) {
+        {
+            std::lock_guard<std::mutex> l(mtx_);
+            if (freeList_.size() < capacity_) {
+                freeList_.push_back(obj);
+                return;
+            }
+        }
+        delete obj;
+    }
+
+private:
+    ObjectPool(const ObjectPool &);
+    ObjectPool& operator=(const ObjectPool &);
+
+    size_t capacity_;
+    std::vector<T*> freeList_;
+    std::mutex mtx_;
+};
+
+}// namespace hlkvds
+
+#endif //#ifndef _HLKVDS_OBJECTPOOL_H_
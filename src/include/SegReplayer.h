@@ -0,0 +1,95 @@
+#ifndef _HLKVDS_SEGREPLAYER_H_
+#define _HLKVDS_SEGREPLAYER_H_
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include "IndexManager.h"
+
+namespace hlkvds {
+
+class Volume;
+
+// Crash recovery of the index. The index and the SSTs on the device are
+// those persisted at sequence number since. The head of every segment is
+// scanned, in parallel over the volumes, and the records of the segments
+// stamped since are replayed into the index in the order of their
+// segment sequence numbers, tombstones included; of two records of a key
+// the higher sequence number wins. Index entries left pointing at
+// records that are gone are dropped, then the death size of every used
+// segment is recomputed from the index.
+class SegReplayer {
+public:
+    SegReplayer(std::vector<Volume *> &vols, IndexManager *im, uint64_t since);
+    ~SegReplayer();
+
+    bool Replay();
+
+    uint32_t GetReplayedSegs() const {
+        return segLogs_.size();
+    }
+    uint64_t GetReplayedKeys() const {
+        return keyNum_;
+    }
+    uint64_t GetDroppedKeys() const {
+        return droppedNum_;
+    }
+    uint64_t GetReadBytes() const {
+        return readBytes_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // What a segment holds compared with the persisted metadata.
+    enum SegState {
+        SEG_UNCHANGED = 0, // not written since, the index may point there
+        SEG_REPLAYED,      // written since, its records are replayed
+        SEG_EMPTY          // no valid record, nothing may point there
+    };
+
+    struct SegRecord {
+        DataHeader header;
+        uint32_t head_offset;
+    };
+
+    struct SegLog {
+        Volume *vol;
+        uint32_t seg_id;
+        uint64_t timestamp;
+        uint64_t lsn;
+        std::vector<SegRecord> records;
+    };
+
+    struct VolScan {
+        std::vector<uint8_t> states;
+        std::vector<SegLog *> logs;
+    };
+
+    void scanRange(Volume *vol, uint32_t begin, uint32_t end);
+    bool scanSeg(Volume *vol, uint32_t seg_id, char *buf);
+    bool readSegRange(Volume *vol, char *buf, uint64_t phy_offset, uint32_t begin, uint32_t end);
+    void applyLog(SegLog *log);
+    bool isStaleEntry(HashEntry &entry);
+    void dropStaleEntries();
+    void recomputeLiveSize();
+
+    std::vector<Volume *> vols_;
+    std::map<int, Volume *> volMap_;
+    std::map<int, VolScan> volScans_;
+    IndexManager *idxMgr_;
+    uint64_t since_;
+
+    std::mutex mtx_;
+    std::vector<SegLog *> segLogs_;
+    bool failed_;
+
+    uint64_t keyNum_;
+    uint64_t droppedNum_;
+    std::atomic<uint64_t> readBytes_;
+};
+
+}// namespace hlkvds
+
+#endif //#ifndef _HLKVDS_SEGREPLAYER_H_
@@ -0,0 +1,72 @@
+#ifndef _HLKVDS_SEGSHARDTABLE_H_
+#define _HLKVDS_SEGSHARDTABLE_H_
+
+#include <mutex>
+#include <atomic>
+
+#include "Db_Structure.h"
+#include "ObjectPool.h"
+#include "Segment.h"
+
+namespace hlkvds {
+
+class Volume;
+class IndexManager;
+
+// One shard descriptor per cache line, so merge threads working on
+// neighbouring shards never false-share. Each shard also owns the free
+// lists its requests and segments are recycled into.
+class alignas(CACHE_LINE_SIZE) SegShard {
+public:
+    SegShard() : seg_(NULL), reqPool_(REQ_POOL_SIZE), segPool_(SEG_POOL_SIZE) {}
+
+    std::mutex mtx_;
+    std::atomic<SegForReq *> seg_;
+
+    ObjectPool<Request> reqPool_;
+    ObjectPool<SegForReq> segPool_;
+};
+
+// Fixed table of open aggregation segments, indexed by shard id.
+// The table never changes size after creation, so readers only need
+// an atomic load of the slot; the shard mutex serializes the writers
+// (merge thread and timeout thread) of a single shard.
+class SegShardTable {
+public:
+    SegShardTable(int shard_num);
+    ~SegShardTable();
+
+    int Size() const {
+        return shardNum_;
+    }
+
+    std::mutex& GetMutex(int shard_id) {
+        return shards_[shard_id].mtx_;
+    }
+
+    SegForReq* Get(int shard_id) const {
+        return shards_[shard_id].seg_.load(std::memory_order_acquire);
+    }
+
+    // Install seg into the slot and return the previous one.
+    SegForReq* Swap(int shard_id, SegForReq *seg) {
+        return shards_[shard_id].seg_.exchange(seg, std::memory_order_acq_rel);
+    }
+
+    // Pooled objects of the aggregated write path. A segment remembers
+    // its pool, IndexManager::SegReaper hands it back after reaping.
+    Request* NewRequest(int shard_id, KVSlice& slice);
+    void FreeRequest(Request *req);
+    SegForReq* NewSeg(int shard_id, Volume* vol, IndexManager* im, uint32_t timeout);
+
+private:
+    SegShardTable(const SegShardTable &);
+    SegShardTable& operator=(const SegShardTable &);
+
+    int shardNum_;
+    SegShard *shards_;
+};
+
+}// namespace hlkvds
+
+#endif //#ifndef _HLKVDS_SEGSHARDTABLE_H_
@@ -3,8 +3,10 @@
 
 #include <string>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <list>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
@@ -12,6 +14,8 @@
 #include "KeyDigestHandle.h"
 #include "Db_Structure.h"
 #include "Utils.h"
+#include "ObjectPool.h"
+#include "IoScheduler.h"
 
 namespace hlkvds {
 
@@ -24,7 +28,8 @@ class SegForReq;
 
 class SegHeaderOnDisk {
 public:
-    uint64_t timestamp;
+    uint64_t timestamp; // write time in microseconds, the age of the data
+    uint64_t lsn; // newest sequence number handed out for it, orders crash replay
     uint64_t trx_id;
     uint32_t trx_segs;
     uint32_t checksum_data;
@@ -36,7 +41,31 @@ public:
     SegHeaderOnDisk(const SegHeaderOnDisk& toBeCopied);
     SegHeaderOnDisk& operator=(const SegHeaderOnDisk& toBeCopied);
 
-    SegHeaderOnDisk(uint64_t ts, uint64_t id, uint32_t segs, uint32_t data, uint32_t len, uint32_t keys_num);
+    SegHeaderOnDisk(uint64_t ts, uint64_t seq, uint64_t id, uint32_t segs, uint32_t data, uint32_t len,
+                    uint32_t keys_num);
+};
+
+// Process wide byte counters of the segment write path: bytes that were
+// bounced through the segment buffer and bytes handed to the device
+// straight from caller memory.
+class SegWriteStat {
+public:
+    static void AddCopied(uint64_t bytes) {
+        copiedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static void AddZeroCopy(uint64_t bytes) {
+        zeroCopyBytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static uint64_t GetCopiedBytes() {
+        return copiedBytes_.load(std::memory_order_relaxed);
+    }
+    static uint64_t GetZeroCopyBytes() {
+        return zeroCopyBytes_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<uint64_t> copiedBytes_;
+    static std::atomic<uint64_t> zeroCopyBytes_;
 };
 
 class KVSlice {
@@ -51,7 +80,7 @@ public:
             const char* data, int data_len);
 
     const Kvdb_Digest& GetDigest() const {
-        return *digest_;
+        return digest_;
     }
 
     const char* GetKey() const {
@@ -84,10 +113,24 @@ public:
         return *entryGC_;
     }
 
+    // A copy of a record by GC, migration or promotion, which keeps the
+    // sequence number of the record.
+    bool IsCopy() const {
+        return entryGC_ != NULL;
+    }
+
     uint32_t GetSegId() const {
         return segId_;
     }
 
+    // A cold value is written straight to MediumTier on a multi-tier store.
+    bool IsCold() const {
+        return cold_;
+    }
+    void SetCold(bool cold) {
+        cold_ = cold;
+    }
+
     void SetKeyValue(const char* key, int key_len, const char* data, int data_len);
     void SetHashEntry(const HashEntry *hash_entry);
     void SetHashEntryBeforeGC(const HashEntry *hash_entry);
@@ -98,11 +141,12 @@ private:
     uint32_t keyLength_;
     const char* data_;
     uint16_t dataLength_;
-    Kvdb_Digest *digest_;
+    Kvdb_Digest digest_;
     HashEntry *entry_;
     uint32_t segId_;
     bool deepCopy_;
     HashEntry *entryGC_;
+    bool cold_;
 
     void copy_helper(const KVSlice& toBeCopied);
     void calcDigest();
@@ -124,6 +168,9 @@ public:
     Request& operator=(const Request& toBeCopied);
     Request(KVSlice& slice);
 
+    // Rearm a recycled request for a new slice.
+    void Reset(KVSlice& slice);
+
     KVSlice& GetSlice() const {
         return *slice_;
     }
@@ -170,7 +217,11 @@ public:
     ~SegBase();
     SegBase(const SegBase& toBeCopied);
     SegBase& operator=(const SegBase& toBeCopied);
-    SegBase(Volume* vol);
+    SegBase(Volume* vol, IndexManager* im);
+
+    // Rearm a recycled segment, the data buffer is kept when the
+    // segment size does not change.
+    void Reset(Volume* vol);
 
     bool TryPut(KVSlice* slice);
     void Put(KVSlice* slice);
@@ -200,16 +251,27 @@ public:
         return vol_;
     }
 
+    // GC and migration write their segments as background I/O.
+    void SetIoClass(IoClass cls) {
+        ioClass_ = cls;
+    }
+
 public:
     static inline size_t SizeOfSegOnDisk() {
         return sizeof(SegHeaderOnDisk);
     }
 
+protected:
+    IndexManager* idxMgr_;
+
 private:
     void copyHelper(const SegBase& toBeCopied);
     void fillEntryToSlice();
     bool _writeDataToDevice();
-    void copyToDataBuf();
+    void fillIovec();
+    void appendIovec(char *base, size_t len);
+
+    static char* getZeroBuf();
 
 private:
     int32_t segId_;
@@ -221,10 +283,13 @@ private:
 
     int32_t keyNum_;
     int32_t keyAlignedNum_;
+    uint64_t lsn_;
 
     std::list<KVSlice *> sliceList_;
 
     char *dataBuf_;
+    std::vector<struct iovec> iovs_;
+    IoClass ioClass_;
 };
 
 class SegForReq : public SegBase {
@@ -236,6 +301,16 @@ public:
 
     SegForReq(Volume* vol, IndexManager* im, uint32_t timeout);
 
+    void Reset(Volume* vol);
+
+    void SetPool(ObjectPool<SegForReq> *pool) {
+        pool_ = pool;
+    }
+
+    ObjectPool<SegForReq>* GetPool() const {
+        return pool_;
+    }
+
     bool TryPut(Request* req);
     void Put(Request* req);
     void Completion();
@@ -249,10 +324,8 @@ public:
     void CleanDeletedEntry();
 
 private:
-    IndexManager* idxMgr_;
     uint32_t timeout_;
     KVTime startTime_;
-    KVTime persistTime_;
 
     bool isCompletion_;
     bool hasReq_;
@@ -262,6 +335,8 @@ private:
 
     mutable std::mutex mtx_;
     std::list<HashEntry> delReqList_;
+
+    ObjectPool<SegForReq> *pool_;
 };
 
 class SegForSlice : public SegBase {
@@ -274,8 +349,6 @@ public:
     SegForSlice(Volume* vol, IndexManager* im);
 
     void UpdateToIndex();
-private:
-    IndexManager* idxMgr_;
 };
 
 //class SegForGC : public SegBase {
@@ -301,74 +374,62 @@ public:
     SegForMigrate(Volume* vol, IndexManager* im);
 
     void UpdateToIndex();
-private:
-    IndexManager* idxMgr_;
 };
 
-class SegLatencyFriendly {
+// Shared open segment that immediate writes are appended to. Every
+// append rewrites only the pages it touches and is durable on return;
+// the segment is accounted as used from the start but stays pinned
+// (invisible to GC and migration) until it is sealed. Callers serialize
+// on GetMutex().
+class SegAppendLog {
 public:
-    SegLatencyFriendly();
-    ~SegLatencyFriendly();
-    SegLatencyFriendly(const SegLatencyFriendly& toBeCopied);
-    SegLatencyFriendly& operator=(const SegLatencyFriendly& toBeCopied);
-    SegLatencyFriendly(Volume* vol, IndexManager* idx);
-
-    bool TryPut(KVSlice *slice);
-    void Put(KVSlice *slice);
-    bool TryPutList(std::list<KVSlice*> &slice_list);
-    void PutList(std::list<KVSlice*> &slice_list);
-
-    bool WriteSegToDevice();
+    SegAppendLog(Volume* vol, IndexManager* im);
+    ~SegAppendLog();
 
-    void UpdateToIndex();
+    std::mutex& GetMutex() {
+        return mtx_;
+    }
 
-    uint32_t GetFreeSize() const {
-        return segSize_ - SegBase::SizeOfSegOnDisk() - checksumSize_;
+    bool IsOpen() const {
+        return segId_ >= 0;
     }
 
     int32_t GetSegId() const {
         return segId_;
     }
 
-    void SegSegId(int32_t seg_id) {
-        segId_ = seg_id;
-    }
-
-    int32_t GetKeyNum() const {
-        return keyNum_;
-    }
-
-    std::list<KVSlice *>& GetSliceList() {
-        return sliceList_;
-    }
-
     Volume* GetSelfVolume() {
         return vol_;
     }
 
+    // Start a new log in an allocated segment.
+    bool Open(uint32_t seg_id);
+    bool TryPut(KVSlice* slice);
+    // Write one record and fill the hash entry of slice.
+    bool Append(KVSlice* slice);
+    // Write the final segment header and hand the segment over to GC.
+    bool Seal();
+
 private:
-    void copyHelper(const SegLatencyFriendly& toBeCopied);
-    void fillEntryToSlice();
-    bool _writeDataToDevice();
-    void copyToDataBuf();
+    SegAppendLog(const SegAppendLog &);
+    SegAppendLog& operator=(const SegAppendLog &);
+
+    bool writePages(uint32_t begin, uint32_t end);
+    void fillSegHeader();
 
 private:
     Volume* vol_;
     IndexManager* idxMgr_;
-
     int32_t segId_;
-    int32_t segSize_;
+    uint32_t segSize_;
+    uint64_t segOffset_;
 
     uint32_t headPos_;
-
     int32_t keyNum_;
-
-    uint32_t checksumSize_;
-
-    std::list<KVSlice *> sliceList_;
+    uint64_t lsn_;
 
     char *dataBuf_;
-
+    std::mutex mtx_;
 };
 
 }
@@ -5,6 +5,8 @@
 #include <vector>
 #include <mutex>
 #include <map>
+#include <set>
+#include <atomic>
 
 #include "hlkvds/Options.h"
 #include "Utils.h"
@@ -26,21 +28,28 @@ public:
     SegUseStat state;
     uint32_t free_size;
     uint32_t death_size;
+    uint32_t gc_gen;    // times the data was copied by GC, 0 for fresh writes
+    uint64_t timestamp; // last time data was written, in microseconds
 
 public:
     SegmentStat() :
-        state(SegUseStat::FREE), free_size(0), death_size(0) {
+        state(SegUseStat::FREE), free_size(0), death_size(0), gc_gen(0),
+                timestamp(0) {
     }
     ~SegmentStat() {
     }
     SegmentStat(const SegmentStat& toBeCopied) :
         state(toBeCopied.state), free_size(toBeCopied.free_size),
-                death_size(toBeCopied.death_size) {
+                death_size(toBeCopied.death_size),
+                gc_gen(toBeCopied.gc_gen),
+                timestamp(toBeCopied.timestamp) {
     }
     SegmentStat& operator=(const SegmentStat& toBeCopied) {
         state = toBeCopied.state;
         free_size = toBeCopied.free_size;
         death_size = toBeCopied.death_size;
+        gc_gen = toBeCopied.gc_gen;
+        timestamp = toBeCopied.timestamp;
         return *this;
     }
 };
@@ -62,11 +71,53 @@ public:
     bool AllocForGC(uint32_t& seg_id);
     void FreeForFailed(uint32_t seg_id);
     void FreeForGC(uint32_t seg_id);
-    void Use(uint32_t seg_id, uint32_t free_size);
+    // timestamp 0 stamps the segment with the current time, GC passes
+    // the age and the generation of the data it copied instead.
+    void Use(uint32_t seg_id, uint32_t free_size, uint64_t timestamp = 0,
+             uint32_t gc_gen = 0);
     void AddDeathSize(uint32_t seg_id, uint32_t death_size);
-
+    void UpdateFreeSize(uint32_t seg_id, uint32_t free_size);
+    uint64_t GetTimestamp(uint32_t seg_id);
+    uint32_t GetGeneration(uint32_t seg_id);
+    uint32_t GetUsedSize(uint32_t seg_id);
+
+    // Crash recovery: a segment found written since the SSTs were
+    // persisted is used again, and the death size of a used segment is
+    // recomputed from the bytes the index still points at.
+    void Recover(uint32_t seg_id, uint32_t free_size, uint64_t timestamp);
+    void SetLiveSize(uint32_t seg_id, uint64_t live_size);
+
+    // Pinned segments are used but still being appended to, they are
+    // never picked by GC or migration.
+    void Pin(uint32_t seg_id);
+    void Unpin(uint32_t seg_id);
+
+    // Live record map of each segment, one bit per possible header
+    // position (headers are at least a DataHeader apart). A bit is set
+    // while the index points at the record there, so GC and migration
+    // find the records to copy without probing the index. A segment's
+    // bitmap is allocated when it first holds a record and then reused.
+    void SetLive(uint32_t seg_id, uint32_t seg_pos);
+    void ClearLive(uint32_t seg_id, uint32_t seg_pos);
+    bool IsLive(uint32_t seg_id, uint32_t seg_pos);
+
+    // Segments freed by GC wait to be discarded on the device. Segments
+    // taken for discard stay FREE but are not allocable before
+    // DiscardDone, and are never more than half the free segments.
+    void TakeForDiscard(std::vector<uint32_t> &segs, uint32_t max_num);
+    void DiscardDone(std::vector<uint32_t> &segs);
+
+    // Victims for GC in the order they should be merged, according to
+    // options_.gc_policy. Only segments under utils are candidates, and
+    // at most GC_CANDS_MAX of them are returned.
     void SortSegsByUtils(std::multimap<uint32_t, uint32_t> &cand_map, double utils);
-    void SortSegsByTS(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t max_seg_num);
+
+    // Read heat of each segment, bumped by every read of its data and
+    // halved by DecayHeat, so it follows recent accesses.
+    void AddHeat(uint32_t seg_id);
+    void DecayHeat();
+    // Victims for migration, coldest first: least heat, then oldest data.
+    void SortSegsByHeat(std::vector<uint32_t> &cands, uint32_t max_seg_num);
 
     uint32_t GetTotalFreeSegs();
     uint32_t GetTotalUsedSegs();
@@ -74,7 +125,28 @@ public:
     SegmentManager(Options &opt, uint32_t segment_size, uint32_t segment_num, uint32_t cur_seg_id, uint32_t seg_size_bit);
     ~SegmentManager();
 
+    static uint64_t GetNowTimestamp();
+
 private:
+    uint32_t getUsedSize(uint32_t seg_id);
+
+    // Allocable segments are the set bits of freeMap_, a bit of freeSum_
+    // is set while its word of freeMap_ is not zero. Must hold mtx_.
+    void setFree(uint32_t seg_id);
+    void clearFree(uint32_t seg_id);
+    uint32_t findFree(uint32_t seg_id);
+    void sortByCostBenefit(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t thld);
+
+    // Used, unpinned segments sit in a doubly linked list per utilization
+    // bucket, updated in O(1) whenever their stat changes. Must hold mtx_.
+    uint32_t bucketOf(uint32_t used_size);
+    void refreshBucket(uint32_t seg_id);
+    void linkBucket(uint32_t seg_id, uint32_t bucket);
+    void unlinkBucket(uint32_t seg_id);
+
+    typedef std::atomic<uint64_t> LiveWord;
+    LiveWord* liveMapOf(uint32_t seg_id, bool create);
+
     std::vector<SegmentStat> segTable_;
     uint32_t segSize_;
     uint32_t segSizeBit_;
@@ -83,6 +155,22 @@ private:
     uint32_t usedCounter_;
     uint32_t freedCounter_;
     uint32_t reservedCounter_;
+    std::set<uint32_t> pinnedSegs_;
+    std::set<uint32_t> discardSegs_;
+
+    std::vector<uint32_t> bucketHead_;
+    std::vector<uint32_t> segBucket_;
+    std::vector<uint32_t> segPrev_;
+    std::vector<uint32_t> segNext_;
+
+    std::vector<uint64_t> freeMap_;
+    std::vector<uint64_t> freeSum_;
+    uint32_t discardingNum_;
+
+    std::atomic<LiveWord *> *liveMap_;
+    uint32_t liveWords_;
+
+    std::atomic<uint32_t> *segHeat_;
 
     Options &options_;
     mutable std::mutex mtx_;
@@ -123,6 +123,7 @@ public:
     void SetEntryCount(uint32_t num);
     bool SetReservedContent(char* content, uint64_t length);
     void SetDataTheorySize(uint64_t size);
+    void SetGraceCloseFlag(bool flag);
 
     SuperBlockManager(Options &opt);
     ~SuperBlockManager();
@@ -12,6 +12,7 @@
 #include "hlkvds/Status.h"
 #include "hlkvds/Write_batch.h"
 #include "Segment.h"
+#include "SegShardTable.h"
 #include "WorkQueue.h"
 #include "DataStor.h"
 
@@ -75,6 +76,9 @@ public:
     Status WriteData(KVSlice& slice, bool immediately);
     Status WriteBatchData(WriteBatch *batch);
     Status ReadData(KVSlice &slice, std::string &data);
+    // Write back a key read from MediumTier. The index takes it only if
+    // it still points where slice's entry before GC says.
+    Status PromoteData(KVSlice &slice);
 
     void ManualGC();
 
@@ -100,6 +104,7 @@ public:
 
     // Called by IndexManager
     void ModifyDeathEntry(HashEntry &entry);
+    void ModifyLiveEntry(HashEntry &entry);
 
     // Called by Iterator
     std::string GetKeyByHashEntry(HashEntry *entry);
@@ -111,6 +116,7 @@ public:
 
     // Called by Migrate
     Volume* GetVolume() { return vol_; }
+    double GetUtilRate();
 
 private:
     Options &options_;
@@ -120,9 +126,7 @@ private:
     MultiTierDS_SB_Reserved_FastTier sbResFastTier_;
 
     int shardsNum_;
-    std::mutex segMapMtx_;
-    std::map<int, SegForReq *> segMap_;
-    std::vector<std::mutex *> segMtxVec_;
+    SegShardTable *segShards_;
 
     std::mutex allocMtx_;
 
@@ -133,14 +137,15 @@ private:
     uint32_t segNum_;
 
     Volume *vol_;
+    SegAppendLog *appendLog_;
 
     Migrate *mig_;
     MediumTier *mt_;
 
 private:
-    Status writeDataAggregate(KVSlice& slice);
+    Status writeDataAggregate(KVSlice& slice, bool promote = false);
     Status writeDataImmediately(KVSlice& slice);
-    Status updateMeta(Request *req);
+    Status updateMeta(Request *req, bool promote);
 
     void deleteAllSegments();
     void initSBReservedContentForCreate();
@@ -240,6 +245,9 @@ public:
     void printDynamicInfo();
 
     Status ReadData(KVSlice &slice, std::string &data);
+    // Write a value straight to MediumTier, to the append log of the
+    // next volume in turn.
+    Status WriteData(KVSlice &slice);
 
     void ManualGC();
 
@@ -261,6 +269,7 @@ public:
 
     // Called by IndexManager
     void ModifyDeathEntry(HashEntry &entry);
+    void ModifyLiveEntry(HashEntry &entry);
 
     // Called by Iterator
     std::string GetKeyByHashEntry(HashEntry *entry);
@@ -291,6 +300,9 @@ private:
     int pickVolId_;
     std::mutex volIdMtx_;
 
+    // one append log per volume, for values written past FastTier
+    std::vector<SegAppendLog *> appendLogs_;
+
 private:
     int getVolIdFromEntry(HashEntry* entry);
     void deleteAllVolume();
@@ -20,6 +20,7 @@ public:
 
     void SetTime(time_t _time);
     time_t GetTime();
+    void SetTimeval(timeval _time);
     timeval GetTimeval();
     void Update();
 
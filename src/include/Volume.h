@@ -2,11 +2,15 @@
 #define _HLKVDS_VOLUME_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <thread>
 #include <atomic>  
 #include <map>
+#include <vector>
+#include <vector>
 
 #include "hlkvds/Options.h"
+#include "IoScheduler.h"
 
 
 namespace hlkvds {
@@ -18,6 +22,7 @@ class IndexManager;
 
 class KVSlice;
 class HashEntry;
+class KVTime;
 
 class Volume {
 public:
@@ -28,25 +33,49 @@ public:
 
     void StartThds();
     void StopThds();
+    // The discard thread alone, for volumes whose GC is not run
+    void StartDiscardThd();
+    void StopDiscardThd();
+
+    // Discard a batch of freed segments on the device.
+    void DiscardFreeSegs();
 
     bool GetSST(char* buf, uint64_t length);
     bool SetSST(char* buf, uint64_t length);
 
-    bool Read(char* data, size_t count, off_t offset);
-    bool Write(char* data, size_t count, off_t offset);
+    bool Read(char* data, size_t count, off_t offset,
+              IoClass cls = IoClass::FG_READ);
+    bool Write(char* data, size_t count, off_t offset,
+               IoClass cls = IoClass::FG_WRITE);
+    bool Writev(const struct iovec *iov, int iovcnt, off_t offset,
+                IoClass cls = IoClass::FG_WRITE);
+
+    IoScheduler* GetIoScheduler() {
+        return ioSched_;
+    }
     
     uint32_t GetTotalFreeSegs();
     uint32_t GetTotalUsedSegs();
     
     void SortSegsByUtils(std::multimap<uint32_t, uint32_t> &cand_map, double utils);
-    void SortSegsByTS(std::multimap<uint32_t, uint32_t> &cand_map, uint32_t max_seg_num);
+    void SortSegsByHeat(std::vector<uint32_t> &cands, uint32_t max_seg_num);
+    void DecayHeat();
     
     
     bool Alloc(uint32_t& seg_id);
     bool AllocForGC(uint32_t& seg_id);
     void FreeForFailed(uint32_t seg_id);
     void FreeForGC(uint32_t seg_id);
-    void Use(uint32_t seg_id, uint32_t free_size);
+    void Use(uint32_t seg_id, uint32_t free_size, uint64_t timestamp = 0,
+             uint32_t gc_gen = 0);
+    void UpdateFreeSize(uint32_t seg_id, uint32_t free_size);
+    uint64_t GetSegTimestamp(uint32_t seg_id);
+    uint32_t GetSegGeneration(uint32_t seg_id);
+    uint32_t GetSegUsedSize(uint32_t seg_id);
+    void RecoverSeg(uint32_t seg_id, uint32_t free_size, uint64_t timestamp);
+    void SetSegLiveSize(uint32_t seg_id, uint64_t live_size);
+    void Pin(uint32_t seg_id);
+    void Unpin(uint32_t seg_id);
     
     bool ForeGC();
     void FullGC();
@@ -58,6 +87,23 @@ public:
 
     int GetId() const { return volId_; }
 
+    // Segments queued or being written to this volume.
+    int GetQueueDepth();
+    int32_t GetPendingWrites() const {
+        return pendingWrites_.load(std::memory_order_relaxed);
+    }
+    void IncPendingWrites() {
+        pendingWrites_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void DecPendingWrites() {
+        pendingWrites_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // Moving average of device write latency in microseconds.
+    uint64_t GetWriteLatency() const {
+        return writeLat_.load(std::memory_order_relaxed);
+    }
+    bool IsGCRunning();
+
 //move from SegmentManager
 public:
 
@@ -91,11 +137,16 @@ public:
     bool CalcKeyOffsetPhyFromEntry(HashEntry* entry, uint64_t& key_offset);
 
     void ModifyDeathEntry(HashEntry &entry);
+    void ModifyLiveEntry(HashEntry &entry);
+    bool IsLiveEntry(HashEntry &entry);
+    // Count a read of the record of entry in its segment's heat.
+    void AddReadHeat(HashEntry &entry);
 
 private:
     BlockDevice* bdev_;
     SegmentManager* segMgr_;
     GcManager* gcMgr_;
+    IoScheduler* ioSched_;
 
     IndexManager *idxMgr_;
     Options& options_;
@@ -104,11 +155,19 @@ private:
     uint32_t segSize_;
     uint32_t segNum_;
     uint32_t segSizeBit_;
+    std::atomic<int32_t> pendingWrites_;
+    std::atomic<uint64_t> writeLat_;
 
     std::thread gcT_;
     std::atomic<bool> gcT_stop_; 
 
+    std::thread discardT_;
+    std::atomic<bool> discardT_stop_;
+    bool discardOk_;
+
     void GCThdEntry();
+    void DiscardThdEntry();
+    void updateWriteLatency(KVTime &start);
 };
 
 } //namespace hlkvds
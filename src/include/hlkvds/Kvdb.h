@@ -21,8 +21,9 @@ public:
 
     virtual ~DB();
 
+    // A cold value bypasses the fast tier of a multi-tier store.
     Status Insert(const char* key, uint32_t key_len, const char* data,
-                uint16_t length, bool immediately = false);
+                uint16_t length, bool immediately = false, bool cold = false);
     Status Delete(const char* key, uint32_t key_len);
     Status Get(const char* key, uint32_t key_len, std::string &data);
 
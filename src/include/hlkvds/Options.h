@@ -18,9 +18,30 @@ struct Options {
     double seg_full_rate;
     double gc_upper_level;
     double gc_lower_level;
+    int gc_policy;
+    int gc_generations;
+    double mig_upper_level;
+    double mig_lower_level;
+    int promote_threshold;
+    int direct_medium_size;
 
     bool aggregate_request;
 
+    // device I/O scheduling of GC and migration
+    bool io_scheduler;
+    int bg_io_rate;
+    int fg_p99_target;
+
+    // discard the blocks of segments freed by GC and migration
+    bool discard_segments;
+
+    // seconds between index checkpoints, 0 checkpoints only at close
+    int checkpoint_interval;
+
+    // open before the index is loaded, slot ranges load in the background
+    // or when a request needs them
+    bool lazy_open;
+
     //Create DB parameters
     int datastor_type;
     int hashtable_size;
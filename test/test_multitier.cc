@@ -1,7 +1,12 @@
 #include <string>
 #include <iostream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "test_new_base.h"
 #include "Utils.h"
+#include "Db_Structure.h"
 
 using namespace std;
 
@@ -177,6 +182,307 @@ TEST_F(TestMultiTier, InsertImmediately) {
     delete db;
 }
 
+TEST_F(TestMultiTier, MigrateOverWatermark) {
+    KVDS *db = Create();
+    delete db;
+
+    Options opts;
+    opts.mig_upper_level = 0.3;
+    opts.mig_lower_level = 0.1;
+    db = Open(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // a few segments of the fast tier, the first one read hot
+    int batch_num = 8;
+    int key_num = 40;
+    string value(ALIGNED_SIZE, 'v');
+    for (int b = 0; b < batch_num; b++) {
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(b * key_num + i);
+            batch.put(key.c_str(), key.size(), value.c_str(), value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            string get_data;
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+        }
+    }
+
+    // the migration thread demotes segments down to the lower watermark
+    usleep(MIG_INTERVAL_US * 10);
+
+    for (int i = 0; i < batch_num * key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(value, get_data);
+    }
+
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+    for (int i = 0; i < batch_num * key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiTier, PromoteHotKeys) {
+    KVDS *db = Create();
+    delete db;
+
+    Options opts;
+    opts.mig_upper_level = 0.3;
+    opts.mig_lower_level = 0.1;
+    db = Open(opts);
+    EXPECT_TRUE( NULL != db);
+
+    int batch_num = 8;
+    int key_num = 40;
+    string value(ALIGNED_SIZE, 'v');
+    for (int b = 0; b < batch_num; b++) {
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(b * key_num + i);
+            batch.put(key.c_str(), key.size(), value.c_str(), value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    // the oldest keys are demoted to the medium tier
+    usleep(MIG_INTERVAL_US * 10);
+
+    // read them over the threshold, overwriting every other key meanwhile,
+    // a promoted copy must never hide a newer write
+    string new_value(ALIGNED_SIZE, 'n');
+    for (int round = 0; round < PROMOTE_THRESHOLD + 2; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            string get_data;
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+            if (round == 2 && i % 2 == 0) {
+                EXPECT_TRUE(Insert(key.c_str(), key.size(), new_value.c_str(), new_value.size()).ok());
+            }
+        }
+    }
+    usleep(MIG_INTERVAL_US * 5);
+
+    for (int i = 0; i < batch_num * key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ((i < key_num && i % 2 == 0) ? new_value : value, get_data);
+    }
+
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+    for (int i = 0; i < batch_num * key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ((i < key_num && i % 2 == 0) ? new_value : value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiTier, DirectToMediumTier) {
+    KVDS *db = Create();
+    delete db;
+
+    Options opts;
+    db = Open(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // large values from concurrent writers, spread over the medium volumes
+    int thd_num = 4;
+    int key_num = 20;
+    uint16_t large_size = DIRECT_MEDIUM_SIZE + 1000;
+    vector<thread> thds;
+    for (int t = 0; t < thd_num; t++) {
+        thds.push_back(thread([this, t, key_num, large_size] {
+            for (int i = t * key_num; i < (t + 1) * key_num; i++) {
+                string key = "large-key-" + to_string(i);
+                string value(large_size, 'a' + i % 26);
+                EXPECT_TRUE(Insert(key.c_str(), key.size(), value.c_str(), value.size()).ok());
+            }
+        }));
+    }
+    for (int t = 0; t < thd_num; t++) {
+        thds[t].join();
+    }
+
+    // cold small values, and overwrites moving keys between the tiers
+    string small(ALIGNED_SIZE, 's');
+    string cold(ALIGNED_SIZE, 'c');
+    for (int i = 0; i < key_num; i++) {
+        string key = "cold-key-" + to_string(i);
+        EXPECT_TRUE(db->Insert(key.c_str(), key.size(), cold.c_str(), cold.size(), false, true).ok());
+    }
+    for (int i = 0; i < key_num; i++) {
+        string key = "large-key-" + to_string(i);
+        EXPECT_TRUE(Insert(key.c_str(), key.size(), small.c_str(), small.size()).ok());
+        key = "cold-key-" + to_string(i);
+        EXPECT_TRUE(Insert(key.c_str(), key.size(), small.c_str(), small.size()).ok());
+        EXPECT_TRUE(db->Insert(key.c_str(), key.size(), cold.c_str(), cold.size(), false, true).ok());
+    }
+
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < thd_num * key_num; i++) {
+            string key = "large-key-" + to_string(i);
+            string get_data;
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+            EXPECT_EQ(i < key_num ? small : string(large_size, 'a' + i % 26), get_data);
+        }
+        for (int i = 0; i < key_num; i++) {
+            string key = "cold-key-" + to_string(i);
+            string get_data;
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+            EXPECT_EQ(cold, get_data);
+        }
+        db = ReOpen(opts);
+        EXPECT_TRUE( NULL != db);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiTier, TieredReadCache) {
+    KVDS *db = Create();
+    delete db;
+
+    Options opts;
+    opts.disable_cache = false;
+    opts.promote_threshold = 0;
+    db = Open(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // cold keys live on the medium tier and are cached once read, hot
+    // ones stay on the fast tier and are not
+    int key_num = 40;
+    string hot(ALIGNED_SIZE, 'h');
+    string cold(ALIGNED_SIZE, 'c');
+    for (int i = 0; i < key_num; i++) {
+        string key = "hot-key-" + to_string(i);
+        EXPECT_TRUE(Insert(key.c_str(), key.size(), hot.c_str(), hot.size()).ok());
+        key = "cold-key-" + to_string(i);
+        EXPECT_TRUE(db->Insert(key.c_str(), key.size(), cold.c_str(), cold.size(), false, true).ok());
+    }
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string key = "cold-key-" + to_string(i);
+            string get_data;
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+            EXPECT_EQ(cold, get_data);
+            key = "hot-key-" + to_string(i);
+            EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+            EXPECT_EQ(hot, get_data);
+        }
+    }
+
+    // writes racing with cached reads must never leave a stale value
+    string new_value(ALIGNED_SIZE, 'n');
+    thread reader([this, key_num] {
+        for (int round = 0; round < 5; round++) {
+            for (int i = 0; i < key_num; i++) {
+                string key = "cold-key-" + to_string(i);
+                string get_data;
+                Get(key.c_str(), key.size(), get_data);
+            }
+        }
+    });
+    for (int i = 0; i < key_num; i++) {
+        string key = "cold-key-" + to_string(i);
+        if (i % 4 == 0) {
+            EXPECT_TRUE(Delete(key.c_str(), key.size()).ok());
+        } else if (i % 2 == 0) {
+            EXPECT_TRUE(Insert(key.c_str(), key.size(), new_value.c_str(), new_value.size()).ok());
+        }
+    }
+    reader.join();
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "cold-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        if (i % 4 == 0) {
+            EXPECT_TRUE(s.notfound());
+        } else {
+            EXPECT_TRUE(s.ok());
+            EXPECT_EQ(i % 2 == 0 ? new_value : cold, get_data);
+        }
+    }
+    delete db;
+}
+
+TEST_F(TestMultiTier, CrashRecovery) {
+    int key_num = 100;
+    string small_value = "small-value";
+    string cold_value(ALIGNED_SIZE, 'c');
+    string new_value(ALIGNED_SIZE, 'n');
+
+    // the child writes to both tiers, reopens cleanly, then overwrites
+    // and deletes keys and dies without closing the DB
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        bool ok = Create() != NULL;
+        Options opts;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            ok = ok && db_->Insert(key.c_str(), key.size(), i % 3 ? small_value.c_str() : cold_value.c_str(),
+                                   i % 3 ? small_value.size() : cold_value.size(), false, !(i % 3)).ok();
+        }
+        ok = ok && ReOpen(opts) != NULL;
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i += 2) {
+            string key = "test-key-" + to_string(i);
+            if (i % 4 == 0) {
+                batch.del(key.c_str(), key.size());
+            } else if (i % 8 == 2) {
+                ok = ok && Insert(key.c_str(), key.size(), new_value.c_str(), new_value.size(), true).ok();
+            } else {
+                batch.put(key.c_str(), key.size(), new_value.c_str(), new_value.size());
+            }
+        }
+        ok = ok && InsertBatch(&batch).ok();
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    Options opts;
+    KVDS *db = Open(opts);
+    ASSERT_TRUE( NULL != db);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            string get_data;
+            Status s = Get(key.c_str(), key.size(), get_data);
+            if (i % 4 == 0) {
+                EXPECT_TRUE(s.notfound());
+            } else {
+                EXPECT_TRUE(s.ok());
+                EXPECT_EQ(i % 2 == 0 ? new_value : (i % 3 ? small_value : cold_value), get_data);
+            }
+        }
+        // the recovered metadata survives a clean close
+        db = ReOpen(opts);
+        ASSERT_TRUE( NULL != db);
+    }
+    delete db;
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -1,7 +1,12 @@
 #include <string>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/algorithm/string.hpp>
 #include "test_new_base.h"
 #include "Utils.h"
+#include "Db_Structure.h"
 
 using namespace std;
 
@@ -10,6 +15,18 @@ public:
     TestMultiVolume(): TestNewBase(FILE_PATH, 0) {}
 };
 
+static uint64_t allocatedBlocks(string &path) {
+    vector<string> paths;
+    boost::split(paths, path, boost::is_any_of(","));
+    uint64_t blocks = 0;
+    for (uint32_t i = 0; i < paths.size(); i++) {
+        struct stat st;
+        EXPECT_EQ(0, stat(paths[i].c_str(), &st));
+        blocks += st.st_blocks;
+    }
+    return blocks;
+}
+
 TEST_F(TestMultiVolume, OpenDB) {
     KVDS *db = Create();
     EXPECT_TRUE( NULL != db);
@@ -177,6 +194,493 @@ TEST_F(TestMultiVolume, InsertImmediately) {
     delete db;
 }
 
+TEST_F(TestMultiVolume, InsertImmediatelyShareSegment) {
+    KVDS *db = Create();
+
+    // more immediate writes than the volumes have segments
+    int key_num = 200;
+    string test_value(ALIGNED_SIZE, 'v');
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string test_key = "test-key-" + to_string(i);
+            test_value[0] = 'a' + round;
+            Status s = Insert(test_key.c_str(), test_key.size(), test_value.c_str(), test_value.size(), true);
+            EXPECT_TRUE(s.ok());
+        }
+    }
+
+    Options opts;
+    opts.datastor_type = 0;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    for (int i = 0; i < key_num; i++) {
+        string test_key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(test_key.c_str(), test_key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(test_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, OverwriteCostBenefitGC) {
+    KVDS *db = Create();
+
+    Options opts;
+    opts.datastor_type = 0;
+    opts.gc_policy = GC_POLICY_COST_BENEFIT;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // more overwrites than the volumes can hold, GC has to run
+    int key_num = 100;
+    int batch_num = 50;
+    string test_value(ALIGNED_SIZE, 'v');
+    for (int round = 0; round < 30; round++) {
+        test_value[0] = 'a' + round;
+        for (int i = 0; i < key_num; i += batch_num) {
+            WriteBatch batch;
+            vector<string> keys;
+            for (int j = i; j < i + batch_num; j++) {
+                keys.push_back("test-key-" + to_string(j));
+            }
+            for (int j = 0; j < batch_num; j++) {
+                batch.put(keys[j].c_str(), keys[j].size(), test_value.c_str(), test_value.size());
+            }
+            Status s = InsertBatch(&batch);
+            EXPECT_TRUE(s.ok());
+        }
+    }
+
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    for (int i = 0; i < key_num; i++) {
+        string test_key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(test_key.c_str(), test_key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(test_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, HotColdGC) {
+    KVDS *db = Create();
+
+    Options opts;
+    opts.datastor_type = 0;
+    opts.gc_generations = 3;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // cold keys are written once and have to survive every GC round
+    int cold_num = 100;
+    int hot_num = 50;
+    string cold_value(ALIGNED_SIZE, 'c');
+    string hot_value(ALIGNED_SIZE, 'h');
+    vector<string> keys;
+    for (int i = 0; i < cold_num + hot_num; i++) {
+        keys.push_back("test-key-" + to_string(i));
+    }
+
+    for (int i = 0; i < cold_num; i += hot_num) {
+        WriteBatch batch;
+        for (int j = i; j < i + hot_num; j++) {
+            batch.put(keys[j].c_str(), keys[j].size(), cold_value.c_str(), cold_value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    for (int round = 0; round < 60; round++) {
+        hot_value[0] = 'a' + round % 26;
+        WriteBatch batch;
+        for (int i = cold_num; i < cold_num + hot_num; i++) {
+            batch.put(keys[i].c_str(), keys[i].size(), hot_value.c_str(), hot_value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    for (int i = 0; i < cold_num + hot_num; i++) {
+        string get_data;
+        Status s = Get(keys[i].c_str(), keys[i].size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(i < cold_num ? cold_value : hot_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, MixedSizeGC) {
+    KVDS *db = Create();
+
+    Options opts;
+    opts.datastor_type = 0;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    // small values sit inline in the header region, aligned ones at the
+    // segment tail, GC reads both kinds of extents of its victims
+    int aligned_num = 40;
+    int small_num = 200;
+    vector<string> keys;
+    vector<string> values;
+    for (int i = 0; i < aligned_num + small_num; i++) {
+        keys.push_back("test-key-" + to_string(i));
+        values.push_back(string(i < aligned_num ? ALIGNED_SIZE : 100, 'c'));
+    }
+
+    for (int round = 0; round < 80; round++) {
+        WriteBatch batch;
+        for (int i = 0; i < aligned_num + small_num; i++) {
+            // the first half of each kind stays cold after round 0
+            bool hot = (i < aligned_num) ? (i >= aligned_num / 2) : (i >= aligned_num + small_num / 2);
+            if (round > 0 && !hot) {
+                continue;
+            }
+            values[i][0] = 'a' + round % 26;
+            batch.put(keys[i].c_str(), keys[i].size(), values[i].c_str(), values[i].size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    for (int i = 0; i < aligned_num + small_num; i++) {
+        string get_data;
+        Status s = Get(keys[i].c_str(), keys[i].size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(values[i], get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, GCAfterReOpen) {
+    KVDS *db = Create();
+
+    Options opts;
+    opts.datastor_type = 0;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    int cold_num = 100;
+    int hot_num = 50;
+    string cold_value(ALIGNED_SIZE, 'c');
+    string hot_value(ALIGNED_SIZE, 'h');
+    vector<string> keys;
+    for (int i = 0; i < cold_num + hot_num; i++) {
+        keys.push_back("test-key-" + to_string(i));
+    }
+
+    // every segment written before the reopen holds cold and hot keys
+    for (int i = 0; i < cold_num; i += hot_num / 2) {
+        WriteBatch batch;
+        for (int j = i; j < i + hot_num / 2; j++) {
+            batch.put(keys[j].c_str(), keys[j].size(), cold_value.c_str(), cold_value.size());
+            int k = cold_num + j % hot_num;
+            batch.put(keys[k].c_str(), keys[k].size(), hot_value.c_str(), hot_value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    // GC has to copy the cold keys out of those segments, which relies
+    // on the live maps rebuilt on open
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    for (int round = 0; round < 60; round++) {
+        hot_value[0] = 'a' + round % 26;
+        WriteBatch batch;
+        for (int i = cold_num; i < cold_num + hot_num; i++) {
+            batch.put(keys[i].c_str(), keys[i].size(), hot_value.c_str(), hot_value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+
+    for (int i = 0; i < cold_num + hot_num; i++) {
+        string get_data;
+        Status s = Get(keys[i].c_str(), keys[i].size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(i < cold_num ? cold_value : hot_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, DiscardFreedSegs) {
+    KVDS *db = Create();
+
+    Options opts;
+    opts.datastor_type = 0;
+    db = ReOpen(opts);
+    EXPECT_TRUE( NULL != db);
+
+    int key_num = 50;
+    string value(ALIGNED_SIZE, 'v');
+    for (int round = 0; round < 20; round++) {
+        value[0] = 'a' + round;
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            batch.put(key.c_str(), key.size(), value.c_str(), value.size());
+        }
+        EXPECT_TRUE(InsertBatch(&batch).ok());
+    }
+    uint64_t before = allocatedBlocks(path_);
+
+    // segments freed by GC get their blocks punched out of the files
+    db->Do_GC();
+    uint64_t after = allocatedBlocks(path_);
+    for (int i = 0; i < 50 && after >= before; i++) {
+        usleep(DISCARD_INTERVAL_US);
+        after = allocatedBlocks(path_);
+    }
+    EXPECT_LT(after, before);
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        EXPECT_TRUE(s.ok());
+        EXPECT_EQ(value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, CrashRecovery) {
+    int key_num = 200;
+    string small_value = "small-value";
+    string large_value(ALIGNED_SIZE, 'l');
+
+    // the child writes, reopens cleanly, then overwrites and deletes keys
+    // and dies without closing the DB
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        bool ok = Create() != NULL;
+        Options opts;
+        opts.datastor_type = 0;
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            batch.put(key.c_str(), key.size(), small_value.c_str(), small_value.size());
+        }
+        ok = ok && InsertBatch(&batch).ok();
+        ok = ok && ReOpen(opts) != NULL;
+        for (int i = 0; i < key_num; i += 2) {
+            string key = "test-key-" + to_string(i);
+            if (i % 4 == 0) {
+                ok = ok && Delete(key.c_str(), key.size()).ok();
+            } else {
+                ok = ok && Insert(key.c_str(), key.size(), large_value.c_str(), large_value.size(), true).ok();
+            }
+        }
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    Options opts;
+    opts.datastor_type = 0;
+    KVDS *db = Open(opts);
+    ASSERT_TRUE( NULL != db);
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        if (i % 4 == 0) {
+            EXPECT_TRUE(s.notfound());
+        } else {
+            EXPECT_TRUE(s.ok());
+            EXPECT_EQ(i % 2 ? small_value : large_value, get_data);
+        }
+    }
+
+    // the recovered metadata survives a clean close
+    db = ReOpen(opts);
+    ASSERT_TRUE( NULL != db);
+    for (int i = 1; i < key_num; i += 2) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+        EXPECT_EQ(small_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, CrashRecoveryAfterGC) {
+    int key_num = 100;
+    string test_value(ALIGNED_SIZE, 'v');
+
+    // the child overwrites the keys until GC copies them around, then
+    // dies without closing the DB; replay must not let a copy win over
+    // a newer write of its key
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        bool ok = Create() != NULL;
+        Options opts;
+        opts.datastor_type = 0;
+        opts.gc_policy = GC_POLICY_COST_BENEFIT;
+        ok = ok && ReOpen(opts) != NULL;
+        int batch_num = 50;
+        for (int round = 0; round < 30; round++) {
+            test_value[0] = 'a' + round;
+            for (int i = 0; i < key_num; i += batch_num) {
+                WriteBatch batch;
+                vector<string> keys;
+                for (int j = i; j < i + batch_num; j++) {
+                    keys.push_back("test-key-" + to_string(j));
+                }
+                for (int j = 0; j < batch_num; j++) {
+                    batch.put(keys[j].c_str(), keys[j].size(), test_value.c_str(), test_value.size());
+                }
+                ok = ok && InsertBatch(&batch).ok();
+            }
+        }
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    Options opts;
+    opts.datastor_type = 0;
+    KVDS *db = Open(opts);
+    ASSERT_TRUE( NULL != db);
+    test_value[0] = 'a' + 29;
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        EXPECT_TRUE(Get(key.c_str(), key.size(), get_data).ok());
+        EXPECT_EQ(test_value, get_data);
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, CheckpointRecovery) {
+    int key_num = 200;
+    string small_value = "small-value";
+    string large_value(ALIGNED_SIZE, 'l');
+    Options opts;
+    opts.datastor_type = 0;
+    opts.checkpoint_interval = 1;
+
+    // the child overwrites keys, lets them be checkpointed, then deletes
+    // keys and dies without closing the DB
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        bool ok = Create() != NULL;
+        WriteBatch batch;
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            batch.put(key.c_str(), key.size(), small_value.c_str(), small_value.size());
+        }
+        ok = ok && InsertBatch(&batch).ok();
+        ok = ok && ReOpen(opts) != NULL;
+        for (int i = 2; i < key_num; i += 4) {
+            string key = "test-key-" + to_string(i);
+            ok = ok && Insert(key.c_str(), key.size(), large_value.c_str(), large_value.size(), true).ok();
+        }
+        usleep(2500000);
+        for (int i = 0; i < key_num; i += 4) {
+            string key = "test-key-" + to_string(i);
+            ok = ok && Delete(key.c_str(), key.size()).ok();
+        }
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    KVDS *db = Open(opts);
+    ASSERT_TRUE( NULL != db);
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        if (i % 4 == 0) {
+            EXPECT_TRUE(s.notfound());
+        } else {
+            EXPECT_TRUE(s.ok());
+            EXPECT_EQ(i % 4 == 2 ? large_value : small_value, get_data);
+        }
+    }
+
+    // the final checkpoint of a clean close is loaded without replay
+    db = ReOpen(opts);
+    ASSERT_TRUE( NULL != db);
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        string get_data;
+        Status s = Get(key.c_str(), key.size(), get_data);
+        if (i % 4 == 0) {
+            EXPECT_TRUE(s.notfound());
+        } else {
+            EXPECT_TRUE(s.ok());
+            EXPECT_EQ(i % 4 == 2 ? large_value : small_value, get_data);
+        }
+    }
+    delete db;
+}
+
+TEST_F(TestMultiVolume, LazyOpen) {
+    int key_num = 400;
+    string value = "lazy-value";
+    string new_value = "lazy-new-value";
+    // several ranges of slots to load
+    Options opts;
+    opts.hashtable_size = 4 * INDEX_LOAD_RANGE;
+    KVDS *db = Create(opts);
+    ASSERT_TRUE( NULL != db);
+    WriteBatch batch;
+    for (int i = 0; i < key_num; i++) {
+        string key = "test-key-" + to_string(i);
+        batch.put(key.c_str(), key.size(), value.c_str(), value.size());
+    }
+    EXPECT_TRUE(InsertBatch(&batch).ok());
+
+    // requests are served right after the open, the delta checkpoint
+    // taken while ranges are still loading is applied on the next open
+    opts.lazy_open = true;
+    opts.checkpoint_interval = 1;
+    for (int round = 0; round < 2; round++) {
+        db = ReOpen(opts);
+        ASSERT_TRUE( NULL != db);
+        for (int i = 0; i < key_num; i++) {
+            string key = "test-key-" + to_string(i);
+            string get_data;
+            Status s = Get(key.c_str(), key.size(), get_data);
+            if (round && i % 4 == 0) {
+                EXPECT_TRUE(s.notfound());
+            } else {
+                EXPECT_TRUE(s.ok());
+                EXPECT_EQ(round && i % 4 == 2 ? new_value : value, get_data);
+            }
+        }
+        if (round == 0) {
+            for (int i = 0; i < key_num; i += 2) {
+                string key = "test-key-" + to_string(i);
+                if (i % 4 == 0) {
+                    EXPECT_TRUE(Delete(key.c_str(), key.size()).ok());
+                } else {
+                    EXPECT_TRUE(Insert(key.c_str(), key.size(), new_value.c_str(), new_value.size()).ok());
+                }
+            }
+            usleep(1500000);
+        }
+    }
+    delete db;
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -10,6 +10,8 @@
 #include <algorithm>
 #include "Kvdb_Impl.h"
 #include "Utils.h"
+#include "ObjectPool.h"
+#include "Segment.h"
 #include "hlkvds/Options.h"
 
 #define SEG_UNIT_SIZE 1024
@@ -18,6 +20,8 @@
 
 #define OVERWRITE_TIMES 10
 
+static int value_size = VALUE_SIZE;
+
 using namespace std;
 using namespace hlkvds;
 
@@ -27,6 +31,7 @@ struct thread_arg {
     int key_end;
     vector<string> *key_list;
     string* data;
+    const char* value_buf;
     uint64_t *latency;
 };
 
@@ -46,6 +51,7 @@ struct benchmark_arg {
     int shards_num;
     int ds_type;
     int aggregate;
+    int value_size;
     Benchmark_Type bench_type;
 };
 
@@ -121,7 +127,7 @@ private:
 
 void usage() {
     cout << "Usage: ./Benchmark create|write|overwrite|read -f dbfile -s db_size \
--n num_records -t thread_num -seg segment_size(KB) -shards shards_num -dstype [0|1] -aggregate [0|1]" << endl;
+-n num_records -t thread_num -seg segment_size(KB) -shards shards_num -dstype [0|1] -aggregate [0|1] [-vsize value_size]" << endl;
 }
 
 int Create_DB(string filename, int db_size, int segment_K, int shards_num, int ds_type) {
@@ -182,9 +188,8 @@ void* fun_insert(void *arg) {
     vector<string> &key_list = *t_args->key_list;
     uint64_t *latency = t_args->latency;
 
-    string *value = t_args->data;
+    const char *value = t_args->value_buf;
 
-    int value_size = VALUE_SIZE;
     int key_len = KEY_SIZE;
     Status s;
 
@@ -192,7 +197,7 @@ void* fun_insert(void *arg) {
         string key = key_list[i];
         //string key = key_list[i-key_start];
         KVTime tv_start;
-        s = db->Insert(key.c_str(), key_len, value->c_str(), value_size);
+        s = db->Insert(key.c_str(), key_len, value, value_size);
         KVTime tv_end;
         latency[i - key_start] = (uint64_t)(tv_end - tv_start);
         if (!s.ok()) {
@@ -207,7 +212,14 @@ double Bench_Insert(KVDS *db, int record_num, vector<string> &key_list,
                     int thread_num, LatMgr *total_lat_mgr = NULL) {
     cout << "Start Benchmark Test: Insert , record_num = " << record_num << ", Please wait ..." << endl;
 
-    string data = string(VALUE_SIZE, 'v');
+    string data = string(value_size, 'v');
+    // page aligned so that aligned values can skip the segment buffer
+    char *value_buf = NULL;
+    if (posix_memalign((void **)&value_buf, 4096, value_size)) {
+        cout << "Allocate value buffer failed!" << endl;
+        return 0;
+    }
+    memcpy(value_buf, data.c_str(), value_size);
 
     thread_arg arglist[thread_num];
     pthread_t pidlist[thread_num];
@@ -219,9 +231,15 @@ double Bench_Insert(KVDS *db, int record_num, vector<string> &key_list,
         arglist[i].key_end = end;
         arglist[i].key_list = &key_list;
         arglist[i].data = &data;
+        arglist[i].value_buf = value_buf;
         arglist[i].latency = new uint64_t[end - start + 1];
     }
 
+    uint64_t alloc_start = PoolStat::GetAllocCount();
+    uint64_t reuse_start = PoolStat::GetReuseCount();
+    uint64_t copied_start = SegWriteStat::GetCopiedBytes();
+    uint64_t zero_copy_start = SegWriteStat::GetZeroCopyBytes();
+
     KVTime tv_start;
     for (int i = 0; i < thread_num; i++) {
         pthread_create(&pidlist[i], NULL, fun_insert, &arglist[i]);
@@ -234,6 +252,12 @@ double Bench_Insert(KVDS *db, int record_num, vector<string> &key_list,
     KVTime tv_end;
     double diff_time = (tv_end - tv_start) / 1000000.0;
 
+    uint64_t pool_allocs = PoolStat::GetAllocCount() - alloc_start;
+    uint64_t pool_reuses = PoolStat::GetReuseCount() - reuse_start;
+    uint64_t copied = SegWriteStat::GetCopiedBytes() - copied_start;
+    uint64_t zero_copy = SegWriteStat::GetZeroCopyBytes() - zero_copy_start;
+    free(value_buf);
+
     LatMgr lat_mgr;
     for (int i = 0; i < thread_num; i++) {
         lat_mgr.Push_back_batch(arglist[i].latency, record_num/thread_num);
@@ -251,7 +275,7 @@ double Bench_Insert(KVDS *db, int record_num, vector<string> &key_list,
 
     double iops = record_num / diff_time;
 
-    uint64_t total_size = (uint64_t)record_num * (KEY_SIZE + VALUE_SIZE);
+    uint64_t total_size = (uint64_t)record_num * (KEY_SIZE + value_size);
     double throughput = total_size / (diff_time * 1024 * 1024);
 
     uint64_t avg = lat_mgr.GetAvg();
@@ -266,6 +290,11 @@ double Bench_Insert(KVDS *db, int record_num, vector<string> &key_list,
     cout << "Latency Statistic(usec):   P50 = " << lat_stats.P_50 << ", P75 = "
             << lat_stats.P_75 << ", P99 = " << lat_stats.P_99 << ", P999 = "
             << lat_stats.P_999 << ", P9999 = " << lat_stats.P_9999 << endl;
+    cout << "Allocation Report      :   Pool Allocs = " << pool_allocs
+            << ", Pool Reuses = " << pool_reuses << ", Allocs Per Insert = "
+            << (double)pool_allocs / record_num << endl;
+    cout << "Copy Report            :   Copied = " << copied / (1024 * 1024)
+            << "MB, Zero-copy = " << zero_copy / (1024 * 1024) << "MB" << endl;
 
     return diff_time;
 }
@@ -306,7 +335,7 @@ void Bench_Get_Seq(KVDS *db, int record_num, vector<string> &key_list,
                     int thread_num) {
     cout << "Start Benchmark Test: Get , record_num = " << record_num << ", Please wait ..." << endl;
 
-    string data = string(VALUE_SIZE, 'v');
+    string data = string(value_size, 'v');
 
     thread_arg arglist[thread_num];
     pthread_t pidlist[thread_num];
@@ -318,6 +347,7 @@ void Bench_Get_Seq(KVDS *db, int record_num, vector<string> &key_list,
         arglist[i].key_end = end;
         arglist[i].key_list = &key_list;
         arglist[i].data = &data;
+        arglist[i].value_buf = NULL;
         arglist[i].latency = new uint64_t[end - start + 1];
     }
 
@@ -344,7 +374,7 @@ void Bench_Get_Seq(KVDS *db, int record_num, vector<string> &key_list,
 
     double iops = record_num / diff_time;
 
-    uint64_t total_size = (uint64_t)record_num * (KEY_SIZE + VALUE_SIZE);
+    uint64_t total_size = (uint64_t)record_num * (KEY_SIZE + value_size);
     double throughput = total_size / (diff_time * 1024 * 1024);
 
     uint64_t avg = lat_mgr.GetAvg();
@@ -364,7 +394,7 @@ void Bench_Get_Seq(KVDS *db, int record_num, vector<string> &key_list,
 }
 
 int Parse_Option(int argc, char** argv, benchmark_arg &bm_arg) {
-    if (argc != 18) {
+    if (argc != 18 && argc != 20) {
         cout << "Please Input all the parameters!" << endl;
         return -1;
     }
@@ -415,10 +445,19 @@ int Parse_Option(int argc, char** argv, benchmark_arg &bm_arg) {
     bm_arg.shards_num = atoi(argv[13]);
     bm_arg.ds_type = atoi(argv[15]);
     bm_arg.aggregate = atoi(argv[17]);
-    
+    bm_arg.value_size = VALUE_SIZE;
+    if (argc == 20) {
+        if (strcmp(argv[18], "-vsize") != 0) {
+            cout << "Please Input Correct parameter!" << endl;
+            return -1;
+        }
+        bm_arg.value_size = atoi(argv[19]);
+    }
+
     if (bm_arg.db_size < 0 ||  bm_arg.record_num < 0 || \
         bm_arg.thread_num < 0 || bm_arg.segment_K < 0 || \
-        bm_arg.shards_num < 1) {
+        bm_arg.shards_num < 1 || bm_arg.value_size < 1 || \
+        bm_arg.value_size > 65535) {
         cout << "Parametes error, Please Input Positive Integer!" << endl;
         return -1;
     }
@@ -498,7 +537,7 @@ void Bench_Overwrite(benchmark_arg bm_arg) {
     uint64_t total_record_num = record_num * OVERWRITE_TIMES;
     double iops = total_record_num / total_time;
 
-    uint64_t total_size = (uint64_t)total_record_num * (KEY_SIZE + VALUE_SIZE);
+    uint64_t total_size = (uint64_t)total_record_num * (KEY_SIZE + value_size);
     double throughput = total_size / (total_time * 1024 * 1024);
 
     uint64_t avg = total_lat_mgr->GetAvg();
@@ -542,6 +581,7 @@ int main(int argc, char** argv) {
         usage();
         return -1;
     }
+    value_size = bm_arg.value_size;
 
     switch(bm_arg.bench_type) {
         case CREATE:
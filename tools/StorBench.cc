@@ -0,0 +1,972 @@
+#include <string>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <condition_variable>
+#include <algorithm>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+
+#include "hlkvds/Options.h"
+#include "hlkvds/Status.h"
+#include "Db_Structure.h"
+#include "Utils.h"
+#include "BlockDevice.h"
+#include "KernelDevice.h"
+#include "SuperBlockManager.h"
+#include "IndexManager.h"
+#include "MetaStor.h"
+#include "DataStor.h"
+#include "Segment.h"
+#include "GcManager.h"
+#include "SegmentManager.h"
+
+#define SEG_UNIT_SIZE 1024
+#define KEY_SIZE 10
+#define VALUE_SIZE 4096
+
+using namespace std;
+using namespace hlkvds;
+
+// KernelDevice that serializes its writes and adds a fixed delay to
+// each of them, emulating a slow device next to fast ones. With svc_us
+// every I/O also holds one of queue depth channels for svc_us per 4K,
+// so large background I/O delays the requests queued behind it.
+class ThrottledDevice : public BlockDevice {
+public:
+    ThrottledDevice(uint32_t delay_us, uint32_t svc_us = 0) :
+        delayUs_(delay_us), svcUs_(svc_us), busy_(0), writeBytes_(0), writeNum_(0),
+        readBytes_(0) {}
+    ~ThrottledDevice() {}
+
+    int ZeroDevice() { return dev_.ZeroDevice(); }
+    int Open(std::string path, bool dsync = true) { return dev_.Open(path, dsync); }
+    void Close() { dev_.Close(); }
+
+    std::string GetDevicePath() { return dev_.GetDevicePath(); }
+    uint64_t GetDeviceCapacity() { return dev_.GetDeviceCapacity(); }
+    int GetPageSize() { return dev_.GetPageSize(); }
+    int GetBlockSize() { return dev_.GetBlockSize(); }
+    int GetQueueDepth() { return dev_.GetQueueDepth(); }
+    void SetQueueDepth(int depth) { dev_.SetQueueDepth(depth); }
+
+    ssize_t pWrite(const void* buf, size_t count, off_t offset) {
+        throttle(count);
+        serve(count);
+        return dev_.pWrite(buf, count, offset);
+    }
+    ssize_t pRead(void* buf, size_t count, off_t offset) {
+        readBytes_ += count;
+        serve(count);
+        return dev_.pRead(buf, count, offset);
+    }
+    ssize_t pWritev(const struct iovec *iov, int iovcnt, off_t offset) {
+        size_t count = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            count += iov[i].iov_len;
+        }
+        throttle(count);
+        serve(count);
+        return dev_.pWritev(iov, iovcnt, offset);
+    }
+    ssize_t pReadv(const struct iovec *iov, int iovcnt, off_t offset) {
+        size_t count = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            count += iov[i].iov_len;
+        }
+        readBytes_ += count;
+        serve(count);
+        return dev_.pReadv(iov, iovcnt, offset);
+    }
+
+    int Discard(off_t offset, size_t length) { return dev_.Discard(offset, length); }
+
+    void ClearReadCache() { dev_.ClearReadCache(); }
+
+    uint64_t GetWriteBytes() const { return writeBytes_.load(); }
+    uint64_t GetWriteNum() const { return writeNum_.load(); }
+    uint64_t GetReadBytes() const { return readBytes_.load(); }
+
+private:
+    void throttle(size_t count) {
+        writeBytes_ += count;
+        writeNum_++;
+        if (delayUs_) {
+            std::lock_guard<std::mutex> l(mtx_);
+            usleep(delayUs_);
+        }
+    }
+
+    void serve(size_t count) {
+        if (!svcUs_) {
+            return;
+        }
+        std::unique_lock<std::mutex> l(svcMtx_);
+        svcCv_.wait(l, [this] { return busy_ < dev_.GetQueueDepth(); });
+        busy_++;
+        l.unlock();
+        usleep(svcUs_ * ((count + 4095) / 4096));
+        l.lock();
+        busy_--;
+        svcCv_.notify_one();
+    }
+
+    KernelDevice dev_;
+    uint32_t delayUs_;
+    uint32_t svcUs_;
+    std::mutex mtx_;
+    std::mutex svcMtx_;
+    std::condition_variable svcCv_;
+    int busy_;
+    std::atomic<uint64_t> writeBytes_;
+    std::atomic<uint64_t> writeNum_;
+    std::atomic<uint64_t> readBytes_;
+};
+
+// The storage stack of KVDS built by hand, so the benchmark can put its
+// own devices underneath.
+class BenchStore {
+public:
+    BenchStore() : sbMgr_(NULL), idxMgr_(NULL), metaStor_(NULL), dataStor_(NULL) {}
+    ~BenchStore() {
+        Close();
+    }
+
+    bool Create(string paths, Options &opts, map<int, uint32_t> &delays,
+                uint32_t svc_us = 0) {
+        opts_ = opts;
+        if (!openDevices(paths, delays, svc_us)) {
+            return false;
+        }
+
+        sbMgr_ = new SuperBlockManager(opts_);
+        idxMgr_ = new IndexManager(sbMgr_, opts_);
+        metaStor_ = new MetaStor(paths.c_str(), bdVec_, sbMgr_, idxMgr_, opts_);
+        dataStor_ = DataStor::Create(opts_, bdVec_, sbMgr_, idxMgr_, opts_.datastor_type);
+        if (!dataStor_) {
+            return false;
+        }
+        idxMgr_->InitDataStor(dataStor_);
+        metaStor_->InitDataStor(dataStor_);
+        if (!metaStor_->CreateMetaData()) {
+            return false;
+        }
+        dataStor_->InitSegmentBuffer();
+        idxMgr_->StartThds();
+        dataStor_->StartThds();
+        metaStor_->StartThds();
+        return true;
+    }
+
+    // Open a store created before, recovering it if it was not closed.
+    bool Open(string paths, Options &opts, map<int, uint32_t> &delays,
+              uint32_t svc_us = 0) {
+        opts_ = opts;
+        if (!openDevices(paths, delays, svc_us)) {
+            return false;
+        }
+
+        sbMgr_ = new SuperBlockManager(opts_);
+        idxMgr_ = new IndexManager(sbMgr_, opts_);
+        metaStor_ = new MetaStor(paths.c_str(), bdVec_, sbMgr_, idxMgr_, opts_);
+        int datastor_type = -1;
+        if (!metaStor_->TryLoadSB(datastor_type)) {
+            return false;
+        }
+        dataStor_ = DataStor::Create(opts_, bdVec_, sbMgr_, idxMgr_, datastor_type);
+        if (!dataStor_) {
+            return false;
+        }
+        idxMgr_->InitDataStor(dataStor_);
+        metaStor_->InitDataStor(dataStor_);
+        if (!metaStor_->LoadMetaData()) {
+            return false;
+        }
+        dataStor_->InitSegmentBuffer();
+        idxMgr_->StartThds();
+        dataStor_->StartThds();
+        metaStor_->StartThds();
+        return true;
+    }
+
+    void Close() {
+        if (dataStor_) {
+            metaStor_->PersistMetaData();
+        }
+        release();
+    }
+
+    // Drop the store as a crash would, its metadata is not persisted.
+    void Crash() {
+        release();
+    }
+
+    Status Insert(const char* key, uint32_t key_len, const char* data, uint16_t length) {
+        KVSlice slice(key, key_len, data, length);
+        return dataStor_->WriteData(slice, false);
+    }
+
+    Status Get(const char* key, uint32_t key_len, string &data) {
+        KVSlice slice(key, key_len, NULL, 0);
+        if (!idxMgr_->GetHashEntry(&slice)) {
+            return Status::NotFound("Key is not found.");
+        }
+        return dataStor_->ReadData(slice, data, NULL);
+    }
+
+    void ManualGC() {
+        dataStor_->ManualGC();
+    }
+
+    uint32_t GetKeyCounter() {
+        return idxMgr_->GetKeyCounter();
+    }
+
+    uint32_t GetTotalSegNum() {
+        return dataStor_->GetTotalSegNum();
+    }
+
+    vector<ThrottledDevice *>& GetDevices() {
+        return devVec_;
+    }
+
+private:
+    bool openDevices(string paths, map<int, uint32_t> &delays, uint32_t svc_us) {
+        vector<string> fields;
+        boost::split(fields, paths, boost::is_any_of(","));
+        for (uint32_t i = 0; i < fields.size(); i++) {
+            ThrottledDevice *bdev = new ThrottledDevice(delays.count(i) ? delays[i] : 0, svc_us);
+            devVec_.push_back(bdev);
+            bdVec_.push_back(bdev);
+            if (bdev->Open(fields[i]) < 0) {
+                cout << "Open device " << fields[i] << " failed!" << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void release() {
+        if (dataStor_) {
+            metaStor_->StopThds();
+            dataStor_->StopThds();
+            idxMgr_->StopThds();
+        }
+        delete idxMgr_;
+        delete sbMgr_;
+        delete metaStor_;
+        delete dataStor_;
+        idxMgr_ = NULL;
+        sbMgr_ = NULL;
+        metaStor_ = NULL;
+        dataStor_ = NULL;
+        for (uint32_t i = 0; i < devVec_.size(); i++) {
+            delete devVec_[i];
+        }
+        devVec_.clear();
+        bdVec_.clear();
+    }
+
+    Options opts_;
+    vector<ThrottledDevice *> devVec_;
+    vector<BlockDevice *> bdVec_;
+    SuperBlockManager *sbMgr_;
+    IndexManager *idxMgr_;
+    MetaStor *metaStor_;
+    DataStor *dataStor_;
+};
+
+struct bench_arg {
+    string file_path;
+    int record_num;
+    int thread_num;
+    int segment_K;
+    int shards_num;
+    int throttle_id;
+    int delay_us;
+    int write_num;
+    int hot_rate;
+    int gc_gen;
+    int reader_num;
+    int svc_us;
+    int bg_rate;
+    int p99_target;
+
+    bench_arg() : file_path(""), record_num(10000), thread_num(16),
+        segment_K(256), shards_num(8), throttle_id(-1), delay_us(0),
+        write_num(100000), hot_rate(90), gc_gen(GC_GENERATIONS),
+        reader_num(4), svc_us(20), bg_rate(20), p99_target(FG_P99_TARGET) {}
+};
+
+void usage() {
+    cout << "Usage: ./StorBench pickvol -f dev0,dev1,... [-n num_records] [-t thread_num] \
+[-seg segment_size(KB)] [-shards shards_num] [-throttle vol_id] [-delay write_delay(us)]" << endl;
+    cout << "       ./StorBench gc -f dev0,dev1,... [-n num_records] [-w num_overwrites] \
+[-hot hot_write_rate(%)] [-gen gc_generations] [-t thread_num] [-seg segment_size(KB)] \
+[-shards shards_num]" << endl;
+    cout << "       ./StorBench gcpick [-n num_segments] [-w num_rounds] [-seg segment_size(KB)]" << endl;
+    cout << "       ./StorBench gclat -f dev0,dev1,... [-n num_records] [-w num_overwrites] \
+[-hot hot_write_rate(%)] [-r reader_num] [-svc device_us_per_4K] [-bgrate bg_budget(MB/s)] \
+[-p99 read_p99_target(us)] [-t thread_num] [-seg segment_size(KB)] [-shards shards_num]" << endl;
+    cout << "       ./StorBench mig -f fast_dev,medium_dev0,... [-n num_records] [-svc device_us_per_4K] \
+[-t thread_num] [-seg segment_size(KB)] [-shards shards_num]" << endl;
+    cout << "       ./StorBench recover -f dev0,dev1,... [-n num_records] [-w num_overwrites] \
+[-svc device_us_per_4K] [-t thread_num] [-seg segment_size(KB)] [-shards shards_num]" << endl;
+    cout << "       ./StorBench indexload -f dev [-n num_keys] [-svc device_us_per_4K]" << endl;
+}
+
+int Parse_Option(int argc, char** argv, bench_arg &arg) {
+    string cmd = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string opt = argv[i];
+        if (opt == "-f") {
+            arg.file_path = argv[i + 1];
+        } else if (opt == "-n") {
+            arg.record_num = atoi(argv[i + 1]);
+        } else if (opt == "-t") {
+            arg.thread_num = atoi(argv[i + 1]);
+        } else if (opt == "-seg") {
+            arg.segment_K = atoi(argv[i + 1]);
+        } else if (opt == "-shards") {
+            arg.shards_num = atoi(argv[i + 1]);
+        } else if (opt == "-throttle") {
+            arg.throttle_id = atoi(argv[i + 1]);
+        } else if (opt == "-delay") {
+            arg.delay_us = atoi(argv[i + 1]);
+        } else if (opt == "-w") {
+            arg.write_num = atoi(argv[i + 1]);
+        } else if (opt == "-hot") {
+            arg.hot_rate = atoi(argv[i + 1]);
+        } else if (opt == "-gen") {
+            arg.gc_gen = atoi(argv[i + 1]);
+        } else if (opt == "-r") {
+            arg.reader_num = atoi(argv[i + 1]);
+        } else if (opt == "-svc") {
+            arg.svc_us = atoi(argv[i + 1]);
+        } else if (opt == "-bgrate") {
+            arg.bg_rate = atoi(argv[i + 1]);
+        } else if (opt == "-p99") {
+            arg.p99_target = atoi(argv[i + 1]);
+        } else {
+            cout << "Unknown parameter " << opt << endl;
+            return -1;
+        }
+    }
+    if ((arg.file_path.empty() && cmd != "gcpick") || arg.record_num <= 0 || arg.thread_num <= 0 ||
+        arg.segment_K <= 0 || arg.shards_num <= 0 || arg.write_num < 0 ||
+        arg.hot_rate < 0 || arg.hot_rate > 100 || arg.gc_gen <= 0 ||
+        arg.reader_num <= 0 || arg.svc_us < 0 || arg.bg_rate < 0 || arg.p99_target < 0) {
+        cout << "Please Input Correct parameter!" << endl;
+        return -1;
+    }
+    return 0;
+}
+
+void fun_insert(BenchStore *store, int key_start, int key_end, string *value,
+                uint64_t *latency) {
+    for (int i = key_start; i < key_end; i++) {
+        char key[KEY_SIZE + 1];
+        snprintf(key, sizeof(key), "%010d", i);
+        KVTime tv_start;
+        Status s = store->Insert(key, KEY_SIZE, value->c_str(), value->size());
+        KVTime tv_end;
+        latency[i - key_start] = (uint64_t)(tv_end - tv_start);
+        if (!s.ok()) {
+            cout << "Insert key=" << key << " failed!" << endl;
+        }
+    }
+}
+
+// Aggregated inserts over several volumes, one of them throttled. Reports
+// how the segments spread over the devices next to the round robin share.
+void Bench_PickVol(bench_arg &arg) {
+    Options opts;
+    opts.datastor_type = 0;
+    opts.hashtable_size = arg.record_num * 2;
+    opts.segment_size = arg.segment_K * SEG_UNIT_SIZE;
+    opts.shards_num = arg.shards_num;
+    opts.aggregate_request = 1;
+
+    map<int, uint32_t> delays;
+    if (arg.throttle_id >= 0) {
+        delays[arg.throttle_id] = arg.delay_us;
+    }
+
+    BenchStore store;
+    if (!store.Create(arg.file_path, opts, delays)) {
+        cout << "Create store failed!" << endl;
+        return;
+    }
+
+    vector<ThrottledDevice *> &devs = store.GetDevices();
+    vector<uint64_t> bytes_start;
+    for (uint32_t i = 0; i < devs.size(); i++) {
+        bytes_start.push_back(devs[i]->GetWriteBytes());
+    }
+
+    string value(VALUE_SIZE, 'v');
+    vector<thread> thds;
+    vector<uint64_t> latency(arg.record_num);
+    int per_thd = arg.record_num / arg.thread_num;
+
+    KVTime tv_start;
+    for (int i = 0; i < arg.thread_num; i++) {
+        int start = per_thd * i;
+        int end = (i == arg.thread_num - 1) ? arg.record_num : start + per_thd;
+        thds.push_back(thread(fun_insert, &store, start, end, &value, &latency[start]));
+    }
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+    KVTime tv_end;
+    double diff_time = (tv_end - tv_start) / 1000000.0;
+
+    sort(latency.begin(), latency.end());
+    uint64_t p99 = latency[(size_t)(latency.size() * 0.99)];
+    double throughput = (double)arg.record_num * (KEY_SIZE + VALUE_SIZE) / (diff_time * 1024 * 1024);
+
+    cout << "PickVol Bench Finish. Total time: " << diff_time << "s" << endl;
+    cout << "Performance Report     :   IOPS = " << arg.record_num / diff_time
+            << ", Throughput = " << throughput << "MB/s, P99 = " << p99 << "us" << endl;
+
+    uint64_t total = 0;
+    vector<uint64_t> written;
+    for (uint32_t i = 0; i < devs.size(); i++) {
+        written.push_back(devs[i]->GetWriteBytes() - bytes_start[i]);
+        total += written[i];
+    }
+    for (uint32_t i = 0; i < devs.size(); i++) {
+        cout << "Volume[" << i << "]              :   delay = "
+                << (delays.count(i) ? delays[i] : 0) << "us, written = "
+                << written[i] / (1024 * 1024) << "MB, share = "
+                << (total ? 100.0 * written[i] / total : 0) << "%, round robin share = "
+                << 100.0 / devs.size() << "%" << endl;
+    }
+}
+
+// Overwrites where hot_rate percent of the writes go to 10% of the keys.
+void fun_overwrite(BenchStore *store, int record_num, int write_num, int hot_rate,
+                   int seed, string *value) {
+    std::mt19937 gen(seed);
+    int hot_num = std::max(record_num / 10, 1);
+    std::uniform_int_distribution<int> pct(0, 99);
+    std::uniform_int_distribution<int> hot(0, hot_num - 1);
+    std::uniform_int_distribution<int> cold(hot_num, std::max(record_num - 1, hot_num));
+    for (int i = 0; i < write_num; i++) {
+        int k = pct(gen) < hot_rate ? hot(gen) : cold(gen);
+        char key[KEY_SIZE + 1];
+        snprintf(key, sizeof(key), "%010d", k % record_num);
+        Status s = store->Insert(key, KEY_SIZE, value->c_str(), value->size());
+        if (!s.ok()) {
+            cout << "Insert key=" << key << " failed!" << endl;
+        }
+    }
+}
+
+// Fill the store once, then run a skewed overwrite workload with every GC
+// policy on a fresh store and report the write amplification of each.
+void Bench_GC(bench_arg &arg) {
+    const char *names[] = { "greedy", "cost-benefit" };
+    int policies[] = { GC_POLICY_GREEDY, GC_POLICY_COST_BENEFIT };
+    string value(VALUE_SIZE, 'v');
+    map<int, uint32_t> delays;
+
+    for (int p = 0; p < 2; p++) {
+        Options opts;
+        opts.datastor_type = 0;
+        opts.hashtable_size = arg.record_num * 2;
+        opts.segment_size = arg.segment_K * SEG_UNIT_SIZE;
+        opts.shards_num = arg.shards_num;
+        opts.aggregate_request = 1;
+        opts.gc_policy = policies[p];
+        opts.gc_generations = arg.gc_gen;
+
+        BenchStore store;
+        if (!store.Create(arg.file_path, opts, delays)) {
+            cout << "Create store failed!" << endl;
+            return;
+        }
+
+        vector<thread> thds;
+        vector<uint64_t> latency(arg.record_num);
+        int per_thd = arg.record_num / arg.thread_num;
+        for (int i = 0; i < arg.thread_num; i++) {
+            int start = per_thd * i;
+            int end = (i == arg.thread_num - 1) ? arg.record_num : start + per_thd;
+            thds.push_back(thread(fun_insert, &store, start, end, &value, &latency[start]));
+        }
+        for (uint32_t i = 0; i < thds.size(); i++) {
+            thds[i].join();
+        }
+        thds.clear();
+
+        vector<ThrottledDevice *> &devs = store.GetDevices();
+        uint64_t dev_start = 0;
+        for (uint32_t i = 0; i < devs.size(); i++) {
+            dev_start += devs[i]->GetWriteBytes();
+        }
+        uint64_t gc_start = GcManager::GetRelocatedBytes();
+        uint64_t gc_read_start = GcManager::GetReadBytes();
+
+        KVTime tv_start;
+        int write_per_thd = arg.write_num / arg.thread_num;
+        for (int i = 0; i < arg.thread_num; i++) {
+            thds.push_back(thread(fun_overwrite, &store, arg.record_num, write_per_thd,
+                                  arg.hot_rate, i + 1, &value));
+        }
+        for (uint32_t i = 0; i < thds.size(); i++) {
+            thds[i].join();
+        }
+        KVTime tv_end;
+        double diff_time = (tv_end - tv_start) / 1000000.0;
+
+        uint64_t dev_bytes = 0;
+        for (uint32_t i = 0; i < devs.size(); i++) {
+            dev_bytes += devs[i]->GetWriteBytes();
+        }
+        dev_bytes -= dev_start;
+        uint64_t gc_bytes = GcManager::GetRelocatedBytes() - gc_start;
+        uint64_t gc_read = GcManager::GetReadBytes() - gc_read_start;
+        uint64_t user_bytes = (uint64_t) write_per_thd * arg.thread_num * (KEY_SIZE + VALUE_SIZE);
+
+        cout << "GC Policy " << names[p] << ", generations " << arg.gc_gen
+                << " : time = " << diff_time
+                << "s, user = " << user_bytes / (1024 * 1024)
+                << "MB, relocated = " << gc_bytes / (1024 * 1024)
+                << "MB, gc read = " << gc_read / (1024 * 1024)
+                << "MB, device = " << dev_bytes / (1024 * 1024)
+                << "MB, WA = " << (double) (user_bytes + gc_bytes) / user_bytes
+                << ", device WA = " << (double) dev_bytes / user_bytes << endl;
+    }
+}
+
+// Cost of updating segment stats and of picking GC victims on a large
+// segment table, for each GC policy.
+void Bench_GCPick(bench_arg &arg) {
+    const char *names[] = { "greedy", "cost-benefit" };
+    int policies[] = { GC_POLICY_GREEDY, GC_POLICY_COST_BENEFIT };
+    uint32_t seg_num = arg.record_num;
+    uint32_t seg_size = arg.segment_K * SEG_UNIT_SIZE;
+    int rounds = std::max(arg.write_num / 1000, 1);
+
+    for (int p = 0; p < 2; p++) {
+        Options opts;
+        opts.gc_policy = policies[p];
+        SegmentManager segMgr(opts, seg_size, seg_num, 0, 0);
+        std::vector<SegmentStat> table(seg_num);
+        segMgr.Set((char *) &table[0], SegmentManager::SizeOfSegmentStat() * seg_num);
+
+        std::mt19937 gen(p + 1);
+        for (uint32_t i = 0; i < seg_num; i++) {
+            uint32_t seg_id;
+            segMgr.AllocForGC(seg_id);
+            segMgr.Use(seg_id, gen() % (seg_size / 4));
+        }
+
+        KVTime tv_upd_start;
+        for (int i = 0; i < arg.write_num; i++) {
+            segMgr.AddDeathSize(gen() % seg_num, ALIGNED_SIZE);
+        }
+        KVTime tv_upd_end;
+        uint64_t update_us = tv_upd_end - tv_upd_start;
+
+        uint64_t pick_us = 0;
+        size_t cands = 0;
+        for (int r = 0; r < rounds; r++) {
+            std::multimap<uint32_t, uint32_t> cand_map;
+            KVTime tv_start;
+            segMgr.SortSegsByUtils(cand_map, SEG_FULL_RATE);
+            KVTime tv_end;
+            pick_us += (tv_end - tv_start);
+            cands += cand_map.size();
+        }
+
+        cout << "GC Pick " << names[p] << " : segments = " << seg_num
+                << ", avg pick = " << (double) pick_us / rounds
+                << "us, avg candidates = " << cands / rounds
+                << ", avg stat update = " << 1000.0 * update_us / std::max(arg.write_num, 1)
+                << "ns" << endl;
+    }
+}
+
+// Random reads until stop is set, or read_num of them when it is not 0.
+void fun_read(BenchStore *store, int record_num, int read_num, std::atomic<bool> *stop,
+              int seed, vector<uint64_t> *latency) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> pick(0, record_num - 1);
+    for (int i = 0; read_num ? i < read_num : !stop->load(); i++) {
+        char key[KEY_SIZE + 1];
+        snprintf(key, sizeof(key), "%010d", pick(gen));
+        string data;
+        KVTime tv_start;
+        Status s = store->Get(key, KEY_SIZE, data);
+        KVTime tv_end;
+        latency->push_back((uint64_t)(tv_end - tv_start));
+        if (!s.ok()) {
+            cout << "Get key=" << key << " failed!" << endl;
+        }
+    }
+}
+
+// Run reader_num readers, during a full GC when gc is set, and return
+// their latencies sorted.
+vector<uint64_t> run_readers(BenchStore *store, bench_arg &arg, bool gc, uint64_t &gc_us) {
+    int idle_reads = 2000;
+    std::atomic<bool> stop(false);
+    vector<vector<uint64_t> > lats(arg.reader_num);
+    vector<thread> thds;
+    for (int i = 0; i < arg.reader_num; i++) {
+        thds.push_back(thread(fun_read, store, arg.record_num, gc ? 0 : idle_reads,
+                              &stop, i + 1, &lats[i]));
+    }
+    if (gc) {
+        KVTime tv_start;
+        store->ManualGC();
+        KVTime tv_end;
+        gc_us = tv_end - tv_start;
+        stop.store(true);
+    }
+    vector<uint64_t> all;
+    for (int i = 0; i < arg.reader_num; i++) {
+        thds[i].join();
+        all.insert(all.end(), lats[i].begin(), lats[i].end());
+    }
+    sort(all.begin(), all.end());
+    return all;
+}
+
+string lat_report(vector<uint64_t> &lat) {
+    if (lat.empty()) {
+        return "no reads";
+    }
+    stringstream ss;
+    ss << "p50 = " << lat[lat.size() / 2] << "us, p99 = " << lat[lat.size() * 99 / 100]
+            << "us, p99.9 = " << lat[lat.size() * 999 / 1000] << "us";
+    return ss.str();
+}
+
+// Read latency on an idle store and while a full GC runs, on a device
+// with emulated service time, with the I/O scheduler off, on, and on
+// with a background budget. Background GC is disabled, so the idle
+// numbers are free of GC.
+void Bench_GCLat(bench_arg &arg) {
+    const char *names[] = { "scheduler off", "scheduler on", "scheduler on, bg budget" };
+    string value(VALUE_SIZE, 'v');
+    map<int, uint32_t> delays;
+
+    for (int m = 0; m < 3; m++) {
+        Options opts;
+        opts.datastor_type = 0;
+        opts.hashtable_size = arg.record_num * 2;
+        opts.segment_size = arg.segment_K * SEG_UNIT_SIZE;
+        opts.shards_num = arg.shards_num;
+        opts.aggregate_request = 1;
+        opts.gc_upper_level = 1.0;
+        opts.io_scheduler = m > 0;
+        opts.bg_io_rate = m == 2 ? arg.bg_rate : 0;
+        opts.fg_p99_target = arg.p99_target;
+
+        BenchStore store;
+        if (!store.Create(arg.file_path, opts, delays, arg.svc_us)) {
+            cout << "Create store failed!" << endl;
+            return;
+        }
+
+        vector<thread> thds;
+        vector<uint64_t> latency(arg.record_num);
+        int per_thd = arg.record_num / arg.thread_num;
+        for (int i = 0; i < arg.thread_num; i++) {
+            int start = per_thd * i;
+            int end = (i == arg.thread_num - 1) ? arg.record_num : start + per_thd;
+            thds.push_back(thread(fun_insert, &store, start, end, &value, &latency[start]));
+        }
+        for (uint32_t i = 0; i < thds.size(); i++) {
+            thds[i].join();
+        }
+        thds.clear();
+
+        int write_per_thd = arg.write_num / arg.thread_num;
+        for (int i = 0; i < arg.thread_num; i++) {
+            thds.push_back(thread(fun_overwrite, &store, arg.record_num, write_per_thd,
+                                  arg.hot_rate, i + 1, &value));
+        }
+        for (uint32_t i = 0; i < thds.size(); i++) {
+            thds[i].join();
+        }
+
+        uint64_t gc_us = 0;
+        vector<uint64_t> idle = run_readers(&store, arg, false, gc_us);
+        uint64_t reloc_start = GcManager::GetRelocatedBytes();
+        vector<uint64_t> busy = run_readers(&store, arg, true, gc_us);
+        uint64_t reloc = GcManager::GetRelocatedBytes() - reloc_start;
+
+        cout << "GC Read Latency, " << names[m] << " :" << endl;
+        cout << "    idle    : " << lat_report(idle) << endl;
+        cout << "    full GC : " << lat_report(busy) << ", GC time = "
+                << gc_us / 1000 << "ms, relocated = " << reloc / (1024 * 1024) << "MB" << endl;
+    }
+}
+
+// Inserts into a multi-tier store several times the size of its fast
+// tier, so most of the data is migrated while writers wait for it.
+// Reports the insert rate and the write bandwidth of the medium tier.
+void Bench_Mig(bench_arg &arg) {
+    Options opts;
+    opts.datastor_type = 1;
+    opts.hashtable_size = arg.record_num * 2;
+    opts.segment_size = arg.segment_K * SEG_UNIT_SIZE;
+    opts.shards_num = arg.shards_num;
+    opts.aggregate_request = 1;
+    opts.promote_threshold = 0;
+
+    map<int, uint32_t> delays;
+    BenchStore store;
+    if (!store.Create(arg.file_path, opts, delays, arg.svc_us)) {
+        cout << "Create store failed!" << endl;
+        return;
+    }
+
+    vector<ThrottledDevice *> &devs = store.GetDevices();
+    string value(VALUE_SIZE, 'v');
+    vector<thread> thds;
+    vector<uint64_t> latency(arg.record_num);
+    int per_thd = arg.record_num / arg.thread_num;
+
+    KVTime tv_start;
+    for (int i = 0; i < arg.thread_num; i++) {
+        int start = per_thd * i;
+        int end = (i == arg.thread_num - 1) ? arg.record_num : start + per_thd;
+        thds.push_back(thread(fun_insert, &store, start, end, &value, &latency[start]));
+    }
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+    KVTime tv_end;
+    double diff_time = (tv_end - tv_start) / 1000000.0;
+
+    uint64_t mt_bytes = 0;
+    for (uint32_t i = 1; i < devs.size(); i++) {
+        mt_bytes += devs[i]->GetWriteBytes();
+    }
+    sort(latency.begin(), latency.end());
+
+    cout << "Migration, " << arg.record_num << " records :" << endl;
+    cout << "    insert  : " << (uint64_t)(arg.record_num / diff_time) << " ops/s, p99 = "
+            << latency[latency.size() * 99 / 100] << "us" << endl;
+    cout << "    medium  : " << mt_bytes / (1024 * 1024) << "MB written, "
+            << (uint64_t)(mt_bytes / diff_time / (1024 * 1024)) << "MB/s" << endl;
+}
+
+// Writes records and overwrites into a multi-volume store, drops it
+// without closing, then times the open that replays its segments.
+// Reports the scan rate and the recovery time it gives for 1 TB, then
+// the clean close and the open that loads its checkpoint only.
+void Bench_Recover(bench_arg &arg) {
+    Options opts;
+    opts.datastor_type = 0;
+    opts.hashtable_size = arg.record_num * 2;
+    opts.segment_size = arg.segment_K * SEG_UNIT_SIZE;
+    opts.shards_num = arg.shards_num;
+    opts.aggregate_request = 1;
+
+    map<int, uint32_t> delays;
+    BenchStore *store = new BenchStore();
+    if (!store->Create(arg.file_path, opts, delays, arg.svc_us)) {
+        cout << "Create store failed!" << endl;
+        delete store;
+        return;
+    }
+
+    string value(VALUE_SIZE, 'v');
+    vector<uint64_t> latency(arg.record_num);
+    vector<thread> thds;
+    int per_thd = arg.record_num / arg.thread_num;
+    for (int i = 0; i < arg.thread_num; i++) {
+        int start = per_thd * i;
+        int end = (i == arg.thread_num - 1) ? arg.record_num : start + per_thd;
+        thds.push_back(thread(fun_insert, store, start, end, &value, &latency[start]));
+    }
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+    thds.clear();
+    int write_per_thd = arg.write_num / arg.thread_num;
+    for (int i = 0; i < arg.thread_num; i++) {
+        thds.push_back(thread(fun_overwrite, store, arg.record_num, write_per_thd,
+                              arg.hot_rate, i + 1, &value));
+    }
+    for (uint32_t i = 0; i < thds.size(); i++) {
+        thds[i].join();
+    }
+    store->Crash();
+    delete store;
+
+    store = new BenchStore();
+    KVTime tv_start;
+    bool ok = store->Open(arg.file_path, opts, delays, arg.svc_us);
+    KVTime tv_end;
+    if (!ok) {
+        cout << "Recover store failed!" << endl;
+        delete store;
+        return;
+    }
+    double diff_time = (tv_end - tv_start) / 1000000.0;
+
+    uint64_t read_bytes = 0;
+    vector<ThrottledDevice *> &devs = store->GetDevices();
+    for (uint32_t i = 0; i < devs.size(); i++) {
+        read_bytes += devs[i]->GetReadBytes();
+    }
+    uint32_t seg_num = store->GetTotalSegNum();
+    double seg_rate = seg_num / diff_time;
+    double tb_segs = (double) (1ULL << 40) / opts.segment_size;
+
+    cout << "Recovery, " << arg.record_num << " records, " << seg_num << " segments :" << endl;
+    cout << "    open    : " << (uint64_t)(diff_time * 1000) << "ms, "
+            << (uint64_t) seg_rate << " segments/s, "
+            << read_bytes / (1024 * 1024) << "MB read" << endl;
+    cout << "    keys    : " << store->GetKeyCounter() << " recovered" << endl;
+    cout << "    1 TB    : " << (uint64_t)(tb_segs / seg_rate) << "s estimated for "
+            << (uint64_t) tb_segs << " segments" << endl;
+
+    KVTime close_start;
+    store->Close();
+    KVTime close_end;
+    delete store;
+
+    store = new BenchStore();
+    KVTime reopen_start;
+    ok = store->Open(arg.file_path, opts, delays, arg.svc_us);
+    KVTime reopen_end;
+    if (!ok) {
+        cout << "Reopen store failed!" << endl;
+        delete store;
+        return;
+    }
+    cout << "    close   : " << (close_end - close_start) / 1000 << "ms, reopen "
+            << (reopen_end - reopen_start) / 1000 << "ms, "
+            << store->GetKeyCounter() << " keys" << endl;
+    delete store;
+}
+
+// Writes the index image of record_num keys to the first device, then
+// times reading it alone and loading it into the hash table. Reports the
+// load rate and the open time it gives for 10M, 100M and 1B keys.
+void Bench_IndexLoad(bench_arg &arg) {
+    vector<string> paths;
+    boost::split(paths, arg.file_path, boost::is_any_of(","));
+    ThrottledDevice *bdev = new ThrottledDevice(0, arg.svc_us);
+    if (bdev->Open(paths[0]) < 0) {
+        cout << "Open device " << paths[0] << " failed!" << endl;
+        delete bdev;
+        return;
+    }
+
+    uint32_t ht_size = IndexManager::CalcHashSizeForPower2(arg.record_num * 2);
+    uint64_t length = IndexManager::CalcIndexSizeOnDevice(ht_size);
+    if (length > bdev->GetDeviceCapacity()) {
+        cout << "Device too small, " << length / (1024 * 1024) << "MB needed!" << endl;
+        delete bdev;
+        return;
+    }
+
+    // keys spread over the slots as their digests would
+    char *image;
+    if (posix_memalign((void **)&image, 4096, length) < 0) {
+        delete bdev;
+        return;
+    }
+    memset(image, 0, length);
+    time_t t = time(NULL);
+    memcpy(image, &t, KVTime::SizeOf());
+    int *counters = (int *)(image + KVTime::SizeOf());
+    std::mt19937 gen(1);
+    for (int i = 0; i < arg.record_num; i++) {
+        counters[gen() % ht_size]++;
+    }
+    uint64_t entry_size = IndexManager::SizeOfHashEntryOnDisk();
+    char *entry_ptr = (char *)(counters + ht_size);
+    for (int i = 0; i < arg.record_num; i++) {
+        memcpy(entry_ptr + entry_size * i, &i, sizeof(i));
+    }
+    for (uint64_t off = 0; off < length; off += INDEX_READ_CHUNK) {
+        uint64_t chunk = min(length - off, (uint64_t) INDEX_READ_CHUNK);
+        if ((uint64_t) bdev->pWrite(image + off, chunk, off) != chunk) {
+            cout << "Write index image failed!" << endl;
+            free(image);
+            delete bdev;
+            return;
+        }
+    }
+
+    KVTime read_start;
+    if ((uint64_t) bdev->pRead(image, length, 0) != length) {
+        cout << "Read index image failed!" << endl;
+    }
+    KVTime read_end;
+    free(image);
+
+    Options opts;
+    SuperBlockManager *sbMgr = new SuperBlockManager(opts);
+    IndexManager *idxMgr = new IndexManager(sbMgr, opts);
+    idxMgr->InitMeta(ht_size, length, 0, arg.record_num);
+    KVTime load_start;
+    bool ok = idxMgr->Load(bdev, 0, length);
+    KVTime load_end;
+    if (!ok) {
+        cout << "Load index failed!" << endl;
+    }
+    double diff_time = (load_end - load_start) / 1000000.0;
+    double key_rate = arg.record_num / diff_time;
+
+    cout << "Index load, " << arg.record_num << " keys, " << length / (1024 * 1024) << "MB :" << endl;
+    cout << "    read    : " << (read_end - read_start) / 1000 << "ms" << endl;
+    cout << "    load    : " << (uint64_t)(diff_time * 1000) << "ms, "
+            << (uint64_t) key_rate << " keys/s, " << idxMgr->GetKeyCounter() << " keys" << endl;
+    cout << "    10M     : " << (uint64_t)(1e7 / key_rate * 1000) << "ms estimated" << endl;
+    cout << "    100M    : " << (uint64_t)(1e8 / key_rate * 1000) << "ms estimated" << endl;
+    cout << "    1B      : " << (uint64_t)(1e9 / key_rate * 1000) << "ms estimated" << endl;
+    delete idxMgr;
+    delete sbMgr;
+    delete bdev;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return -1;
+    }
+
+    bench_arg arg;
+    if (Parse_Option(argc, argv, arg) < 0) {
+        usage();
+        return -1;
+    }
+
+    string cmd = argv[1];
+    if (cmd == "pickvol") {
+        Bench_PickVol(arg);
+    } else if (cmd == "gc") {
+        Bench_GC(arg);
+    } else if (cmd == "gcpick") {
+        Bench_GCPick(arg);
+    } else if (cmd == "gclat") {
+        Bench_GCLat(arg);
+    } else if (cmd == "mig") {
+        Bench_Mig(arg);
+    } else if (cmd == "recover") {
+        Bench_Recover(arg);
+    } else if (cmd == "indexload") {
+        Bench_IndexLoad(arg);
+    } else {
+        usage();
+        return -1;
+    }
+    return 0;
+}